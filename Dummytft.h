@@ -23,6 +23,8 @@
 #define dsp_getheight()     0                                      // Get height of screen
 #define dsp_update()                                               // Updates to the physical screen
 #define dsp_usesSPI()       false                                  // Does not use SPI
+#define SPECY               0                                      // No spectrum analyzer
+#define SPECH               0
 
 void* tft = NULL ;
 
@@ -2,6 +2,13 @@
 
 #include "esp32_radio.h"
 #include "esp32_vs1053.h"
+#include "esp32_ringbuf.h"
+#include "esp32_sdindex.h"
+#include "esp32_standby.h"
+#include "esp32_framesync.h"
+#include "esp32_playlist.h"
+#include "esp32_hls.h"
+#include "esp32_telemetry.h"
 // Rotary encoder stuff
 #define sv DRAM_ATTR static volatile
 sv uint16_t       clickcount = 0 ;                       // Incremented per encoder click
@@ -31,9 +38,12 @@ sv bool           longclick = false ;                    // True if longclick de
 //**************************************************************************************************
 // ID's for the items to publish to MQTT.  Is index in amqttpub[]
 enum { MQTT_IP,     MQTT_ICYNAME, MQTT_STREAMTITLE, MQTT_NOWPLAYING,
-       MQTT_PRESET, MQTT_VOLUME, MQTT_PLAYING, MQTT_PLAYLISTPOS
+       MQTT_PRESET, MQTT_VOLUME, MQTT_PLAYING, MQTT_PLAYLISTPOS,
+       MQTT_RECOVERY, MQTT_DECODER
+     } ;
+enum { MQSTRING, MQINT8, MQINT16, MQINT32,               // Type of variable to publish
+       MQDECODER                                         // Formatted by tlm.decodertext()
      } ;
-enum { MQSTRING, MQINT8, MQINT16 } ;                     // Type of variable to publish
 
 class mqttpubc                                           // For MQTT publishing
 {
@@ -47,7 +57,7 @@ class mqttpubc                                           // For MQTT publishing
     // Publication topics for MQTT.  The topic will be pefixed by "PREFIX/", where PREFIX is replaced
     // by the the mqttprefix in the preferences.
   protected:
-    mqttpub_struct amqttpub[9] =                   // Definitions of various MQTT topic to publish
+    mqttpub_struct amqttpub[11] =                  // Definitions of various MQTT topic to publish
     { // Index is equal to enum above
       { "ip",              MQSTRING, &ipaddress,        false }, // Definition for MQTT_IP
       { "icy/name",        MQSTRING, &icyname,          false }, // Definition for MQTT_ICYNAME
@@ -57,6 +67,8 @@ class mqttpubc                                           // For MQTT publishing
       { "volume" ,         MQINT8,   &ini_block.reqvol, false }, // Definition for MQTT_VOLUME
       { "playing",         MQINT8,   &playingstat,      false }, // Definition for MQTT_PLAYING
       { "playlist/pos",    MQINT16,  &playlist_num,     false }, // Definition for MQTT_PLAYLISTPOS
+      { "recovery/tta",    MQINT32,  &recov.tta,        false }, // Definition for MQTT_RECOVERY
+      { "decoder",         MQDECODER, NULL,             false }, // Definition for MQTT_DECODER
       { NULL,              0,        NULL,              false }  // End of definitions
     } ;
   public:
@@ -89,7 +101,8 @@ void mqttpubc::publishtopic()
   int         i = 0 ;                                         // Loop control
   char        topic[40] ;                                     // Topic to send
   const char* payload ;                                       // Points to payload
-  char        intvar[10] ;                                    // Space for integer parameter
+  char        intvar[12] ;                                    // Space for integer parameter
+  char        txtvar[80] ;                                    // Space for formatted text
   while ( amqttpub[i].topic )
   {
     if ( amqttpub[i].topictrigger )                           // Topic ready to send?
@@ -113,6 +126,15 @@ void mqttpubc::publishtopic()
                     *(int16_t*)amqttpub[i].payload ) ;        // Convert to array of char
           payload = intvar ;                                  // Point to this array
           break ;
+        case MQINT32 :
+          sprintf ( intvar, "%d",
+                    *(int32_t*)amqttpub[i].payload ) ;        // Convert to array of char
+          payload = intvar ;                                  // Point to this array
+          break ;
+        case MQDECODER :
+          tlm.decodertext ( txtvar, sizeof(txtvar) ) ;        // Format state of decoder now,
+          payload = txtvar ;                                  // so no String is shared
+          break ;
         default :
           continue ;                                          // Unknown data type
       }
@@ -293,18 +315,69 @@ void nvschkey ( const char* oldk, const char* newk )
 }
 
 
+//**************************************************************************************************
+//                                      S P I H I S T                                              *
+//**************************************************************************************************
+// Count a wait or hold time in a log2 histogram.  Entry n counts times below 2^n microseconds.    *
+//**************************************************************************************************
+void spihist ( uint32_t* hist, uint32_t us )
+{
+  int inx = 32 - __builtin_clz ( us | 1 ) ;                 // Number of significant bits
+
+  if ( inx >= SPIHISTSIZ )                                  // Limit to last entry
+  {
+    inx = SPIHISTSIZ - 1 ;
+  }
+  hist[inx]++ ;                                             // Count this time
+}
+
+
+//**************************************************************************************************
+//                                S P I _ H I G H E R W A I T I N G                                *
+//**************************************************************************************************
+// Check if a client with a higher priority than the given client is waiting for the SPI bus.      *
+//**************************************************************************************************
+bool spi_higherwaiting ( spiclient_t client )
+{
+  int i ;                                                   // Loop control
+
+  for ( i = 0 ; i < client ; i++ )                          // Check all higher priority clients
+  {
+    if ( spi_waiting[i] )                                   // This one waiting?
+    {
+      return true ;                                         // Yes, give it a chance
+    }
+  }
+  return false ;
+}
+
+
 //**************************************************************************************************
 //                                      C L A I M S P I                                            *
 //**************************************************************************************************
 // Claim the SPI bus.  Uses FreeRTOS semaphores.                                                   *
+// The client gives the priority.  A client will not take the bus as long as a client with a       *
+// higher priority is waiting for it.  Wait times are collected in a histogram per client.         *
 //**************************************************************************************************
-void claimSPI ( const char* p )
+void claimSPI ( const char* p, spiclient_t client )
 {
   const        TickType_t ctry = 10 ;                       // Time to wait for semaphore
   uint32_t     count = 0 ;                                  // Wait time in ticks
+  uint32_t     t0 = micros() ;                              // Start of wait
 
-  while ( xSemaphoreTake ( SPIsem, ctry ) != pdTRUE  )      // Claim SPI bus
+  portENTER_CRITICAL ( &spimux ) ;
+  spi_waiting[client]++ ;                                   // Register as waiting
+  portEXIT_CRITICAL ( &spimux ) ;
+  while ( true )
   {
+    while ( spi_higherwaiting ( client ) )                  // Let higher priority clients go first
+    {
+      vTaskDelay ( 1 ) ;
+    }
+    if ( xSemaphoreTake ( SPIsem, ctry ) == pdTRUE )        // Claim SPI bus
+    {
+      break ;                                               // Got it
+    }
     if ( count++ > 10 )
     {
       dbgprint ( "SPI semaphore not taken within %d ticks by CPU %d, id %s",
@@ -313,6 +386,13 @@ void claimSPI ( const char* p )
                  p ) ;
     }
   }
+  portENTER_CRITICAL ( &spimux ) ;
+  spi_waiting[client]-- ;                                   // Not waiting anymore
+  portEXIT_CRITICAL ( &spimux ) ;
+  spi_holder = client ;                                     // Remember owner
+  spi_holdname = p ;
+  spi_granttime = micros() ;                                // Start of grant
+  spihist ( spi_waithist[client], spi_granttime - t0 ) ;    // Count wait time
 }
 
 
@@ -320,24 +400,129 @@ void claimSPI ( const char* p )
 //                                   R E L E A S E S P I                                           *
 //**************************************************************************************************
 // Free the the SPI bus.  Uses FreeRTOS semaphores.                                                *
+// The hold time is collected in a histogram per client.                                           *
 //**************************************************************************************************
 void releaseSPI()
 {
-  xSemaphoreGive ( SPIsem ) ;                            // Release SPI bus
+  uint32_t hold = micros() - spi_granttime ;                // Time the bus was held
+
+  spihist ( spi_holdhist[spi_holder], hold ) ;              // Count hold time
+  if ( hold > spi_maxhold[spi_holder] )                     // Held too long?
+  {
+    spi_overholds[spi_holder]++ ;                           // Yes, count
+  }
+  xSemaphoreGive ( SPIsem ) ;                               // Release SPI bus
+}
+
+
+//**************************************************************************************************
+//                                      Y I E L D S P I                                            *
+//**************************************************************************************************
+// Called by the owner of the SPI bus during a long operation.  If the maximum hold time for this  *
+// client has expired and a client with a higher priority is waiting, the bus is released and     *
+// claimed again.  Returns true if the bus has been given away in the meantime.                    *
+//**************************************************************************************************
+bool yieldSPI()
+{
+  spiclient_t client = spi_holder ;                         // Current owner
+  const char* p = spi_holdname ;                            // and its id
+
+  if ( ( ( micros() - spi_granttime ) < spi_maxhold[client] ) ||
+       !spi_higherwaiting ( client ) )
+  {
+    return false ;                                          // No need to give up the bus
+  }
+  releaseSPI() ;                                            // Let the other client in
+  claimSPI ( p, client ) ;                                  // and claim again
+  return true ;
+}
+
+
+//**************************************************************************************************
+//                                      C L A I M D S P                                            *
+//**************************************************************************************************
+// Claim the display for drawing.  A display on the SPI bus claims the bus as client SPI_TFT.      *
+// Other displays take dspsem, so that spftask and spectask do not draw at the same time, while    *
+// the SPI bus stays free for the VS1053.                                                          *
+//**************************************************************************************************
+void claimDSP ( const char* p )
+{
+  if ( dsp_usesSPI() )                                      // Display on SPI bus?
+  {
+    claimSPI ( p, SPI_TFT ) ;                               // Yes, claim the bus
+  }
+  else
+  {
+    xSemaphoreTake ( dspsem, portMAX_DELAY ) ;              // No, only lock the display
+  }
+}
+
+
+//**************************************************************************************************
+//                                     R E L E A S E D S P                                         *
+//**************************************************************************************************
+// Free the display, see claimDSP().                                                               *
+//**************************************************************************************************
+void releaseDSP()
+{
+  if ( dsp_usesSPI() )                                      // Display on SPI bus?
+  {
+    releaseSPI() ;                                          // Yes, release the bus
+  }
+  else
+  {
+    xSemaphoreGive ( dspsem ) ;                             // No, unlock the display
+  }
+}
+
+
+//**************************************************************************************************
+//                                    S H O W S P I S T A T S                                      *
+//**************************************************************************************************
+// Show the wait and hold time histograms of the SPI bus clients and reset them.                   *
+//**************************************************************************************************
+void showspistats()
+{
+  const char* names[] = { "VS1053", "SD", "TFT", "other" } ; // Names of the clients
+  char        line[12 * SPIHISTSIZ + 1] ;                   // Histogram as text
+  int         i, j, k ;                                     // Loop control
+  uint32_t*   hist ;                                        // Histogram to show
+
+  dbgprint ( "SPI histograms, entry n counts times below 2^n usec:" ) ;
+  for ( i = 0 ; i < SPI_NUMCLIENTS ; i++ )
+  {
+    for ( j = 0 ; j < 2 ; j++ )                             // Wait and hold histogram
+    {
+      hist = j ? spi_holdhist[i] : spi_waithist[i] ;
+      line[0] = '\0' ;
+      for ( k = 0 ; k < SPIHISTSIZ ; k++ )
+      {
+        sprintf ( line + strlen ( line ), " %d", hist[k] ) ;
+        hist[k] = 0 ;                                       // Reset for next period
+      }
+      dbgprint ( "%-6s %s%s", names[i], j ? "hold" : "wait", line ) ;
+    }
+    dbgprint ( "%-6s held longer than %d usec: %d times",
+               names[i], spi_maxhold[i], spi_overholds[i] ) ;
+    spi_overholds[i] = 0 ;
+  }
 }
 
 
 //**************************************************************************************************
 //                                      Q U E U E F U N C                                          *
 //**************************************************************************************************
-// Queue a special function for the play task.                                                     *
+// Queue a special function for the play task.  The function will be executed as soon as all     *
+// data that is in the ringbuffer at this moment has been played.                                  *
 //**************************************************************************************************
 void queuefunc ( int func )
 {
-  qdata_struct     specchunk ;                          // Special function to queue
+  qctrl_struct     specfunc ;                           // Special function to queue
 
-  specchunk.datatyp = func ;                            // Put function in datatyp
-  xQueueSend ( dataqueue, &specchunk, 200 ) ;           // Send to queue
+  specfunc.func = func ;                                // Put function in func
+  specfunc.pos = dataring.written() ;                   // Position in datastream
+  xQueueSend ( ctrlqueue, &specfunc, 200 ) ;            // Send to queue
+  xTaskNotifyGive ( xplaytask ) ;                       // Wake up playtask
 }
 
 
@@ -498,11 +683,11 @@ char* dbgprint ( const char* format, ... )
 // track is a random one too.  Otherwise the next/previous node is choosen.                        *
 // If nodeID is "0" choose a random nodeID.                                                        *
 // Delta is +1 or -1 for next or previous track.                                                   *
-// The nodeID will be returned to the caller.                                                      *
+// The nodeID will be returned to the caller.  It is empty if curnod is unknown.                   *
 //**************************************************************************************************
 String selectnextSDnode ( String curnod, int16_t delta )
 {
-  int16_t        inx, inx2 ;                           // Position in nodelist
+  int32_t        inx ;                                 // Position in track table
 
   if ( hostreq )                                       // Host request already set?
   {
@@ -518,33 +703,21 @@ String selectnextSDnode ( String curnod, int16_t delta )
   {
     return SD_currentnode ;                            // Yes, return random nodeID
   }
+  inx = sdindex.find ( curnod.c_str() ) ;              // Get position of current nodeID in table
+  if ( inx < 0 )                                       // Known node?
+  {
+    return "" ;                                        // No, return empty nodeID
+  }
+  if ( delta > 0 )                                     // Next track?
+  {
+    inx++ ;                                            // Yes, next one
+  }
   else
   {
-    inx = SD_nodelist.indexOf ( curnod ) ;             // Get position of current nodeID in list
-    if ( delta > 0 )                                   // Next track?
-    {
-      inx += curnod.length() + 1 ;                     // Get position of next nodeID in list
-      if ( inx >= SD_nodelist.length() )               // End of list?
-      {
-        inx = 0 ;                                      // Yes, wrap around
-      }
-    }
-    else
-    {
-      if ( inx == 0 )                                  // At the begin of the list?
-      {
-        inx = SD_nodelist.length()  ;                  // Yes, goto end of list
-      }
-      inx-- ;                                          // Index of delimeter of previous node ID
-      while ( ( inx > 0 ) &&
-              ( SD_nodelist[inx - 1] != '\n' ) )
-      {
-        inx-- ;
-      }
-    }
-    inx2 = SD_nodelist.indexOf ( "\n", inx ) ;         // Find end of node ID
+    inx += SD_nodecount - 1 ;                          // No, previous one
   }
-  return SD_nodelist.substring ( inx, inx2 ) ;         // Return nodeID
+  inx %= SD_nodecount ;                                // Wrap around
+  return sdindex.nodeid ( inx ) ;                      // Return nodeID
 }
 
 
@@ -553,55 +726,34 @@ String selectnextSDnode ( String curnod, int16_t delta )
 //**************************************************************************************************
 // Translate the nodeID of a track to the full filename that can be used as a station.             *
 // If nodeID is "0" choose a random nodeID.                                                        *
+// The path is looked up in the track table of the SD index.                                       *
 //**************************************************************************************************
 String getSDfilename ( String nodeID )
 {
-  String          res ;                                    // Function result
-  File            root, file ;                             // Handle to root and directory entry
-  uint16_t        n, i ;                                   // Current seqnr and counter in directory
-  int16_t         inx ;                                    // Position in nodeID
-  const char*     p = "/" ;                                // Points to directory/file
-  uint16_t        rndnum ;                                 // Random index in SD_nodelist
-  int             nodeinx = 0 ;                            // Points to node ID in SD_nodecount
-  int             nodeinx2 ;                               // Points to end of node ID in SD_nodecount
+  char            path[SDPATHLEN] ;                        // Path of the track
+  char            title[SDTAGLEN] ;                        // Title from ID3 tag
+  char            artist[SDTAGLEN] ;                       // Artist from ID3 tag
+  int32_t         inx ;                                    // Index in track table
 
   SD_currentnode = nodeID ;                                // Save current node
   if ( nodeID == "0" )                                     // Empty parameter?
   {
     dbgprint ( "getSDfilename random choice" ) ;
-    rndnum = random ( SD_nodecount ) ;                     // Yes, choose a random node
-    for ( i = 0 ; i < rndnum ; i++ )                       // Find the node ID
-    {
-      // Search to begin of the random node by skipping lines
-      nodeinx = SD_nodelist.indexOf ( "\n", nodeinx ) + 1 ;
-    }
-    nodeinx2 = SD_nodelist.indexOf ( "\n", nodeinx ) ;     // Find end of node ID
-    nodeID = SD_nodelist.substring ( nodeinx,
-                                     nodeinx2 ) ;          // Get node ID
+    inx = random ( SD_nodecount ) ;                        // Yes, choose a random node
+  }
+  else
+  {
+    inx = sdindex.find ( nodeID.c_str() ) ;                // Find node in track table
   }
   dbgprint ( "getSDfilename requested node ID is %s",      // Show requeste node ID
              nodeID.c_str() ) ;
-  while ( ( n = nodeID.toInt() ) )                         // Next sequence in current level
+  if ( ( inx < 0 ) ||
+       !sdindex.gettrack ( inx, path, title, artist ) )    // Get path of the track
   {
-    inx = nodeID.indexOf ( "," ) ;                         // Find position of comma
-    if ( inx >= 0 )
-    {
-      nodeID = nodeID.substring ( inx + 1 ) ;              // Remove sequence in this level from nodeID
-    }
-    claimSPI ( "sdopen" ) ;                                // Claim SPI bus
-    root = SD.open ( p ) ;                                 // Open the directory (this level)
-    releaseSPI() ;                                         // Release SPI bus
-    for ( i = 1 ; i <=  n ; i++ )
-    {
-      claimSPI ( "sdopenxt" ) ;                            // Claim SPI bus
-      file = root.openNextFile() ;                         // Get next directory entry
-      releaseSPI() ;                                       // Release SPI bus
-      delay ( 10 ) ;                                       // Allow playtask
-    }
-    p = file.name() ;                                      // Points to directory- or file name
+    dbgprint ( "Track not found" ) ;
+    strcpy ( path, "/" ) ;                                 // Will fail to play
   }
-  res = String ( "localhost" ) + String ( p ) ;            // Format result
-  return res ;                                             // Return full station spec
+  return String ( "localhost" ) + String ( path ) ;        // Return full station spec
 }
 
 
@@ -633,7 +785,6 @@ int listsdtracks ( const char * dirname, int level = 0, bool send = true )
     fcount = 0 ;                                        // Yes, reset count
     memset ( SD_node, 0, sizeof(SD_node) ) ;            // And sequence counters
     SD_outbuf = String() ;                              // And output buffer
-    SD_nodelist = String() ;                            // And nodelist
     if ( !SD_okay )                                     // See if known card
     {
       if ( send )
@@ -646,7 +797,7 @@ int listsdtracks ( const char * dirname, int level = 0, bool send = true )
   oldfcount = fcount ;                                  // To see if files found in this directory
   //dbgprint ( "SD directory is %s", dirname ) ;        // Show current directory
   ldirname = strlen ( dirname ) ;                       // Length of dirname to remove from filename
-  claimSPI ( "sdopen2" ) ;                              // Claim SPI bus
+  claimSPI ( "sdopen2", SPI_SD ) ;                      // Claim SPI bus
   root = SD.open ( dirname ) ;                          // Open the current directory level
   releaseSPI() ;                                        // Release SPI bus
   if ( !root || !root.isDirectory() )                   // Success?
@@ -657,18 +808,18 @@ int listsdtracks ( const char * dirname, int level = 0, bool send = true )
   }
   while ( true )                                        // Find all mp3 files
   {
-    claimSPI ( "opennextf" ) ;                          // Claim SPI bus
+    claimSPI ( "opennextf", SPI_SD ) ;                  // Claim SPI bus
     file = root.openNextFile() ;                        // Try to open next
     releaseSPI() ;                                      // Release SPI bus
     if ( !file )
     {
       break ;                                           // End of list
     }
-    SD_node[level]++ ;                                  // Set entry sequence of current level
-    if ( file.name()[0] == '.' )                        // Skip hidden directories
+    if ( SDIndex::ishidden ( file.name() ) )            // Skip hidden files and directories,
     {
-      continue ;
+      continue ;                                        // like the index, without counting
     }
+    SD_node[level]++ ;                                  // Set entry sequence of current level
     if ( file.isDirectory() )                           // Is it a directory?
     {
       if ( level < SD_MAXDEPTH )                        // Yes, dig deeper
@@ -700,7 +851,10 @@ int listsdtracks ( const char * dirname, int level = 0, bool send = true )
                                    ldirname ) +
                        String ( "\n" ) ;
         }
-        SD_nodelist += tmpstr + String ( "\n" ) ;       // Add to nodelist
+        if ( sdindex.isbuilding() )                     // Building index for SD card?
+        {
+          sdindex.add ( SD_node, file ) ;               // Yes, add this track
+        }
         //dbgprint ( "Track: %s",                       // Show debug info
         //           file.name() + ldirname ) ;
         if ( SD_outbuf.length() > 1000 )                // Buffer full?
@@ -809,15 +963,14 @@ void listNetworks()
 //**************************************************************************************************
 //                                          T I M E R 1 0 S E C                                    *
 //**************************************************************************************************
-// Extra watchdog.  Called every 10 seconds.                                                       *
-// If totalcount has not been changed, there is a problem and playing will stop.                   *
+// Called every 10 seconds.  Measures the bitrate from the number of bytes played.                 *
+// A stalled stream is handled by recovery() in task context.                                      *
 // Note that calling timely procedures within this routine or in called functions will             *
 // cause a crash!                                                                                  *
 //**************************************************************************************************
 void IRAM_ATTR timer10sec()
 {
   static uint32_t oldtotalcount = 7321 ;          // Needed for change detection
-  static uint8_t  morethanonce = 0 ;              // Counter for succesive fails
   uint32_t        bytesplayed ;                   // Bytes send to MP3 converter
 
   if ( datamode & ( INIT | HEADER | DATA |        // Test op playing
@@ -827,32 +980,11 @@ void IRAM_ATTR timer10sec()
   {
     bytesplayed = totalcount - oldtotalcount ;    // Nunber of bytes played in the 10 seconds
     oldtotalcount = totalcount ;                  // Save for comparison in next cycle
-    if ( bytesplayed == 0 )                       // Still playing?
-    {
-      if ( morethanonce > 10 )                    // No! Happened too many times?
-      {
-        ESP.restart() ;                           // Reset the CPU, probably no return
-      }
-      if ( datamode & ( PLAYLISTDATA |            // In playlist mode?
-                        PLAYLISTINIT |
-                        PLAYLISTHEADER ) )
-      {
-        playlist_num = 0 ;                        // Yes, end of playlist
-      }
-      if ( ( morethanonce > 0 ) ||                // Happened more than once?
-           ( playlist_num > 0 ) )                 // Or playlist active?
-      {
-        datamode = STOPREQD ;                     // Stop player
-        ini_block.newpreset++ ;                   // Yes, try next channel
-      }
-      morethanonce++ ;                            // Count the fails
-    }
-    else
+    if ( bytesplayed )                            // Still playing?
     {
       //                                          // Data has been send to MP3 decoder
       // Bitrate in kbits/s is bytesplayed / 10 / 1000 * 8
       mbitrate = ( bytesplayed + 625 ) / 1250 ;   // Measured bitrate
-      morethanonce = 0 ;                          // Data seen, reset failcounter
     }
   }
 }
@@ -988,6 +1120,28 @@ void IRAM_ATTR isr_IR()
 }
 
 
+//**************************************************************************************************
+//                                          I S R _ D R E Q                                        *
+//**************************************************************************************************
+// Interrupt on the rising edge of DREQ of the VS1053.  Wakes up playtask if it is waiting for     *
+// space in the FIFO of the VS1053.                                                                *
+//**************************************************************************************************
+void IRAM_ATTR isr_dreq()
+{
+  BaseType_t       woken = pdFALSE ;                 // Higher priority task woken?
+
+  if ( dreq_armed )                                  // Playtask waiting for DREQ?
+  {
+    dreq_armed = false ;                             // Yes, notify only once
+    vTaskNotifyGiveFromISR ( xplaytask, &woken ) ;   // Wake up playtask
+    if ( woken )
+    {
+      portYIELD_FROM_ISR() ;                         // Switch to playtask immediately
+    }
+  }
+}
+
+
 //**************************************************************************************************
 //                                          I S R _ E N C _ S W I T C H                            *
 //**************************************************************************************************
@@ -1087,67 +1241,201 @@ void IRAM_ATTR isr_enc_turn()
 
 
 //**************************************************************************************************
-//                                S H O W S T R E A M T I T L E                                    *
+//                                     C O P Y F I E L D                                           *
 //**************************************************************************************************
-// Show artist and songtitle if present in metadata.                                               *
-// Show always if full=true.                                                                       *
+// Copy a part of a string to a buffer of fixed size.  The result is truncated if necessary.       *
+//**************************************************************************************************
+void copyfield ( char* dst, size_t siz, const char* src, size_t len )
+{
+  if ( len >= siz )                             // Fits in buffer?
+  {
+    len = siz - 1 ;                             // No, truncate
+  }
+  memcpy ( dst, src, len ) ;
+  dst[len] = '\0' ;
+}
+
+
 //**************************************************************************************************
-void showstreamtitle ( const char *ml, bool full = false )
+//                                  P A R S E I C Y M E T A                                        *
+//**************************************************************************************************
+// Parse a block of ICY metadata like "StreamTitle='Don McLean - American Pie';StreamUrl='';".     *
+// The block is scanned once as a list of key=value pairs, separated by a semicolon.  The value    *
+// may be quoted.  A quote inside a quoted value (like "Don't stop") is only taken as the end of   *
+// the value if a semicolon or the end of the block follows.  StreamTitle and StreamUrl are copied *
+// to title and url, other keys are skipped.  Returns true if a StreamTitle was found.             *
+//**************************************************************************************************
+bool parseicymeta ( const char* ml, char* title, char* url )
 {
-  char*             p1 ;
-  char*             p2 ;
-  char              streamtitle[150] ;           // Streamtitle from metadata
+  const char* key ;                             // Start of key
+  const char* val ;                             // Start of value
+  size_t      klen ;                            // Length of key
+  size_t      vlen ;                            // Length of value
+  bool        found = false ;                   // StreamTitle seen
 
-  if ( strstr ( ml, "StreamTitle=" ) )
+  title[0] = '\0' ;                             // No fields yet
+  url[0] = '\0' ;
+  while ( *ml )
   {
-    dbgprint ( "Streamtitle found, %d bytes", strlen ( ml ) ) ;
-    dbgprint ( ml ) ;
-    p1 = (char*)ml + 12 ;                       // Begin of artist and title
-    if ( ( p2 = strstr ( ml, ";" ) ) )          // Search for end of title
+    key = ml ;                                  // Isolate the key
+    while ( *ml && ( *ml != '=' ) && ( *ml != ';' ) )
+    {
+      ml++ ;
+    }
+    if ( *ml != '=' )                           // Key without value?
+    {
+      if ( *ml )
+      {
+        ml++ ;                                  // Yes, skip the semicolon
+      }
+      continue ;
+    }
+    klen = ml++ - key ;
+    if ( *ml == '\'' )                          // Quoted value?
+    {
+      val = ++ml ;                              // Yes, search for closing quote
+      while ( *ml && !( ( *ml == '\'' ) &&
+                        ( ( ml[1] == ';' ) || ( ml[1] == '\0' ) ) ) )
+      {
+        ml++ ;
+      }
+      vlen = ml - val ;
+      if ( *ml )
+      {
+        ml++ ;                                  // Skip closing quote
+      }
+    }
+    else
     {
-      if ( *p1 == '\'' )                        // Surrounded by quotes?
+      val = ml ;                                // Not quoted, value ends at semicolon
+      while ( *ml && ( *ml != ';' ) )
       {
-        p1++ ;
-        p2-- ;
+        ml++ ;
       }
-      *p2 = '\0' ;                              // Strip the rest of the line
+      vlen = ml - val ;
+    }
+    if ( *ml == ';' )
+    {
+      ml++ ;                                    // Skip separator
+    }
+    if ( ( klen == 11 ) && ( strncmp ( key, "StreamTitle", 11 ) == 0 ) )
+    {
+      copyfield ( title, ICYTITLESIZ, val, vlen ) ;
+      found = true ;
+    }
+    else if ( ( klen == 9 ) && ( strncmp ( key, "StreamUrl", 9 ) == 0 ) )
+    {
+      copyfield ( url, ICYURLSIZ, val, vlen ) ;
     }
-    // Save last part of string as streamtitle.  Protect against buffer overflow
-    strncpy ( streamtitle, p1, sizeof ( streamtitle ) ) ;
-    streamtitle[sizeof ( streamtitle ) - 1] = '\0' ;
   }
-  else if ( full )
+  return found ;
+}
+
+
+//**************************************************************************************************
+//                                S H O W S T R E A M T I T L E                                    *
+//**************************************************************************************************
+// Show artist and songtitle if present in metadata.                                               *
+// Show always if full=true, the text is a title from a playlist or a filename.                    *
+// The result is kept in icymeta.  The record is only changed if the title or url is different,    *
+// in that case the sequence number is incremented and true is returned.  The caller may skip      *
+// publishing to MQTT if nothing has changed.                                                      *
+//**************************************************************************************************
+bool showstreamtitle ( const char *ml, bool full = false )
+{
+  char              title[ICYTITLESIZ] ;        // Streamtitle from metadata
+  char              url[ICYURLSIZ] ;            // StreamUrl from metadata
+  char              txt[ICYTITLESIZ] ;          // Text for display
+  const char*       p ;                         // Position of artist/title separator
+
+  if ( full )
   {
     // Info probably from playlist
-    strncpy ( streamtitle, ml, sizeof ( streamtitle ) ) ;
-    streamtitle[sizeof ( streamtitle ) - 1] = '\0' ;
+    copyfield ( title, sizeof(title), ml, strlen ( ml ) ) ;
+    url[0] = '\0' ;
   }
   else
   {
-    icystreamtitle = "" ;                       // Unknown type
-    return ;                                    // Do not show
+    parseicymeta ( ml, title, url ) ;           // Get StreamTitle and StreamUrl
   }
-  // Save for status request from browser and for MQTT
-  icystreamtitle = streamtitle ;
-  if ( ( p1 = strstr ( streamtitle, " - " ) ) ) // look for artist/title separator
+  if ( ( strcmp ( title, icymeta.title ) == 0 ) && // Anything changed?
+       ( strcmp ( url, icymeta.url ) == 0 ) && !full )
   {
-    p2 = p1 + 3 ;                               // 2nd part of text at this position
-    if ( displaytype == T_NEXTION )
-    {
-      *p1++ = '\\' ;                            // Found: replace 3 characters by "\r"
-      *p1++ = 'r' ;                             // Found: replace 3 characters by "\r"
-    }
-    else
-    {
-      *p1++ = '\n' ;                            // Found: replace 3 characters by newline
-    }
-    if ( *p2 == ' ' )                           // Leading space in title?
+    return false ;                              // No, skip update
+  }
+  strcpy ( icymeta.title, title ) ;             // Save new record
+  strcpy ( icymeta.url, url ) ;
+  icymeta.seq++ ;
+  if ( ( p = strstr ( title, " - " ) ) )        // Look for artist/title separator
+  {
+    copyfield ( icymeta.artist, sizeof(icymeta.artist), title, p - title ) ;
+    p += 3 ;                                    // 2nd part of text at this position
+    if ( *p == ' ' )                            // Leading space in title?
     {
-      p2++ ;
+      p++ ;
     }
-    strcpy ( p1, p2 ) ;                         // Shift 2nd part of title 2 or 3 places
+    strcpy ( icymeta.song, p ) ;
+  }
+  else
+  {
+    icymeta.artist[0] = '\0' ;                  // No artist
+    strcpy ( icymeta.song, title ) ;
+  }
+  dbgprint ( "Streamtitle %d: %s", icymeta.seq, title ) ;
+  // Save for status request from browser and for MQTT
+  icystreamtitle = title ;
+  if ( *title == '\0' )                         // Anything to show?
+  {
+    return true ;                               // No, do not show
+  }
+  if ( *icymeta.artist )                        // Artist known?
+  {
+    snprintf ( txt, sizeof(txt), "%s%s%s",      // Yes, artist and title on separate lines
+               icymeta.artist,
+               ( displaytype == T_NEXTION ) ? "\\r" : "\n",
+               icymeta.song ) ;
   }
-  tftset ( 1, streamtitle ) ;                   // Set screen segment text middle part
+  else
+  {
+    strcpy ( txt, title ) ;
+  }
+  tftset ( 1, txt ) ;                           // Set screen segment text middle part
+  return true ;
+}
+
+
+//**************************************************************************************************
+//                                    C L E A R I C Y M E T A                                      *
+//**************************************************************************************************
+// Forget the metadata of the previous station.  The first title of the new station is always a    *
+// change then, even if it is the same text.  The counters for the statistics are kept.            *
+//**************************************************************************************************
+void clearicymeta()
+{
+  icymeta.title[0] = '\0' ;                     // No title, artist, song and url
+  icymeta.artist[0] = '\0' ;
+  icymeta.song[0] = '\0' ;
+  icymeta.url[0] = '\0' ;
+  icystreamtitle = "" ;                         // Nothing for status and MQTT
+  metaint = 0 ;                                 // No metadata interval known
+  datacount = 0 ;
+  metadrop = false ;
+}
+
+
+//**************************************************************************************************
+//                                    C O N N A B O R T                                            *
+//**************************************************************************************************
+// Abort a connection to a host that is still in progress.                                         *
+//**************************************************************************************************
+void connabort()
+{
+  if ( conn.state == CONN_CONNECT )                // Socket not yet handed over to mp3client?
+  {
+    close ( conn.fd ) ;                            // Yes, close it
+  }
+  conn.gen++ ;                                     // Ignore late DNS reply
+  conn.state = CONN_IDLE ;
 }
 
 
@@ -1155,10 +1443,17 @@ void showstreamtitle ( const char *ml, bool full = false )
 //                                    S T O P _ M P 3 C L I E N T                                  *
 //**************************************************************************************************
 // Disconnect from the server.                                                                     *
+// In fastswitch mode the connection is closed without flushing and waiting.                       *
 //**************************************************************************************************
 void stop_mp3client ()
 {
-
+  connabort() ;                                    // Abort connect in progress
+  hls.stop() ;                                     // Stop HLS downloads
+  if ( ini_block.fastswitch )                      // Fast station switching?
+  {
+    mp3client.stop() ;                             // Yes, just close the socket
+    return ;
+  }
   while ( mp3client.connected() )
   {
     dbgprint ( "Stopping client" ) ;               // Stop connection to host
@@ -1171,73 +1466,552 @@ void stop_mp3client ()
 }
 
 
+//**************************************************************************************************
+//                                    C O N N D N S _ C B                                          *
+//**************************************************************************************************
+// Callback for dns_gethostbyname().  Runs in the TCP/IP task.                                     *
+//**************************************************************************************************
+void conndns_cb ( const char* name, const ip_addr_t* ipaddr, void* arg )
+{
+  if ( (uint32_t)arg != conn.gen )                 // Reply for an old request?
+  {
+    return ;                                       // Yes, ignore
+  }
+  if ( ipaddr )                                    // Lookup succeeded?
+  {
+    conn.ip = *ipaddr ;                            // Yes, save IP address
+  }
+  else
+  {
+    conn.dnsfail = true ;                          // No, signal failure
+  }
+  conn.dnsdone = true ;
+}
+
+
+//**************************************************************************************************
+//                                    S P L I T H O S T                                            *
+//**************************************************************************************************
+// Split an URL like "skonto.ls.lv:8002/mp3" in host, port and extension.                          *
+//**************************************************************************************************
+void splithost ( const String& h, String& hostwoext, uint16_t& port, String& extension )
+{
+  int         inx ;                                 // Position of ":" in hostname
+
+  port = 80 ;                                       // Default port number
+  extension = "/" ;                                 // Default extension
+  hostwoext = h ;                                   // Host without extension and portnumber
+  // In the URL there may be an extension, like noisefm.ru:8000/play.m3u&t=.m3u
+  inx = h.indexOf ( "/" ) ;                         // Search for begin of extension
+  if ( inx > 0 )                                    // Is there an extension?
+  {
+    extension = h.substring ( inx ) ;               // Yes, change the default
+    hostwoext = h.substring ( 0, inx ) ;            // Host without extension
+  }
+  // In the host there may be a portnumber
+  inx = hostwoext.indexOf ( ":" ) ;                 // Search for separator
+  if ( inx >= 0 )                                   // Portnumber available?
+  {
+    port = h.substring ( inx + 1 ).toInt() ;        // Get portnumber as integer
+    hostwoext = h.substring ( 0, inx ) ;            // Host without portnumber
+  }
+}
+
+
 //**************************************************************************************************
 //                                    C O N N E C T T O H O S T                                    *
 //**************************************************************************************************
 // Connect to the Internet radio server specified by newpreset.                                    *
+// Only the connection is started here.  The rest is done by handleconnect(), so that loop() will  *
+// never be blocked by a slow DNS server or an unreachable host.                                   *
 //**************************************************************************************************
 bool connecttohost()
 {
-  int         inx ;                                 // Position of ":" in hostname
-  uint16_t    port = 80 ;                           // Port number for host
-  String      extension = "/" ;                     // May be like "/mp3" in "skonto.ls.lv:8002/mp3"
-  String      hostwoext = host ;                    // Host without extension and portnumber
-  String      auth  ;                               // For basic authentication
+  uint16_t    port ;                                // Port number for host
+  String      extension ;                           // May be like "/mp3" in "skonto.ls.lv:8002/mp3"
+  String      hostwoext ;                           // Host without extension and portnumber
+  err_t       err ;                                 // Result of DNS request
 
   stop_mp3client() ;                                // Disconnect if still connected
   dbgprint ( "Connect to new host %s", host.c_str() ) ;
+  clearicymeta() ;                                  // Metadata of old host is not valid
   tftset ( 0, "ESP32-Radio" ) ;                     // Set screen segment text top line
   displaytime ( "" ) ;                              // Clear time on TFT screen
   datamode = INIT ;                                 // Start default in metamode
   chunked = false ;                                 // Assume not chunked
-  if ( host.endsWith ( ".m3u" ) )                   // Is it an m3u playlist?
+  if ( host.endsWith ( ".m3u8" ) )                  // Is it a HLS stream?
+  {
+    hls.start ( host ) ;                            // Yes, segments are downloaded by hls
+    datamode = DATA ;                               // No headers or metadata in the audio
+    queuefunc ( QSTARTSONG ) ;                      // Queue a request to start song
+    return true ;
+  }
+  if ( host.endsWith ( ".m3u" ) ||                 // Is it an m3u playlist?
+       host.endsWith ( ".pls" ) )                   // Or a pls playlist?
   {
     playlist = host ;                               // Save copy of playlist URL
-    datamode = PLAYLISTINIT ;                       // Yes, start in PLAYLIST mode
     if ( playlist_num == 0 )                        // First entry to play?
     {
       playlist_num = 1 ;                            // Yes, set index
     }
+    if ( plcache.isvalid ( playlist ) )             // Entries known from earlier download?
+    {
+      dbgprint ( "Playlist from cache, entry %d", playlist_num ) ;
+      plcache.hit() ;                               // Yes, count for statistics
+      return playentry() ;                          // And connect to the entry directly
+    }
+    plcache.begin ( playlist ) ;                    // No, download and parse the playlist
+    datamode = PLAYLISTINIT ;                       // Start in PLAYLIST mode
     dbgprint ( "Playlist request, entry %d", playlist_num ) ;
   }
-  // In the URL there may be an extension, like noisefm.ru:8000/play.m3u&t=.m3u
-  inx = host.indexOf ( "/" ) ;                      // Search for begin of extension
-  if ( inx > 0 )                                    // Is there an extension?
+  splithost ( host, hostwoext, port, extension ) ;  // Get host, port and extension
+  dbgprint ( "Connect to %s on port %d, extension %s",
+             hostwoext.c_str(), port, extension.c_str() ) ;
+  conn.hostwoext = hostwoext ;                      // Save for handleconnect()
+  conn.port = port ;
+  conn.extension = extension ;
+  conn.dnsdone = false ;
+  conn.dnsfail = false ;
+  conn.state = CONN_RESOLVE ;                       // Start with DNS lookup
+  conn.t0 = millis() ;
+  err = dns_gethostbyname ( hostwoext.c_str(), &conn.ip,
+                            conndns_cb, (void*)conn.gen ) ;
+  if ( err == ERR_OK )                              // IP address or cached?
+  {
+    conn.dnsdone = true ;                           // Yes, result is available now
+  }
+  else if ( err != ERR_INPROGRESS )                 // Lookup started?
+  {
+    dbgprint ( "Request %s failed!", host.c_str() ) ;
+    conn.state = CONN_IDLE ;                        // No, give up
+    return false ;
+  }
+  return true ;
+}
+
+
+//**************************************************************************************************
+//                                     P L A Y E N T R Y                                           *
+//**************************************************************************************************
+// Connect to entry playlist_num of the playlist in plcache.  At the end of the playlist the next  *
+// preset is selected and false is returned.                                                       *
+//**************************************************************************************************
+bool playentry()
+{
+  bool res ;                                        // Result of connecttohost()
+
+  if ( ( playlist_num < 1 ) ||                      // Entry in playlist?
+       ( playlist_num > plcache.getcount() ) )
   {
-    extension = host.substring ( inx ) ;            // Yes, change the default
-    hostwoext = host.substring ( 0, inx ) ;         // Host without extension
+    dbgprint ( "End of playlist seen" ) ;           // No, go to next preset
+    playlist_num = 0 ;                              // And reset
+    datamode = STOPPED ;
+    ini_block.newpreset++ ;
+    return false ;
   }
-  // In the host there may be a portnumber
-  inx = hostwoext.indexOf ( ":" ) ;                 // Search for separator
-  if ( inx >= 0 )                                   // Portnumber available?
+  dbgprint ( "Entry %d in playlist is %s", playlist_num,
+             plcache.geturl ( playlist_num ) ) ;
+  mqttpub.trigger ( MQTT_PLAYLISTPOS ) ;            // Playlistposition to MQTT
+  host = plcache.geturl ( playlist_num ) ;          // Connect to the entry
+  res = connecttohost() ;
+  host = playlist ;                                 // Back to the playlist host
+  if ( *plcache.gettitle ( playlist_num ) )         // Title known?
   {
-    port = host.substring ( inx + 1 ).toInt() ;     // Get portnumber as integer
-    hostwoext = host.substring ( 0, inx ) ;         // Host without portnumber
+    showstreamtitle ( plcache.gettitle ( playlist_num ), true ) ;
+    mqttpub.trigger ( MQTT_STREAMTITLE ) ;          // Request publishing to MQTT
   }
-  dbgprint ( "Connect to %s on port %d, extension %s",
-             hostwoext.c_str(), port, extension.c_str() ) ;
-  if ( mp3client.connect ( hostwoext.c_str(), port ) )
+  return res ;
+}
+
+
+//**************************************************************************************************
+//                                    S O C K S T A R T                                            *
+//**************************************************************************************************
+// Start a non-blocking connect to a host.  Returns the socket or -1 on failure.                   *
+//**************************************************************************************************
+int sockstart ( const ip_addr_t* ip, uint16_t port )
+{
+  struct sockaddr_in sa ;                            // Address of host
+  int                fd ;                            // The new socket
+
+  fd = socket ( AF_INET, SOCK_STREAM, IPPROTO_TCP ) ;
+  if ( fd < 0 )
   {
-    dbgprint ( "Connected to server" ) ;
-    auth = nvsgetstr ( "basicauth" ) ;              // Use basic authentication?
-    if ( auth != "" )                               // Should be user:passwd
-    { 
-       auth = base64::encode ( auth.c_str() ) ;     // Encode
-       auth = String ( "Authorization: Basic " ) +
-              auth + String ( "\r\n" ) ;
-    }
-    mp3client.print ( String ( "GET " ) +
-                      extension +
-                      String ( " HTTP/1.1\r\n" ) +
-                      String ( "Host: " ) +
-                      hostwoext +
-                      String ( "\r\n" ) +
-                      String ( "Icy-MetaData:1\r\n" ) +
-                      auth +
-                      String ( "Connection: close\r\n\r\n" ) ) ;
+    return -1 ;                                      // No socket available
+  }
+  fcntl ( fd, F_SETFL, fcntl ( fd, F_GETFL, 0 ) | O_NONBLOCK ) ;
+  memset ( &sa, 0, sizeof(sa) ) ;
+  sa.sin_family = AF_INET ;
+  sa.sin_addr.s_addr = ip_addr_get_ip4_u32 ( ip ) ;
+  sa.sin_port = htons ( port ) ;
+  if ( ( connect ( fd, (struct sockaddr*)&sa, sizeof(sa) ) < 0 ) &&
+       ( errno != EINPROGRESS ) )
+  {
+    close ( fd ) ;                                   // Immediate failure
+    return -1 ;
+  }
+  return fd ;
+}
+
+
+//**************************************************************************************************
+//                                    S O C K P O L L                                              *
+//**************************************************************************************************
+// Check a socket started by sockstart().  Returns 1 if connected, 0 if still busy and -1 if the   *
+// connect failed.  A connected socket gets the same settings as in WiFiClient::connect().         *
+//**************************************************************************************************
+int sockpoll ( int fd )
+{
+  fd_set             fdset ;                         // For select()
+  struct timeval     tv = { 0, 0 } ;                 // Do not wait in select()
+  int                sockerr ;                       // Result of connect
+  socklen_t          len = sizeof(sockerr) ;
+  int                one = 1 ;                       // For setsockopt()
+
+  FD_ZERO ( &fdset ) ;
+  FD_SET ( fd, &fdset ) ;
+  if ( select ( fd + 1, NULL, &fdset, NULL, &tv ) <= 0 )
+  {
+    return 0 ;                                       // Not yet connected
+  }
+  getsockopt ( fd, SOL_SOCKET, SO_ERROR, &sockerr, &len ) ;
+  if ( sockerr )                                     // Connected?
+  {
+    return -1 ;                                      // No, refused or unreachable
+  }
+  fcntl ( fd, F_SETFL, fcntl ( fd, F_GETFL, 0 ) & ~O_NONBLOCK ) ;
+  setsockopt ( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) ) ;
+  setsockopt ( fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one) ) ;
+  return 1 ;
+}
+
+
+//**************************************************************************************************
+//                                    S E N D R E Q U E S T                                        *
+//**************************************************************************************************
+// Send the GET request for a stream to a connected host.                                          *
+//**************************************************************************************************
+void sendrequest ( WiFiClient& client, const String& hostwoext, const String& extension )
+{
+  String auth ;                                      // For basic authentication
+
+  auth = nvsgetstr ( "basicauth" ) ;                 // Use basic authentication?
+  if ( auth != "" )                                  // Should be user:passwd
+  {
+    auth = base64::encode ( auth.c_str() ) ;         // Encode
+    auth = String ( "Authorization: Basic " ) +
+           auth + String ( "\r\n" ) ;
+  }
+  client.print ( String ( "GET " ) +
+                 extension +
+                 String ( " HTTP/1.1\r\n" ) +
+                 String ( "Host: " ) +
+                 hostwoext +
+                 String ( "\r\n" ) +
+                 String ( "Icy-MetaData:1\r\n" ) +
+                 auth +
+                 String ( "Connection: close\r\n\r\n" ) ) ;
+}
+
+
+//**************************************************************************************************
+//                                    C O N N F A I L                                              *
+//**************************************************************************************************
+// A phase of the connection to a host failed or timed out.                                        *
+//**************************************************************************************************
+void connfail ( const char* reason )
+{
+  dbgprint ( "Request %s failed, %s!", conn.hostwoext.c_str(), reason ) ;
+  stop_mp3client() ;                                // Close socket, state becomes idle
+}
+
+
+//**************************************************************************************************
+//                                    H A N D L E C O N N E C T                                    *
+//**************************************************************************************************
+// Advance the connection to a host by one step.  Called for every mp3loop().                      *
+// The states are:                                                                                 *
+//  CONN_RESOLVE - waiting for the DNS reply.  Then start a non-blocking connect.                  *
+//  CONN_CONNECT - waiting until the socket is writable, i.e. the connection is made.              *
+//  CONN_REQUEST - send the GET request.                                                           *
+//  CONN_HEADER  - the headers are handled by handlebyte_ch(), wait until DATA mode is reached.    *
+// Every state has a time-out.  After a time-out the connection is closed and the player stays in  *
+// INIT mode.  recovery() will then try again.                                                     *
+//**************************************************************************************************
+void handleconnect()
+{
+  int res ;                                          // Result of sockpoll()
+
+  switch ( conn.state )
+  {
+    case CONN_RESOLVE :                              // Waiting for DNS
+      if ( !conn.dnsdone )                           // Reply received?
+      {
+        if ( ( millis() - conn.t0 ) > CONNTO_DNS )   // No, time-out?
+        {
+          conn.timeouts++ ;
+          connfail ( "DNS time-out" ) ;
+        }
+        break ;
+      }
+      if ( conn.dnsfail )                            // Host found?
+      {
+        connfail ( "host not found" ) ;
+        break ;
+      }
+      conn.tdns = millis() - conn.t0 ;               // Yes, remember time for lookup
+      conn.fd = sockstart ( &conn.ip, conn.port ) ;  // Start connect
+      if ( conn.fd < 0 )
+      {
+        connfail ( "connect error" ) ;
+        break ;
+      }
+      conn.state = CONN_CONNECT ;                    // Socket must be closed on failure
+      conn.t0 = millis() ;
+      break ;
+    case CONN_CONNECT :                              // Waiting for connection
+      res = sockpoll ( conn.fd ) ;                   // Check connection
+      if ( res == 0 )                                // Still busy?
+      {
+        if ( ( millis() - conn.t0 ) > CONNTO_CONNECT )  // Yes, time-out?
+        {
+          conn.timeouts++ ;
+          connfail ( "connect time-out" ) ;
+        }
+        break ;
+      }
+      if ( res < 0 )                                 // Connected?
+      {
+        connfail ( "connection refused" ) ;
+        break ;
+      }
+      conn.tconnect = millis() - conn.t0 ;           // Yes, remember time for connect
+      swtime.connect = millis() - swtime.start ;     // Time of station switch
+      mp3client = WiFiClient ( conn.fd ) ;           // mp3client owns the socket now
+      conn.state = CONN_REQUEST ;
+      dbgprint ( "Connected to server" ) ;
+      break ;
+    case CONN_REQUEST :                              // Send the request
+      sendrequest ( mp3client, conn.hostwoext,       // Send GET request
+                    conn.extension ) ;
+      conn.state = CONN_HEADER ;                     // Wait for the headers
+      conn.t0 = millis() ;
+      break ;
+    case CONN_HEADER :                               // Headers are handled by handlebyte_ch()
+      if ( datamode & ( DATA | PLAYLISTDATA ) )      // Data reached?
+      {
+        conn.theader = millis() - conn.t0 ;          // Yes, connection is complete
+        conn.state = CONN_IDLE ;
+      }
+      else if ( ( millis() - conn.t0 ) > CONNTO_HEADER )  // Time-out?
+      {
+        conn.timeouts++ ;
+        connfail ( "no headers" ) ;
+      }
+      break ;
+    default :
+      break ;
+  }
+}
+
+
+//**************************************************************************************************
+//                                    N E I G H B O U R                                            *
+//**************************************************************************************************
+// Find the preset next to "from" in direction "dir" (+1 or -1).  Empty presets are skipped.       *
+// Returns -1 if there is no neighbour or if it cannot be kept in standby (SD, playlist, iHeart).  *
+//**************************************************************************************************
+int8_t neighbour ( int8_t from, int8_t dir, String& url )
+{
+  int8_t p = from ;                                       // Preset to check
+  int    i ;                                              // Loop control
+
+  for ( i = 0 ; i < 100 ; i++ )
+  {
+    p += dir ;                                            // Next or previous, with wrap
+    if ( p > 99 )
+    {
+      p = 0 ;
+    }
+    if ( p < 0 )
+    {
+      p = 99 ;
+    }
+    if ( p == from )                                      // Back at start?
+    {
+      break ;                                             // Yes, no neighbour
+    }
+    url = readhostfrompref ( p ) ;                        // Lookup preset in preferences
+    chomp ( url ) ;                                       // Get rid of part after "#"
+    if ( url == "" )                                      // Empty preset?
+    {
+      continue ;                                          // Yes, skip
+    }
+    if ( url.endsWith ( ".m3u" ) ||                       // Not for standby?
+         url.endsWith ( ".pls" ) ||
+         url.endsWith ( ".m3u8" ) ||
+         url.startsWith ( "ihr/" ) ||
+         ( url.indexOf ( "localhost/" ) >= 0 ) )
+    {
+      return -1 ;
+    }
+    return p ;
+  }
+  return -1 ;
+}
+
+
+//**************************************************************************************************
+//                                    H A N D L E S T A N D B Y                                    *
+//**************************************************************************************************
+// Keep standby connections to the presets next to the current preset.  Called from mp3loop().     *
+// The standby connections are (re)assigned when the current preset changes.  Connections that     *
+// already serve a neighbour are kept.  Failed connections are retried after SBRETRY msec.         *
+//**************************************************************************************************
+void handlestandby()
+{
+  static int8_t sbpreset = -1 ;                           // Preset for which standby is set up
+  int8_t        want[SBSLOTS] ;                           // Wanted presets, next and previous
+  String        wanturl[SBSLOTS] ;                        // And their URLs
+  bool          keep[SBSLOTS] ;                           // Slot serves a wanted preset
+  int           i, j ;                                    // Loop control
+
+  if ( !ini_block.standby )                               // Standby mode off?
+  {
+    if ( sbpreset >= 0 )                                  // Yes, anything to close?
+    {
+      for ( i = 0 ; i < SBSLOTS ; i++ )
+      {
+        standby[i].stop() ;                               // Close standby connection
+      }
+      sbpreset = -1 ;
+    }
+    return ;
+  }
+  for ( i = 0 ; i < SBSLOTS ; i++ )
+  {
+    standby[i].handle() ;                                 // Advance connection, read data
+  }
+  if ( localfile || playlist_num ||                       // Only for a normal station that
+       ( ( datamode & ( DATA | METADATA ) ) == 0 ) )      // is playing
+  {
+    return ;
+  }
+  if ( currentpreset == sbpreset )                        // Neighbours known?
+  {
+    for ( i = 0 ; i < SBSLOTS ; i++ )                     // Yes, retry failed connections
+    {
+      if ( standby[i].mayretry() )
+      {
+        standby[i].start ( standby[i].getpreset(), standby[i].geturl() ) ;
+      }
+    }
+    return ;
+  }
+  sbpreset = currentpreset ;
+  want[0] = neighbour ( currentpreset, +1, wanturl[0] ) ; // Next preset
+  want[1] = neighbour ( currentpreset, -1, wanturl[1] ) ; // Previous preset
+  if ( want[1] == want[0] )                               // Only 2 presets?
+  {
+    want[1] = -1 ;                                        // Yes, one connection is enough
+  }
+  for ( i = 0 ; i < SBSLOTS ; i++ )                       // Keep connections to neighbours
+  {
+    keep[i] = false ;
+    for ( j = 0 ; j < SBSLOTS ; j++ )
+    {
+      if ( ( want[j] >= 0 ) &&
+           ( standby[i].getpreset() == want[j] ) &&
+           ( standby[i].geturl() == wanturl[j] ) )
+      {
+        keep[i] = true ;                                  // Slot already serves this one
+        want[j] = -1 ;                                    // No need to start it
+      }
+    }
+    if ( !keep[i] )
+    {
+      standby[i].stop() ;                                 // Close connection to other preset
+    }
+  }
+  for ( j = 0 ; j < SBSLOTS ; j++ )                       // Start the missing connections
+  {
+    for ( i = 0 ; ( want[j] >= 0 ) && ( i < SBSLOTS ) ; i++ )
+    {
+      if ( !keep[i] )                                     // Free slot?
+      {
+        standby[i].start ( want[j], wanturl[j] ) ;        // Yes, use it
+        keep[i] = true ;
+        want[j] = -1 ;
+      }
+    }
+  }
+}
+
+
+//**************************************************************************************************
+//                                    U S E S T A N D B Y                                          *
+//**************************************************************************************************
+// Check if the requested host is available as a standby connection.  If so, the connection and    *
+// the buffered audio are handed over to the player, so playing starts at once.                    *
+// The standby keeps only the first part of a metadata block.  A block that is in progress at the  *
+// handover is skipped, the title follows with the next block.                                     *
+//**************************************************************************************************
+bool usestandby()
+{
+  int i ;                                                 // Loop control
+
+  if ( !ini_block.standby )                               // Standby mode on?
+  {
+    return false ;                                        // No
+  }
+  for ( i = 0 ; i < SBSLOTS ; i++ )
+  {
+    Standby& sb = standby[i] ;                            // Connection to check
+    if ( !sb.isready() || ( sb.geturl() != host ) )       // Ready and the right one?
+    {
+      continue ;                                          // No, try next
+    }
+    dbgprint ( "Preset %d from standby", currentpreset ) ;
+    stop_mp3client() ;                                    // Disconnect if still connected
+    clearicymeta() ;                                      // Metadata of old host is not valid
+    tftset ( 0, "ESP32-Radio" ) ;                         // Set screen segment text top line
+    displaytime ( "" ) ;                                  // Clear time on TFT screen
+    chunked = false ;                                     // Standby is never chunked
+    metaint = sb.getmetaint() ;                           // Take over results of header
+    bitrate = sb.getbitrate() ;
+    icyname = sb.geticyname() ;
+    tftset ( 2, icyname ) ;                               // Set screen segment bottom part
+    mqttpub.trigger ( MQTT_ICYNAME ) ;                    // Request publishing to MQTT
+    totalcount = 0 ;                                      // Reset totalcount
+    datamode = DATA ;                                     // Continue in the metaint cycle
+    datacount = sb.getdatacount() ;
+    if ( sb.getmetaskip() )                               // Busy with metadata?
+    {
+      datamode = METADATA ;                               // Yes, continue there
+      metalinebfx = -1 ;                                  // Expecting length byte
+      if ( sb.getmetaskip() > 0 )                         // Or in the middle of metadata?
+      {
+        metalinebfx = 0 ;                                 // Yes, first part may be truncated,
+        metacount = sb.getmetaskip() ;                    // so skip the bytes left of this block
+        metadrop = true ;
+      }
+    }
+    else if ( *sb.gettitle() )                            // Last metadata known?
+    {
+      if ( showstreamtitle ( sb.gettitle() ) )            // Yes, show artist and title
+      {
+        mqttpub.trigger ( MQTT_STREAMTITLE ) ;            // Changed, request publishing to MQTT
+      }
+    }
+    swtime.connect = millis() - swtime.start ;            // No connect and no headers
+    swtime.header = swtime.connect ;
+    queuefunc ( QSTARTSONG ) ;                            // Queue a request to start song
+    sb.handover ( mp3client, dataring ) ;                 // Take connection and buffered audio
+    xTaskNotifyGive ( xplaytask ) ;                       // Wake up playtask
+    sb_hits++ ;
     return true ;
   }
-  dbgprint ( "Request %s failed!", host.c_str() ) ;
+  sb_misses++ ;
   return false ;
 }
 
@@ -1266,8 +2040,9 @@ uint32_t ssconv ( const uint8_t* bytes )
 //**************************************************************************************************
 // Check file on SD card for ID3 tags and use them to display some info.                           *
 // Extended headers are not parsed.                                                                *
+// The total size of the ID3 tag (or 0 if there is none) is returned, so it can be skipped.        *
 //**************************************************************************************************
-void handle_ID3 ( String &path )
+uint32_t handle_ID3 ( String &path )
 {
   char*  p ;                                                // Pointer to filename
   struct ID3head_t                                          // First part of ID3 info
@@ -1280,6 +2055,7 @@ void handle_ID3 ( String &path )
   uint8_t  exthsiz[4] ;                                     // Extended header size
   uint32_t stx ;                                            // Ext header size converted
   uint32_t sttg ;                                           // Total tagsize converted
+  uint32_t id3size = 0 ;                                    // Size of ID3 info including header
   uint32_t stg ;                                            // Size of a single tag
   struct ID3tag_t                                           // Tag in ID3 info
   {
@@ -1299,6 +2075,7 @@ void handle_ID3 ( String &path )
   if ( strncmp ( ID3head.fid, "ID3", 3 ) == 0 )
   {
     sttg = ssconv ( ID3head.ttagsize ) ;                    // Convert tagsize
+    id3size = sttg + sizeof(ID3head) ;                      // Size including header
     dbgprint ( "Found ID3 info" ) ;
     if ( ID3head.hflags & 0x40 )                            // Extended header?
     {
@@ -1362,23 +2139,29 @@ void handle_ID3 ( String &path )
   }
   mp3file.close() ;                                         // Close the file
   mp3file = SD.open ( path ) ;                              // And open the file again
+  return id3size ;
 }
 
 
 //**************************************************************************************************
 //                                       C O N N E C T T O F I L E                                 *
 //**************************************************************************************************
-// Open the local mp3-file.                                                                        *
+// Open the local mp3-file.  The ID3 info at the start of the file is skipped.                     *
 //**************************************************************************************************
 bool connecttofile()
 {
-  String path ;                                           // Full file spec
+  String   path ;                                         // Full file spec
+  uint32_t id3size ;                                      // Size of ID3 info
 
   tftset ( 0, "ESP32 MP3 Player" ) ;                      // Set screen segment top line
   displaytime ( "" ) ;                                    // Clear time on TFT screen
   path = host.substring ( 9 ) ;                           // Path, skip the "localhost" part
-  claimSPI ( "sdopen3" ) ;                                // Claim SPI bus
-  handle_ID3 ( path ) ;                                   // See if there are ID3 tags in this file
+  claimSPI ( "sdopen3", SPI_SD ) ;                        // Claim SPI bus
+  id3size = handle_ID3 ( path ) ;                         // See if there are ID3 tags in this file
+  if ( id3size )                                          // ID3 info present?
+  {
+    mp3file.seek ( id3size ) ;                            // Yes, skip it
+  }
   mp3filelength = mp3file.available() ;                   // Get length
   releaseSPI() ;                                          // Release SPI bus
   if ( !mp3file )
@@ -2521,6 +3304,7 @@ void setup()
   char                      tmpstr[20] ;                 // For version and Mac address
   const char*               partname = "nvs" ;           // Partition with NVS info
   esp_partition_iterator_t  pi ;                         // Iterator for find
+  uint32_t                  t0 ;                         // For timing SD card scan
   const char*               dtyp = "Display type is %s" ;
   const char*               wvn = "Include file %s_html has the wrong version number! "
                                   "Replace header file." ;
@@ -2559,6 +3343,7 @@ void setup()
 #endif
   maintask = xTaskGetCurrentTaskHandle() ;               // My taskhandle
   SPIsem = xSemaphoreCreateMutex(); ;                    // Semaphore for SPI bus
+  dspsem = xSemaphoreCreateMutex() ;                     // Semaphore for display not on SPI
   pi = esp_partition_find ( ESP_PARTITION_TYPE_DATA,     // Get partition iterator for
                             ESP_PARTITION_SUBTYPE_ANY,   // the NVS partition
                             partname ) ;
@@ -2585,6 +3370,15 @@ void setup()
   ini_block.clk_dst = 1 ;                                // DST is +1 hour
   ini_block.bat0 = 0 ;                                   // Battery ADC levels not yet defined
   ini_block.bat100 = 0 ;
+  ini_block.ringbufsiz = RINGBFSIZ ;                     // Default size of ringbuffer
+  ini_block.sdiburst = SDIBURST ;                        // Default max. duration of SDI burst
+  ini_block.driftctl = true ;                            // Clock drift compensation on
+  ini_block.gapless = true ;                             // Gapless playing of SD tracks
+  ini_block.fastswitch = true ;                          // Fast switching of stations
+  ini_block.standby = false ;                            // No standby connections
+  ini_block.jitterms = JITTERMS ;                        // Minimum start level of jitter buffer
+  ini_block.volramp = VOLRAMP ;                          // Time for volume ramp
+  ini_block.spectrum = false ;                           // No spectrum analyzer display
   readIOprefs() ;                                        // Read pins used for SPI, TFT, VS1053, IR,
   // Rotary encoder
   for ( i = 0 ; (pinnr = progpin[i].gpio) >= 0 ; i++ )   // Check programmable input pins
@@ -2664,9 +3458,22 @@ void setup()
       }
       else
       {
-        dbgprint ( "Locate mp3 files on SD, may take a while..." ) ;
         tftlog ( "Read SD card" ) ;
-        SD_nodecount = listsdtracks ( "/", 0, false ) ;  // Build nodelist
+        t0 = millis() ;                                  // Start timing
+        if ( sdindex.load() )                            // Index on card still valid?
+        {
+          dbgprint ( "SD index loaded in %d msec", millis() - t0 ) ;
+        }
+        else
+        {
+          dbgprint ( "Locate mp3 files on SD, may take a while..." ) ;
+          sdindex.beginbuild() ;                         // Build new index during scan
+          listsdtracks ( "/", 0, false ) ;               // Find all tracks
+          sdindex.endbuild() ;                           // Write index to card
+          dbgprint ( "SD scanned and index built in %d msec, %d tags reused",
+                     millis() - t0, sdindex.getreused() ) ;
+        }
+        SD_nodecount = sdindex.getcount() ;              // Number of tracks in track table
         p = dbgprint ( "%d tracks on SD", SD_nodecount ) ;
         tftlog ( p ) ;                                   // Show number of tracks on TFT
       }
@@ -2682,6 +3489,7 @@ void setup()
   readprefs ( false ) ;                                  // Read preferences
   tcpip_adapter_set_hostname ( TCPIP_ADAPTER_IF_STA, NAME ) ;
   vs1053player->begin() ;                                 // Initialize VS1053 player
+  vs1053player->setRampTime ( ini_block.volramp ) ;       // Set speed of volume changes
   delay(10);
   p = dbgprint ( "Connect to WiFi" ) ;                   // Show progress
   tftlog ( p ) ;                                         // On TFT too
@@ -2760,19 +3568,29 @@ void setup()
                    dsp_getwidth(),
                    dsp_getheight() - 8, BLACK ) ;
   }
-  outchunk.datatyp = QDATA ;                              // This chunk dedicated to QDATA
   adc1_config_width ( ADC_WIDTH_12Bit ) ;
   adc1_config_channel_atten ( ADC1_CHANNEL_0, ADC_ATTEN_0db ) ;
-  dataqueue = xQueueCreate ( QSIZ,                        // Create queue for communication
-                             sizeof ( qdata_struct ) ) ;
+  if ( !dataring.begin ( ini_block.ringbufsiz ) )         // Create ringbuffer for datastream
+  {
+    dataring.begin ( RINGBFSIZ ) ;                        // Failed, try default size
+  }
+  dbgprint ( "Ringbuffer size is %d bytes", dataring.getsize() ) ;
+  tlm.begin() ;                                           // Ring for telemetry
+  ctrlqueue = xQueueCreate ( CQSIZ,                       // Create queue for start/stop requests
+                             sizeof ( qctrl_struct ) ) ;
   xTaskCreatePinnedToCore (
-    playtask,                                             // Task to play data in dataqueue.
+    playtask,                                             // Task to play data in dataring.
     "Playtask",                                           // name of task.
     1600,                                                 // Stack size of task
     NULL,                                                 // parameter of the task
     2,                                                    // priority of the task
     &xplaytask,                                           // Task handle to keep track of created task
     0 ) ;                                                 // Run on CPU 0
+  if ( ini_block.vs_dreq_pin >= 0 )                       // DREQ pin configured?
+  {
+    attachInterrupt ( ini_block.vs_dreq_pin,              // Yes, playtask will be woken up by isr_dreq
+                      isr_dreq, RISING ) ;
+  }
   xTaskCreate (
     spftask,                                              // Task to handle special functions.
     "Spftask",                                            // name of task.
@@ -2780,6 +3598,16 @@ void setup()
     NULL,                                                 // parameter of the task
     1,                                                    // priority of the task
     &xspftask ) ;                                         // Task handle to keep track of created task
+  if ( SPECH )                                            // Display has room for a spectrum?
+  {
+    xTaskCreate (
+      spectask,                                           // Task for spectrum analyzer display.
+      "Spectask",                                         // name of task.
+      2048,                                               // Stack size of task
+      NULL,                                               // parameter of the task
+      1,                                                  // priority of the task
+      NULL ) ;                                            // No task handle needed
+  }
 }
 
 
@@ -2903,6 +3731,46 @@ void writeprefs()
 }
 
 
+//**************************************************************************************************
+//                                      S E N D T E L E M E T R Y                                  *
+//**************************************************************************************************
+// Send the telemetry records to the web client as CSV, oldest record first.  The first column is  *
+// the number of seconds since the start of the telemetry.                                         *
+//**************************************************************************************************
+void sendtelemetry()
+{
+  const tlmrec_struct* r ;                                  // Record to send
+  uint32_t             sec = tlm.getseconds() ;             // Number of newest record + 1
+  uint32_t             n ;                                  // Number of record
+  char                 line[100] ;                          // One line of CSV
+  String               outbuf ;                             // Lines to send
+
+  outbuf = String ( "sec,in,queued,sent,fillmin,fillavg,fillmax,underruns,loopms,"
+                    "decoded,drop,playing\n" ) ;
+  for ( n = ( sec > TLMSIZ ) ? sec - TLMSIZ : 0 ; n < sec ; n++ )
+  {
+    r = tlm.getrec ( n ) ;
+    if ( r == NULL )                                        // Overwritten in the meantime?
+    {
+      continue ;                                            // Yes, skip
+    }
+    sprintf ( line, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+              n, r->in, r->queued, r->sent,
+              r->fillmin, r->fillavg, r->fillmax,
+              r->underruns, r->loopms,
+              r->decoded, r->drop, r->playing ) ;
+    outbuf += String ( line ) ;
+    if ( outbuf.length() > 1000 )                           // Buffer full?
+    {
+      cmdclient.print ( outbuf ) ;                          // Yes, send it
+      outbuf = String() ;                                   // Clear buffer
+      mp3loop() ;                                           // Keep playing
+    }
+  }
+  cmdclient.print ( outbuf ) ;                              // Send the rest
+}
+
+
 //**************************************************************************************************
 //                                        H A N D L E H T T P R E P L Y                            *
 //**************************************************************************************************
@@ -2960,10 +3828,25 @@ void handlehttpreply()
               datamode = STOPREQD ;                         // Stop playing
             }
             cmdclient.print ( sndstr ) ;                    // Yes, send header
+            if ( SD_okay && !sdindex.uptodate() )           // Card changed since index was made?
+            {
+              sdindex.beginbuild() ;                        // Yes, rebuild index during listing
+            }
             n = listsdtracks ( "/" ) ;                      // Handle it
+            if ( sdindex.isbuilding() )                     // Index rebuilt?
+            {
+              sdindex.endbuild() ;                          // Yes, write it to the card
+            }
+            SD_nodecount = sdindex.getcount() ;             // Number of tracks, 0 if build failed
             dbgprint ( "%d tracks found on SD card", n ) ;
             return ;                                        // Do not send empty line
           }
+          else if ( http_getcmd.startsWith ( "telemetry" ) ) // Is is a "Get telemetry"?
+          {
+            cmdclient.print ( httpheader ( String ( "text/plain" ) ) ) ;
+            sendtelemetry() ;                               // Send the records as CSV
+            return ;                                        // Do not send empty line
+          }
           else if ( http_getcmd.startsWith ( "settings" ) ) // Is is a "Get settings" (like presets and tone)?
           {
             cmdclient.print ( sndstr ) ;                    // Yes, send header
@@ -3308,8 +4191,7 @@ void chk_enc()
       enc_nodeID = selectnextSDnode ( SD_currentnode, +1 ) ;  // Start with next file on SD
       if ( enc_nodeID == "" )                                 // Current track available?
       {
-        inx = SD_nodelist.indexOf ( "\n" ) ;                  // No, find first
-        enc_nodeID = SD_nodelist.substring ( 0, inx ) ;
+        enc_nodeID = sdindex.nodeid ( 0 ) ;                   // No, take first
       }
       // Stop playing as reading filenames saturates SD I/O.
       if ( datamode != STOPPED )
@@ -3459,8 +4341,16 @@ void mp3loop()
   uint32_t        av = 0 ;                               // Available in stream
   String          nodeID ;                               // Next nodeID of track on SD
   uint32_t        timing ;                               // Startime and duration this function
-  uint32_t        qspace ;                               // Free space in data queue
-
+  uint32_t        qspace ;                               // Free space in ringbuffer
+  uint32_t        parsetime ;                            // Start time of parser in usec
+  uint8_t*        wp ;                                   // Free area in ringbuffer
+  int             k ;                                    // Number of bytes in SD read
+  bool            limited = false ;                      // Read limited by full ringbuffer
+  static uint32_t lastread = 0 ;                         // millis() of last read from stream
+
+  handleconnect() ;                                      // Advance connection in progress
+  handlestandby() ;                                      // Advance standby connections
+  showunderruns() ;                                      // Log underruns of playtask
   // Try to keep the Queue to playtask filled up by adding as much bytes as possible
   if ( datamode & ( INIT | HEADER | DATA |               // Test op playing
                     METADATA | PLAYLISTINIT |
@@ -3469,56 +4359,117 @@ void mp3loop()
   {
     timing = millis() ;                                  // Start time this function
     maxchunk = sizeof(tmpbuff) ;                         // Reduce byte count for this mp3loop()
-    qspace = uxQueueSpacesAvailable( dataqueue ) *       // Compute free space in data queue
-             sizeof(qdata_struct) ;
+    qspace = dataring.space() ;                          // Compute free space in ringbuffer
     if ( localfile )                                     // Playing file from SD card?
     {
+      // Local files have no metadata, so the data is read directly into the ringbuffer
       av = mp3filelength ;                               // Bytes left in file
       if ( av < maxchunk )                               // Reduce byte count for this mp3loop()
       {
         maxchunk = av ;
       }
-      if ( maxchunk > qspace )                           // Enough space in queue?
+      qspace = dataring.reserve ( &wp ) ;                // Get contiguous free space in ringbuffer
+      if ( maxchunk > qspace )                           // Enough space in ringbuffer?
       {
-        maxchunk = qspace ;                              // No, limit to free queue space
+        maxchunk = qspace ;                              // No, limit to free space
       }
       if ( maxchunk )                                    // Anything to read?
       {
-        claimSPI ( "sdread" ) ;                          // Claim SPI bus
-        res = mp3file.read ( tmpbuff, maxchunk ) ;       // Read a block of data
+        claimSPI ( "sdread", SPI_SD ) ;                  // Claim SPI bus
+        res = 0 ;
+        while ( res < (int)maxchunk )                    // Read in sectors, so that the VS1053
+        {                                                // can get the bus in between
+          k = maxchunk - res ;
+          if ( k > 512 )
+          {
+            k = 512 ;
+          }
+          k = mp3file.read ( wp + res, k ) ;             // Read a block of data
+          if ( k <= 0 )                                  // End of file or error?
+          {
+            break ;
+          }
+          res += k ;
+          yieldSPI() ;                                   // Give bus away if held too long
+        }
         releaseSPI() ;                                   // Release SPI bus
-        mp3filelength -= res ;                           // Number of bytes left
+        if ( res > 0 )
+        {
+          mp3filelength -= res ;                         // Number of bytes left
+          tlm.countin ( res ) ;                          // Count for telemetry
+          framesync.feed ( wp, res ) ;                   // Update frame statistics
+          dataring.commit ( res ) ;                      // Data is available for playtask now
+          xTaskNotifyGive ( xplaytask ) ;                // Wake up playtask
+        }
+        res = 0 ;                                        // Nothing left to parse
+      }
+    }
+    else if ( hls.isactive() )                           // Playing a HLS stream?
+    {
+      streamlevel = dataring.fill() ;                    // Buffered data for drift control
+      if ( maxchunk >= qspace )                          // Enough space in ringbuffer?
+      {
+        maxchunk = qspace ;                              // No, limit audio to free space
+        limited = true ;                                 // Ringbuffer will be full
+      }
+      if ( hls.handle ( tmpbuff, sizeof(tmpbuff),        // Advance downloads, queue audio,
+                        maxchunk ) > 0 )                 // playlist is not limited
+      {
+        jitterupdate ( limited ) ;                       // Update jitter statistics
+      }
+      if ( hls.isended() )                               // All segments played?
+      {
+        dbgprint ( "End of HLS stream" ) ;
+        datamode = STOPREQD ;                            // Yes, stop
       }
     }
     else
     {
       av = mp3client.available() ;                       // Available from stream
+      streamlevel = av + dataring.fill() ;               // Total buffered data for drift control
       if ( av < maxchunk )                               // Limit read size
       {
         maxchunk = av ;
       }
-      if ( maxchunk > qspace )                           // Enough space in queue?
+      if ( maxchunk >= qspace )                          // Enough space in ringbuffer?
       {
-        maxchunk = qspace ;                              // No, limit to free queue space
+        maxchunk = qspace ;                              // No, limit to free space
+        limited = true ;                                 // Ringbuffer will be full
       }
       if ( maxchunk )                                    // Anything to read?
       {
         res = mp3client.read ( tmpbuff, maxchunk ) ;     // Read a number of bytes from the stream
+        if ( res > 0 )
+        {
+          lastread = millis() ;                          // Time of last data
+          tlm.countin ( res ) ;                          // Count for telemetry
+          jitterupdate ( limited && ( res == (int)maxchunk ) ) ; // Update jitter statistics
+        }
       }
       else
       {
-        if ( datamode == PLAYLISTDATA )                  // End of playlist
+        if ( ( datamode == PLAYLISTDATA ) &&             // End of playlist?
+             ( !mp3client.connected() ||                 // Closed by server or no data
+               ( ( millis() - lastread ) >               // on a connection that is kept open
+                 PLBODYTIME ) ) )
         {
-          playlist_num = 0 ;                             // And reset
-          dbgprint ( "End of playlist seen" ) ;
-          datamode = STOPPED ;
-          ini_block.newpreset++ ;                        // Go to next preset
+          if ( metalinebfx > 0 )                         // Yes, last line without linefeed?
+          {
+            metalinebf[metalinebfx] = '\0' ;             // Yes, add it
+            plcache.addline ( metalinebf ) ;
+            metalinebfx = 0 ;
+          }
+          plcache.finish() ;                             // Table is complete
+          playentry() ;                                  // Connect to the selected entry
         }
       }
     }
-    for ( int i = 0 ; i < res ; i++ )
+    if ( res > 0 )                                       // Anything read?
     {
-      handlebyte_ch ( tmpbuff[i] ) ;                     // Handle one byte
+      parsetime = micros() ;                             // Yes, time the parser
+      handlebytes_ch ( tmpbuff, res ) ;                  // Handle the block of data
+      parse_us += micros() - parsetime ;                 // Accumulate time spent in parser
+      parse_bytes += res ;                               // and number of bytes parsed
     }
     timing = millis() - timing ;                         // Duration this function
     if ( timing > max_mp3loop_time )                     // New maximum found?
@@ -3530,9 +4481,11 @@ void mp3loop()
   if ( datamode == STOPREQD )                            // STOP requested?
   {
     dbgprint ( "STOP requested" ) ;
+    swtime.start = millis() ;                            // Start timing of station switch
+    swtime.busy = true ;
     if ( localfile )
     {
-      claimSPI ( "close" ) ;                             // Claim SPI bus
+      claimSPI ( "close", SPI_SD ) ;                     // Claim SPI bus
       mp3file.close() ;
       releaseSPI() ;                                     // Release SPI bus
     }
@@ -3540,10 +4493,17 @@ void mp3loop()
     {
       stop_mp3client() ;                                 // Disconnect if still connected
     }
+    swtime.stop = millis() - swtime.start ;              // Time to close the old input
     chunked = false ;                                    // Not longer chunked
     datacount = 0 ;                                      // Reset datacount
-    outqp = outchunk.buf ;                               // and pointer
-    queuefunc ( QSTOPSONG ) ;                            // Queue a request to stop the song
+    if ( ini_block.fastswitch )                          // Fast station switching?
+    {
+      queuefunc ( QCANCEL ) ;                            // Yes, skip old data and cancel decoder
+    }
+    else
+    {
+      queuefunc ( QSTOPSONG ) ;                          // Queue a request to stop the song
+    }
     metaint = 0 ;                                        // No metaint known now
     datamode = STOPPED ;                                 // Yes, state becomes STOPPED
     return ;
@@ -3554,11 +4514,31 @@ void mp3loop()
     {
       if ( av == 0 )                                     // End of mp3 data?
       {
-        datamode = STOPREQD ;                            // End of local mp3-file detected
         nodeID = selectnextSDnode ( SD_currentnode,
                                     +1 ) ;               // Select the next file on SD
         host = getSDfilename ( nodeID ) ;
-        hostreq = true ;                                 // Request this host
+        if ( ini_block.gapless )                         // Gapless playing?
+        {
+          // Continue with the next file in the same stream.  The data of the previous file
+          // is still in the ringbuffer, so the decoder does not notice the switch.
+          claimSPI ( "close", SPI_SD ) ;                 // Claim SPI bus
+          mp3file.close() ;                              // Close the old file
+          releaseSPI() ;                                 // Release SPI bus
+          if ( connecttofile() )                         // Open next file, skip ID3 info
+          {
+            framesync.reset() ;                          // New statistics for this track
+            queuefunc ( QTRACKMARK ) ;                   // Mark the start of the next track
+          }
+          else
+          {
+            datamode = STOPREQD ;                        // Failed, stop playing
+          }
+        }
+        else
+        {
+          datamode = STOPREQD ;                          // End of local mp3-file detected
+          hostreq = true ;                               // Request this host
+        }
       }
     }
   }
@@ -3598,6 +4578,15 @@ void mp3loop()
   if ( hostreq )                                          // New preset or station?
   {
     hostreq = false ;
+    jitter.lastarrival = 0 ;                              // No gap to previous station
+    framesync.reset() ;                                   // Start frame statistics again
+    if ( !recov.keepurl )                                 // New station requested?
+    {
+      recov.url = host ;                                  // Yes, remember for recovery
+      recov.redirect = "" ;                               // No redirection seen yet
+    }
+    recov.keepurl = false ;
+    recov.lastdata = millis() ;                           // Full RECSTALL for the new input
     currentpreset = ini_block.newpreset ;                 // Remember current preset
     mqttpub.trigger ( MQTT_PRESET ) ;                     // Request publishing to MQTT
     // Find out if this URL is on localhost (SD).
@@ -3606,10 +4595,13 @@ void mp3loop()
     {
       if ( connecttofile() )                              // Yes, open mp3-file
       {
+        swtime.connect = millis() - swtime.start ;        // No headers for a file
+        swtime.header = swtime.connect ;
         datamode = DATA ;                                 // Start in DATA mode
+        queuefunc ( QSTARTSONG ) ;                        // Queue a request to start song
       }
     }
-    else
+    else if ( !usestandby() )                             // Station available in standby?
     {
       if ( host.startsWith ( "ihr/" ) )                   // iHeartRadio station requested?
       {
@@ -3623,19 +4615,155 @@ void mp3loop()
 
 
 //**************************************************************************************************
-//                                           L O O P                                               *
+//                                       R E C O V E R Y                                           *
 //**************************************************************************************************
-// Main loop of the program.                                                                       *
+// Recover from a stalled stream.  Called for every loop().                                        *
+// If no audio is sent to the decoder for RECSTALL msec while playing, the following steps are     *
+// taken one after the other until audio is played again:                                          *
+//  REC_RECONNECT  - connect to the same URL again.                                                *
+//  REC_REDIRECT   - connect to the target of the last redirection directly.  Skipped if there was *
+//                   no redirection.                                                               *
+//  REC_NEXTPRESET - select the next preset.                                                       *
+//  REC_WIFI       - re-associate with the WiFi network and connect to the URL again.              *
+//  REC_RESTART    - reboot.                                                                       *
+// The wait between the steps is doubled after every step.  When the audio is back, the time from  *
+// the detection of the stall to the first audio is published to MQTT.                             *
 //**************************************************************************************************
-void loop()
+void recovery()
 {
-  mp3loop() ;                                       // Do mp3 related actions
-  if ( updatereq )                                  // Software update requested?
+  uint32_t now = millis() ;                         // Current time
+  uint32_t count = totalcount ;                     // Bytes sent to decoder
+
+  if ( count > recov.lastcount )                    // Audio sent to decoder?
   {
-    if ( displaytype == T_NEXTION )                 // NEXTION in use?
-    { 
-      update_software ( "lstmodn",                  // Yes, update NEXTION image from remote image
-                        UPDATEHOST, TFTFILE ) ;
+    recov.lastdata = now ;                          // Yes, remember time
+    if ( recov.step != REC_IDLE )                   // Recovery in progress?
+    {
+      recov.tta = now - recov.t0 ;                  // Yes, it was successful
+      recov.recovered++ ;
+      dbgprint ( "Audio restored by recovery step %d after %d msec",
+                 recov.step, recov.tta ) ;
+      mqttpub.trigger ( MQTT_RECOVERY ) ;           // Request publishing to MQTT
+      recov.step = REC_IDLE ;
+      recov.wifiwait = false ;
+    }
+  }
+  recov.lastcount = count ;                         // Also handles reset of totalcount
+  if ( recov.wifiwait &&                            // Waiting for WiFi?
+       ( WiFi.status() == WL_CONNECTED ) )          // And connected again?
+  {
+    recov.wifiwait = false ;                        // Yes, connect to the URL again
+    host = recov.url ;
+    recov.keepurl = true ;
+    hostreq = true ;
+  }
+  if ( !( datamode & ( INIT | HEADER | DATA |       // Playing?
+                       METADATA | PLAYLISTINIT |
+                       PLAYLISTHEADER |
+                       PLAYLISTDATA | STOPREQD ) ) )
+  {
+    recov.lastdata = now ;                          // No, no stall while stopped
+    if ( !hostreq && !recov.wifiwait &&             // Stopped by user?
+         ( ini_block.newpreset == currentpreset ) )
+    {
+      recov.step = REC_IDLE ;                       // Yes, nothing to recover
+    }
+    if ( recov.step == REC_IDLE )                   // Recovery in progress?
+    {
+      return ;                                      // No, done
+    }
+  }
+  if ( recov.step == REC_IDLE )                     // Recovery in progress?
+  {
+    if ( ( now - recov.lastdata ) < RECSTALL )      // No, audio seen recently?
+    {
+      return ;                                      // Yes, all is well
+    }
+    dbgprint ( "No audio for %d msec, start recovery", now - recov.lastdata ) ;
+    recov.t0 = now ;                                // Start of recovery
+    recov.backoff = RECBACKOFF ;                    // First wait
+  }
+  else if ( (int32_t)( now - recov.next ) < 0 )     // Time for the next step?
+  {
+    return ;                                        // No, wait
+  }
+  else if ( recov.backoff < RECMAXBACKOFF )         // Yes, wait longer after this step
+  {
+    recov.backoff *= 2 ;
+    if ( recov.backoff > RECMAXBACKOFF )
+    {
+      recov.backoff = RECMAXBACKOFF ;
+    }
+  }
+  recov.step = (recstep_t)( recov.step + 1 ) ;      // Next step
+  if ( ( recov.step == REC_REDIRECT ) &&            // Redirection known?
+       ( recov.redirect.length() == 0 ) )
+  {
+    recov.step = REC_NEXTPRESET ;                   // No, skip this step
+  }
+  if ( ( recov.step == REC_WIFI ) && localfile )    // WiFi not needed for SD card
+  {
+    recov.step = REC_RESTART ;
+  }
+  recov.next = now + recov.backoff ;                // Time of next step
+  dbgprint ( "Recovery step %d, next step in %d msec", recov.step, recov.backoff ) ;
+  switch ( recov.step )
+  {
+    case REC_RECONNECT :                            // Same URL again
+      host = recov.url ;
+      break ;
+    case REC_REDIRECT :                             // Target of redirection
+      host = recov.redirect ;
+      break ;
+    case REC_NEXTPRESET :                           // Next preset
+      playlist_num = 0 ;                            // Not the next entry of a playlist
+      ini_block.newpreset++ ;
+      break ;
+    case REC_WIFI :                                 // Re-associate WiFi
+      WiFi.reconnect() ;                            // Host is requested after connect
+      recov.wifiwait = true ;
+      break ;
+    default :
+      dbgprint ( "Recovery failed, restart" ) ;
+      resetreq = true ;                             // Reboot in loop()
+      return ;
+  }
+  recov.steps[recov.step]++ ;                       // Count for statistics
+  datamode = STOPREQD ;                             // Stop the current input
+  if ( recov.step <= REC_REDIRECT )                 // Host to request?
+  {
+    recov.keepurl = true ;                          // Yes, keep URL and redirection
+    hostreq = true ;
+  }
+}
+
+
+//**************************************************************************************************
+//                                           L O O P                                               *
+//**************************************************************************************************
+// Main loop of the program.                                                                       *
+//**************************************************************************************************
+void loop()
+{
+  static uint32_t looptime = 0 ;                    // Start time of previous loop()
+  uint32_t        t = millis() ;                    // Start time of this loop()
+
+  if ( looptime && ( ( t - looptime ) > max_loop_time ) )  // Longest loop() so far?
+  {
+    max_loop_time = t - looptime ;                  // Yes, remember
+  }
+  if ( looptime )
+  {
+    tlm.countloop ( t - looptime ) ;                // Longest loop() for telemetry
+  }
+  looptime = t ;
+  mp3loop() ;                                       // Do mp3 related actions
+  if ( updatereq )                                  // Software update requested?
+  {
+    if ( displaytype == T_NEXTION )                 // NEXTION in use?
+    { 
+      update_software ( "lstmodn",                  // Yes, update NEXTION image from remote image
+                        UPDATEHOST, TFTFILE ) ;
     }
     update_software ( "lstmods",                    // Update sketch from remote file
                       UPDATEHOST, BINFILE ) ;
@@ -3652,6 +4780,7 @@ void loop()
   scanIR() ;                                        // See if IR input
   ArduinoOTA.handle() ;                             // Check for OTA
   mp3loop() ;                                       // Do more mp3 related actions
+  recovery() ;                                      // Check for stalled stream
   handlehttpreply() ;
   cmdclient = cmdserver.available() ;               // Check Input from client?
   if ( cmdclient )                                  // Client connected?
@@ -3704,21 +4833,169 @@ bool chkhdrline ( const char* str )
 }
 
 
+//**************************************************************************************************
+//                                  M A T C H H D R L I N E                                        *
+//**************************************************************************************************
+// Recognize a line of a HTTP response header like "icy-metaint: 16000".  The name of the field is *
+// compared case-insensitive with a table of known names.  The line is changed in place: trailing  *
+// spaces are removed and *val is set to the start of the value.  No heap memory is used, so this  *
+// does not fragment the heap on every connect.  HF_NONE is returned for unknown fields and lines  *
+// without a colon.                                                                                *
+//**************************************************************************************************
+hdrfield_t matchhdrline ( char* line, char** val )
+{
+  static const hdrkey_struct keys[] =                   // Known fields
+  {
+    { "location",          HF_LOCATION      },
+    { "content-type",      HF_CONTENTTYPE   },
+    { "content-length",    HF_CONTENTLENGTH },
+    { "transfer-encoding", HF_TRANSFERENC   },
+    { "icy-br",            HF_ICYBR         },
+    { "icy-metaint",       HF_ICYMETAINT    },
+    { "icy-name",          HF_ICYNAME       },
+    { "icy-genre",         HF_ICYGENRE      },
+    { "icy-url",           HF_ICYURL        },
+    { "icy-description",   HF_ICYDESCR      }
+  } ;
+  char*    colon = strchr ( line, ':' ) ;               // End of name
+  char*    end ;                                        // End of value
+  size_t   nlen ;                                       // Length of name
+  uint8_t  i ;                                          // Index in keys
+
+  if ( colon == NULL )                                  // Name present?
+  {
+    return HF_NONE ;                                    // No, not a field
+  }
+  nlen = colon - line ;
+  *val = colon + 1 ;                                    // Skip spaces before value
+  while ( ( **val == ' ' ) || ( **val == '\t' ) )
+  {
+    (*val)++ ;
+  }
+  end = *val + strlen ( *val ) ;                        // Remove trailing spaces
+  while ( ( end > *val ) && ( ( end[-1] == ' ' ) || ( end[-1] == '\t' ) ) )
+  {
+    *--end = '\0' ;
+  }
+  for ( i = 0 ; i < ( sizeof(keys) / sizeof(keys[0]) ) ; i++ )
+  {
+    if ( ( strncasecmp ( line, keys[i].name, nlen ) == 0 ) &&
+         ( keys[i].name[nlen] == '\0' ) )               // Same name and same length?
+    {
+      return keys[i].field ;                            // Yes, found
+    }
+  }
+  if ( strncasecmp ( line, "icy-", 4 ) == 0 )           // Other icy field?
+  {
+    return HF_ICYOTHER ;
+  }
+  return HF_NONE ;
+}
+
+
+//**************************************************************************************************
+//                                    H D R E N D S W I T H                                        *
+//**************************************************************************************************
+// Check if a header value ends with a token, case-insensitive.  Like "gzip, chunked".             *
+//**************************************************************************************************
+bool hdrendswith ( const char* val, const char* token )
+{
+  size_t vlen = strlen ( val ) ;                        // Length of value
+  size_t tlen = strlen ( token ) ;                      // Length of token
+
+  return ( vlen >= tlen ) &&
+         ( strcasecmp ( val + vlen - tlen, token ) == 0 ) ;
+}
+
+
 //**************************************************************************************************
 //                            S C A N _ C O N T E N T _ L E N G T H                                *
 //**************************************************************************************************
 // If the line contains content-length information: set clength (content length counter).          *
 //**************************************************************************************************
-void scan_content_length ( const char* metalinebf )
+void scan_content_length ( char* metalinebf )
 {
-  if ( strstr ( metalinebf, "Content-Length" ) )        // Line contains content length
+  char* val ;                                           // Value of the field
+
+  if ( matchhdrline ( metalinebf, &val ) ==            // Line contains content length?
+       HF_CONTENTLENGTH )
   {
-    clength = atoi ( metalinebf + 15 ) ;                // Yes, set clength
+    clength = atoi ( val ) ;                            // Yes, set clength
     dbgprint ( "Content-Length is %d", clength ) ;      // Show for debugging purposes
   }
 }
 
 
+//**************************************************************************************************
+//                                      Q U E U E D A T A                                          *
+//**************************************************************************************************
+// Put a block of MP3/Ogg data in the ringbuffer for the playtask.  The frame headers are parsed   *
+// on the way for the statistics.                                                                  *
+// mp3loop() limits the number of bytes read to the free space in the ringbuffer, so normally      *
+// there is always room.  Bytes that do not fit are counted as "dropped".                          *
+//**************************************************************************************************
+void queuedata ( const uint8_t* p, int len )
+{
+  framesync.feed ( p, len ) ;                           // Update frame statistics
+  if ( dataring.write ( p, len ) )                      // Copy to ringbuffer
+  {
+    xTaskNotifyGive ( xplaytask ) ;                     // Wake up playtask
+  }
+}
+
+
+//**************************************************************************************************
+//                                  H A N D L E B Y T E S _ C H                                    *
+//**************************************************************************************************
+// Handle a block of data from server.                                                             *
+// MP3/Ogg data up to the next metadata- or chunk boundary is handled in one go.  Everything else  *
+// (header, metadata, chunksizes and playlists) is handled byte for byte by handlebyte_ch().       *
+//**************************************************************************************************
+void handlebytes_ch ( uint8_t* buf, int len )
+{
+  int run ;                                             // Number of databytes to handle in one go
+
+  while ( len > 0 )
+  {
+    if ( ( datamode == DATA ) &&                        // Handling MP3/Ogg data?
+         ( !chunked || ( chunkcount > 0 ) ) &&          // Not at a chunk boundary?
+         ( ( metaint == 0 ) || ( datacount > 0 ) ) )    // Not at a metadata boundary?
+    {
+      run = len ;                                       // Yes, try to handle the whole block
+      if ( chunked && ( run > chunkcount ) )            // But stop at end of chunk
+      {
+        run = chunkcount ;
+      }
+      if ( metaint && ( run > datacount ) )             // And stop at begin of metadata
+      {
+        run = datacount ;
+      }
+      queuedata ( buf, run ) ;                          // Send the data to the queue
+      if ( chunked )
+      {
+        chunkcount -= run ;                             // Update count to next chunksize block
+      }
+      if ( metaint )                                    // No METADATA on Ogg streams or mp3 files
+      {
+        datacount -= run ;                              // Update count to next metadata
+        if ( datacount == 0 )                           // End of datablock?
+        {
+          datamode = METADATA ;
+          metalinebfx = -1 ;                            // Expecting first metabyte (counter)
+        }
+      }
+      buf += run ;                                      // Skip handled data
+      len -= run ;
+    }
+    else
+    {
+      handlebyte_ch ( *buf++ ) ;                        // Handle a single byte
+      len-- ;
+    }
+  }
+}
+
+
 //**************************************************************************************************
 //                                   H A N D L E B Y T E _ C H                                     *
 //**************************************************************************************************
@@ -3728,9 +5005,9 @@ void scan_content_length ( const char* metalinebf )
 void handlebyte_ch ( uint8_t b )
 {
   static int       chunksize = 0 ;                      // Chunkcount read from stream
-  static uint16_t  playlistcnt ;                        // Counter to find right entry in playlist
   static int       LFcount ;                            // Detection of end of header
   static bool      ctseen = false ;                     // First line of header seen or not
+  char*            val ;                                // Value in a header line
 
   if ( chunked &&
        ( datamode & ( DATA |                           // Test op DATA handling
@@ -3762,15 +5039,7 @@ void handlebyte_ch ( uint8_t b )
   }
   if ( datamode == DATA )                              // Handle next byte of MP3/Ogg data
   {
-    *outqp++ = b ;
-    if ( outqp == ( outchunk.buf + sizeof(outchunk.buf) ) ) // Buffer full?
-    {
-      // Send data to playtask queue.  If the buffer cannot be placed within 200 ticks,
-      // the queue is full, while the sender tries to send more.  The chunk will be dis-
-      // carded it that case.
-      xQueueSend ( dataqueue, &outchunk, 200 ) ;       // Send to queue
-      outqp = outchunk.buf ;                           // Item empty now
-    }
+    queuedata ( &b, 1 ) ;                              // Send to queue
     if ( metaint )                                     // No METADATA on Ogg streams or mp3 files
     {
       if ( --datacount == 0 )                          // End of datablock?
@@ -3809,48 +5078,48 @@ void handlebyte_ch ( uint8_t b )
       {
         dbgprint ( "Headerline: %s",                   // Show headerline
                    metalinebf ) ;
-        String metaline = String ( metalinebf ) ;      // Convert to string
-        String lcml = metaline ;                       // Use lower case for compare
-        lcml.toLowerCase() ;
-        if ( lcml.startsWith ( "location: http://" ) ) // Redirection?
-        {
-          host = metaline.substring ( 17 ) ;           // Yes, get new URL
-          hostreq = true ;                             // And request this one
-        }
-        if ( lcml.indexOf ( "content-type" ) >= 0)     // Line with "Content-Type: xxxx/yyy"
-        {
-          ctseen = true ;                              // Yes, remember seeing this
-          String ct = metaline.substring ( 13 ) ;      // Set contentstype. Not used yet
-          ct.trim() ;
-          dbgprint ( "%s seen.", ct.c_str() ) ;
-        }
-        if ( lcml.startsWith ( "icy-br:" ) )
+        switch ( matchhdrline ( metalinebf, &val ) )   // Check for known fields
         {
-          bitrate = metaline.substring(7).toInt() ;    // Found bitrate tag, read the bitrate
-          if ( bitrate == 0 )                          // For Ogg br is like "Quality 2"
-          {
-            bitrate = 87 ;                             // Dummy bitrate
-          }
-        }
-        else if ( lcml.startsWith ("icy-metaint:" ) )
-        {
-          metaint = metaline.substring(12).toInt() ;   // Found metaint tag, read the value
-        }
-        else if ( lcml.startsWith ( "icy-name:" ) )
-        {
-          icyname = metaline.substring(9) ;            // Get station name
-          icyname.trim() ;                             // Remove leading and trailing spaces
-          tftset ( 2, icyname ) ;                      // Set screen segment bottom part
-          mqttpub.trigger ( MQTT_ICYNAME ) ;           // Request publishing to MQTT
-        }
-        else if ( lcml.startsWith ( "transfer-encoding:" ) )
-        {
-          // Station provides chunked transfer
-          if ( lcml.endsWith ( "chunked" ) )
-          {
-            chunked = true ;                           // Remember chunked transfer mode
-            chunkcount = 0 ;                           // Expect chunkcount in DATA
-          }
+          case HF_LOCATION :                           // Redirection?
+            if ( strncasecmp ( val, "http://", 7 ) == 0 )
+            {
+              host = val + 7 ;                         // Yes, get new URL
+              hostreq = true ;                         // And request this one
+              recov.redirect = host ;                  // Remember target for recovery
+              recov.keepurl = true ;                   // Keep the requested URL
+            }
+            break ;
+          case HF_CONTENTTYPE :                        // Line with "Content-Type: xxxx/yyy"
+            ctseen = true ;                            // Yes, remember seeing this
+            dbgprint ( "%s seen.", val ) ;             // Contentstype not used yet
+            break ;
+          case HF_CONTENTLENGTH :
+            clength = atoi ( val ) ;                   // Set content length
+            break ;
+          case HF_ICYBR :
+            bitrate = atoi ( val ) ;                   // Found bitrate tag, read the bitrate
+            if ( bitrate == 0 )                        // For Ogg br is like "Quality 2"
+            {
+              bitrate = 87 ;                           // Dummy bitrate
+            }
+            break ;
+          case HF_ICYMETAINT :
+            metaint = atoi ( val ) ;                   // Found metaint tag, read the value
+            break ;
+          case HF_ICYNAME :
+            icyname = val ;                            // Get station name
+            tftset ( 2, icyname ) ;                    // Set screen segment bottom part
+            mqttpub.trigger ( MQTT_ICYNAME ) ;         // Request publishing to MQTT
+            break ;
+          case HF_TRANSFERENC :
+            if ( hdrendswith ( val, "chunked" ) )      // Station provides chunked transfer?
+            {
+              chunked = true ;                         // Remember chunked transfer mode
+              chunkcount = 0 ;                         // Expect chunkcount in DATA
+            }
+            break ;
+          default :                                    // Other icy-* fields are only logged
+            break ;
         }
       }
       metalinebfx = 0 ;                                // Reset this line
@@ -3861,6 +5130,7 @@ void handlebyte_ch ( uint8_t b )
                    bitrate, metaint ) ;
         datamode = DATA ;                              // Expecting data now
         datacount = metaint ;                          // Number of bytes before first metadata
+        swtime.header = millis() - swtime.start ;      // Time to handle headers
         queuefunc ( QSTARTSONG ) ;                     // Queue a request to start song
       }
     }
@@ -3898,15 +5168,22 @@ void handlebyte_ch ( uint8_t b )
     if ( --metacount == 0 )
     {
       metalinebf[metalinebfx] = '\0' ;                 // Make sure line is limited
-      if ( strlen ( metalinebf ) )                     // Any info present?
+      if ( metadrop )                                  // Rest of a block from standby?
+      {
+        metadrop = false ;                             // Yes, do not parse it
+      }
+      else if ( strlen ( metalinebf ) )                // Any info present?
       {
+        icymeta.blocks++ ;                             // Count for statistics
         // metaline contains artist and song name.  For example:
         // "StreamTitle='Don McLean - American Pie';StreamUrl='';"
         // Sometimes it is just other info like:
         // "StreamTitle='60s 03 05 Magic60s';StreamUrl='';"
         // Isolate the StreamTitle, remove leading and trailing quotes if present.
-        showstreamtitle ( metalinebf ) ;               // Show artist and title if present in metadata
-        mqttpub.trigger ( MQTT_STREAMTITLE ) ;         // Request publishing to MQTT
+        if ( showstreamtitle ( metalinebf ) )          // Show artist and title if present in metadata
+        {
+          mqttpub.trigger ( MQTT_STREAMTITLE ) ;       // Changed, request publishing to MQTT
+        }
       }
       if ( metalinebfx  > ( METASIZ - 10 ) )           // Unlikely metaline length?
       {
@@ -3925,7 +5202,6 @@ void handlebyte_ch ( uint8_t b )
     metalinebfx = 0 ;                                  // Prepare for new line
     LFcount = 0 ;                                      // For detection end of header
     datamode = PLAYLISTHEADER ;                        // Handle playlist data
-    playlistcnt = 1 ;                                  // Reset for compare
     totalcount = 0 ;                                   // Reset totalcount
     clength = 0xFFFFFFFF ;                             // Content-length unknown
     dbgprint ( "Read from playlist" ) ;
@@ -3952,7 +5228,6 @@ void handlebyte_ch ( uint8_t b )
                    "search for entry %d",
                    playlist_num ) ;
         datamode = PLAYLISTDATA ;                      // Expecting data now
-        mqttpub.trigger ( MQTT_PLAYLISTPOS ) ;         // Playlistposition to MQTT
         return ;
       }
     }
@@ -3966,7 +5241,7 @@ void handlebyte_ch ( uint8_t b )
       LFcount = 0 ;                                    // Reset double CRLF detection
     }
   }
-  if ( datamode == PLAYLISTDATA )                      // Read next byte of .m3u file data
+  if ( datamode == PLAYLISTDATA )                      // Read next byte of .m3u/.pls file data
   {
     clength-- ;                                        // Decrease content length by 1
     if ( ( b > 0x7F ) ||                               // Ignore unprintable characters
@@ -3986,53 +5261,16 @@ void handlebyte_ch ( uint8_t b )
     if ( ( b == '\n' ) ||                              // linefeed ?
          ( clength == 0 ) )                            // Or end of playlist data contents
     {
-      int inx ;                                        // Pointer in metaline
       metalinebf[metalinebfx] = '\0' ;                 // Take care of delimeter
       dbgprint ( "Playlistdata: %s",                   // Show playlistheader
                  metalinebf ) ;
-      if ( strlen ( metalinebf ) < 5 )                 // Skip short lines
-      {
-        metalinebfx = 0 ;                              // Flush line
-        metalinebf[0] = '\0' ;
-        return ;
-      }
-      String metaline = String ( metalinebf ) ;        // Convert to string
-      if ( metaline.indexOf ( "#EXTINF:" ) >= 0 )      // Info?
-      {
-        if ( playlist_num == playlistcnt )             // Info for this entry?
-        {
-          inx = metaline.indexOf ( "," ) ;             // Comma in this line?
-          if ( inx > 0 )
-          {
-            // Show artist and title if present in metadata
-            showstreamtitle ( metaline.substring ( inx + 1 ).c_str(), true ) ;
-            mqttpub.trigger ( MQTT_STREAMTITLE ) ;     // Request publishing to MQTT
-          }
-        }
-      }
-      if ( metaline.startsWith ( "#" ) )               // Commentline?
-      {
-        metalinebfx = 0 ;                              // Yes, ignore
-        return ;                                       // Ignore commentlines
-      }
-      // Now we have an URL for a .mp3 file or stream.  Is it the rigth one?
-      dbgprint ( "Entry %d in playlist found: %s", playlistcnt, metalinebf ) ;
-      if ( playlist_num == playlistcnt  )
+      plcache.addline ( metalinebf ) ;                 // Add to the table of entries
+      metalinebfx = 0 ;                                // Prepare for next line
+      if ( clength == 0 )                              // End of playlist?
       {
-        inx = metaline.indexOf ( "http://" ) ;         // Search for "http://"
-        if ( inx >= 0 )                                // Does URL contain "http://"?
-        {
-          host = metaline.substring ( inx + 7 ) ;      // Yes, remove it and set host
-        }
-        else
-        {
-          host = metaline ;                            // Yes, set new host
-        }
-        connecttohost() ;                              // Connect to it
+        plcache.finish() ;                             // Yes, table is complete
+        playentry() ;                                  // Connect to the selected entry
       }
-      metalinebfx = 0 ;                                // Prepare for next line
-      host = playlist ;                                // Back to the .m3u host
-      playlistcnt++ ;                                  // Next entry in playlist
     }
   }
 }
@@ -4152,6 +5390,107 @@ void handleFSf ( const String& pagename )
 }
 
 
+//**************************************************************************************************
+//                                      S E T P L U G I N                                          *
+//**************************************************************************************************
+// Handle preference "plugin_0n".  The value is the name of a plugin in the table below or the     *
+// path of a file on SD, like "/plugins/flac.plg".  The file holds the compressed image of VLSI as *
+// 16 bits little endian words, so the array in the .plg file of VLSI written in binary form.  The *
+// file is kept in RAM, the VS1053 needs the plugin again after a reset.  An empty value removes   *
+// the plugin.  If the VS1053 is already running, the plugin is loaded at once.                    *
+// To compile a plugin into the program, include the .plg file in a namespace, because every .plg  *
+// file defines plugin[], and add a line to the table, like:                                       *
+//   namespace plg_flac {                                                                          *
+//   #include "vs1053b-flac.plg"                                                                   *
+//   }                                                                                             *
+//   { "flac", plg_flac::plugin, sizeof(plg_flac::plugin) / 2 },                                   *
+//**************************************************************************************************
+const char* setplugin ( uint8_t n, const char* value )
+{
+  static const plgflash_struct builtin[] =              // Plugins in flash
+  {
+    { NULL, NULL, 0 }                                   // End of table
+  } ;
+  static uint16_t* plgbuf[PLGMAX] ;                     // Images read from SD
+  static String    plgpath[PLGMAX] ;                    // and their paths
+  const char*      name = value ;                       // Name of the plugin
+  const uint16_t*  img = NULL ;                         // Image of the plugin
+  uint16_t*        buf = NULL ;                         // Image read from SD
+  size_t           len = 0 ;                            // Size of image in bytes
+  File             plgfile ;                            // File with image
+  bool             res ;                                // Result of load
+  uint8_t          i ;                                  // Index in builtin[]
+
+  if ( n >= PLGMAX )                                    // Legal plugin number?
+  {
+    return "Illegal plugin number" ;
+  }
+  if ( *value == '/' )                                  // File on SD?
+  {
+    if ( !SD_okay )                                     // Yes, card present?
+    {
+      return "No SD card for plugin" ;
+    }
+    claimSPI ( "plugin", SPI_SD ) ;                     // Claim SPI bus
+    plgfile = SD.open ( value ) ;
+    if ( plgfile )
+    {
+      len = plgfile.size() ;
+      if ( ( len >= 4 ) && ( len <= PLGMAXSIZ ) &&      // Reasonable size?
+           ( ( len & 1 ) == 0 ) &&
+           ( buf = (uint16_t*)malloc ( len ) ) )        // And memory for it?
+      {
+        if ( plgfile.read ( (uint8_t*)buf, len ) != len )
+        {
+          free ( buf ) ;                                // Read error
+          buf = NULL ;
+        }
+      }
+      plgfile.close() ;
+    }
+    releaseSPI() ;                                      // Release SPI bus
+    if ( buf == NULL )                                  // Image read?
+    {
+      return "Plugin file not readable or too big" ;
+    }
+    img = buf ;
+    len /= 2 ;                                          // Size in words
+  }
+  else if ( *value )                                    // Plugin in flash?
+  {
+    for ( i = 0 ; builtin[i].name ; i++ )               // Yes, search table
+    {
+      if ( strcmp ( builtin[i].name, value ) == 0 )
+      {
+        name = builtin[i].name ;
+        img = builtin[i].img ;
+        len = builtin[i].size ;
+        break ;
+      }
+    }
+    if ( img == NULL )
+    {
+      return "Unknown plugin" ;
+    }
+  }
+  plgpath[n] = value ;                                  // Keep the name of a file
+  if ( buf )
+  {
+    name = plgpath[n].c_str() ;
+  }
+  claimSPI ( "plugin", SPI_VS1053 ) ;                   // Claim SPI bus
+  res = vs1053player->setPlugin ( n, name, img, len ) ; // Set and load
+  releaseSPI() ;                                        // Release SPI bus
+  free ( plgbuf[n] ) ;                                  // Old image not needed anymore
+  plgbuf[n] = buf ;
+  if ( !res )
+  {
+    return "Plugin not loaded" ;
+  }
+  return "Plugin accepted" ;
+}
+
+
 //**************************************************************************************************
 //                                         C H O M P                                               *
 //**************************************************************************************************
@@ -4218,6 +5557,9 @@ const char* analyzeCmd ( const char* str )
 //   station    = <mp3 stream>              // Select new station (will not be saved)              *
 //   station    = <URL>.mp3                 // Play standalone .mp3 file (not saved)               *
 //   station    = <URL>.m3u                 // Select playlist (will not be saved)                 *
+//   station    = <URL>.pls                 // Select playlist (will not be saved)                 *
+//   station    = <URL>.m3u8                // Select HLS stream (will not be saved)               *
+//   reload                                 // Download the current playlist again                 *
 //   stop                                   // Stop playing                                        *
 //   resume                                 // Resume playing                                      *
 //   mute                                   // Mute/unmute the music (toggle)                      *
@@ -4232,12 +5574,24 @@ const char* analyzeCmd ( const char* str )
 //   clk_dst    = <1..2>                    // Offset during daylight saving time in hours *)      *
 //   mp3track   = <nodeID>                  // Play track from SD card, nodeID 0 = random          *
 //   settings                               // Returns setting like presets and tone               *
-//   status                                 // Show current URL to play                            *
+//   status                                 // Show current URL, decoder and drift control state   *
+//   telemetry                              // Returns statistics per second as CSV (web only)     *
+//   tlmstatus                              // Summary of the statistics per second                *
 //   test                                   // For test purposes                                   *
 //   debug      = 0 or 1                    // Switch debugging on or off                          *
 //   reset                                  // Restart the ESP32                                   *
 //   bat0       = 2318                      // ADC value for an empty battery                      *
 //   bat100     = 2916                      // ADC value for a fully charged battery               *
+//   ringbuf    = 16384                     // Size of ringbuffer, 4096..65536, power of 2 *)      *
+//   sdiburst   = 2000                      // Max. usec to keep SPI bus for VS1053 data, 32..2048 *
+//   driftctl   = 0 or 1                    // Automatic clock drift compensation off or on        *
+//   gapless    = 0 or 1                    // Gapless playing of tracks from SD off or on         *
+//   fastswitch = 0 or 1                    // Fast switching of stations off or on                *
+//   standby    = 0 or 1                    // Standby connections to next/previous preset         *
+//   jitterbuf  = 250                       // Min. start level of jitter buffer in msec, 0..5000  *
+//   volramp    = 100                       // Msec to ramp volume by 40 dB, 0..2000, 0 = no ramp  *
+//   plugin_00  = /plugins/patches.plg      // VS1053 plugin 00-03 from SD or compiled in          *
+//   spectrum   = 0 or 1                    // Spectrum analyzer display (needs plugin) off or on  *
 //  Commands marked with "*)" are sensible during initialization only                              *
 //**************************************************************************************************
 const char* analyzeCmd ( const char* par, const char* val )
@@ -4323,6 +5677,11 @@ const char* analyzeCmd ( const char* par, const char* val )
   else if ( argument.indexOf ( "preset_" ) >= 0 )     // Enumerated preset?
   { // Do not handle here
   }
+  else if ( argument.indexOf ( "plugin_" ) == 0 )     // Plugin for the VS1053?
+  {
+    strcpy ( reply, setplugin ( argument.substring ( 7 ).toInt(),
+                                value.c_str() ) ) ;
+  }
   else if ( argument.indexOf ( "preset" ) >= 0 )      // (UP/DOWN)Preset station?
   {
     // If MP3 player is active: change track
@@ -4394,6 +5753,20 @@ const char* analyzeCmd ( const char* par, const char* val )
               host.c_str() ) ;
     utf8ascii ( reply ) ;                             // Remove possible strange characters
   }
+  else if ( argument == "reload" )                    // Reload playlist?
+  {
+    plcache.invalidate() ;                            // Yes, forget the table
+    if ( playlist_num )                               // Playing from a playlist?
+    {
+      if ( datamode & ( HEADER | DATA | METADATA | PLAYLISTINIT |
+                        PLAYLISTHEADER | PLAYLISTDATA ) )
+      {
+        datamode = STOPREQD ;                         // Request STOP
+      }
+      host = playlist ;                               // Download it again
+      hostreq = true ;
+    }
+  }
   else if ( argument == "status" )                    // Status request
   {
     if ( datamode == STOPPED )
@@ -4402,9 +5775,58 @@ const char* analyzeCmd ( const char* par, const char* val )
     }
     else
     {
-      sprintf ( reply, "%s - %s", icyname.c_str(),
-                icystreamtitle.c_str() ) ;            // Streamtitle from metadata
+      snprintf ( reply, sizeof(reply), "%s - %s, ",
+                 icyname.c_str(),
+                 icystreamtitle.c_str() ) ;           // Streamtitle from metadata
+      tlm.decodertext ( reply + strlen ( reply ),     // Add state of the decoder
+                        sizeof(reply) - strlen ( reply ) ) ;
     }
+    if ( ini_block.spectrum )                         // Spectrum analyzer active?
+    {
+      static uint32_t oldms = 0 ;                     // Time of previous status request
+      static uint32_t oldframes = 0 ;                 // Frames at previous status request
+      static uint32_t oldbusus = 0 ;                  // Bus time at previous status request
+      uint32_t        frames = spectrum.frames ;      // Copy, spectask goes on
+      uint32_t        busus = spectrum.busus ;
+      uint32_t        ms = millis() - oldms ;         // Time since previous status request
+
+      if ( ms == 0 )                                  // Prevent division by zero
+      {
+        ms = 1 ;
+      }
+      snprintf ( reply + strlen ( reply ),            // Frame rate and part of time on bus
+                 sizeof(reply) - strlen ( reply ),
+                 ", spectrum %d bands %d fps, SPI %d.%d%%",
+                 spectrum.bands,
+                 ( frames - oldframes ) * 1000 / ms,
+                 ( busus - oldbusus ) / ms / 10,
+                 ( busus - oldbusus ) / ms % 10 ) ;
+      oldms += ms ;
+      oldframes = frames ;
+      oldbusus = busus ;
+    }
+    snprintf ( reply + strlen ( reply ),              // State of drift control
+               sizeof(reply) - strlen ( reply ),
+               ", drift %s %d ppm",
+               drift.active ? ( drift.settle ? "settling" : "active" ) : "off",
+               drift.ppm ) ;
+    dbgprint ( "Drift control %s, level %d, target %d, trend %d bytes/min, correction %d ppm",
+               drift.active ? ( drift.settle ? "settling" : "active" ) : "off",
+               (int)drift.level, (int)drift.target, (int)drift.trend, drift.ppm ) ;
+    if ( !swtime.busy && swtime.audio )               // Timing of last switch complete?
+    {
+      snprintf ( reply + strlen ( reply ),            // Yes, add total time
+                 sizeof(reply) - strlen ( reply ),
+                 ", switch %d msec", swtime.audio ) ;
+      dbgprint ( "Last switch took %d msec to first audio, after start: stop %d, "
+                 "connect %d, headers %d, cancel %d msec",
+                 swtime.audio, swtime.stop, swtime.connect,
+                 swtime.header, swtime.cancel ) ;
+    }
+  }
+  else if ( argument == "tlmstatus" )                 // Telemetry summary request
+  {
+    tlm.summary ( reply, sizeof(reply), audiobyterate() ) ;
   }
   else if ( argument.startsWith ( "reset" ) )         // Reset request
   {
@@ -4416,6 +5838,11 @@ const char* analyzeCmd ( const char* par, const char* val )
   }
   else if ( argument == "test" )                      // Test command
   {
+    static uint32_t testtime = 0 ;                    // Time of previous test command
+    uint32_t        t ;                               // Time since previous test command
+    int             i ;                               // Loop control
+    const plugin_struct* plg ;                        // Plugin to show
+
     if ( localfile )
     {
       av = mp3filelength ;                            // Available bytes in file
@@ -4424,18 +5851,114 @@ const char* analyzeCmd ( const char* par, const char* val )
     {
       av = mp3client.available() ;                    // Available in stream
     }
-    sprintf ( reply, "Free memory is %d, chunks in queue %d, stream %d, bitrate %d kbps",
+    sprintf ( reply, "Free memory is %d, bytes in buffer %d, stream %d, bitrate %d kbps",
               ESP.getFreeHeap(),
-              uxQueueMessagesWaiting ( dataqueue ),
+              dataring.fill(),
               av,
               mbitrate ) ;
+    dbgprint ( "Buffer size %d, fill min/max %d/%d, underruns %d, dropped %d",
+               dataring.getsize(),
+               dataring.getminfill(),
+               dataring.getmaxfill(),
+               dataring.getunderruns(),
+               dataring.getdropped() ) ;
+    dataring.resetstats() ;                           // Start new statistics period
     dbgprint ( "Stack maintask is %d", uxTaskGetStackHighWaterMark ( maintask ) ) ;
     dbgprint ( "Stack playtask is %d", uxTaskGetStackHighWaterMark ( xplaytask ) ) ;
     dbgprint ( "Stack spftask  is %d", uxTaskGetStackHighWaterMark ( xspftask ) ) ;
     dbgprint ( "ADC reading is %d", adcval ) ;
     dbgprint ( "scaniocount is %d", scaniocount ) ;
     dbgprint ( "Max. mp3_loop duration is %d", max_mp3loop_time ) ;
+    dbgprint ( "Max. loop duration is %d", max_loop_time ) ;
+    dbgprint ( "Last connect: DNS %d, connect %d, headers %d msec, %d time-outs",
+               conn.tdns, conn.tconnect, conn.theader, conn.timeouts ) ;
+    dbgprint ( "Jitter: mean gap %d, deviation %d, longest %d msec, start level %d msec "
+               "(%d bytes), last start waited %d msec",
+               (int)jitter.mean, (int)jitter.dev, (int)jitter.peak,
+               jitter.targetms, jitter.wmbytes, jitter.holdms ) ;
+    if ( ini_block.standby )                          // Standby connections in use?
+    {
+      t = 0 ;                                         // Yes, compute memory budget
+      for ( i = 0 ; i < SBSLOTS ; i++ )
+      {
+        t += standby[i].getbudget() ;
+      }
+      dbgprint ( "Standby budget %d bytes, hits %d, misses %d, hit rate %d%%",
+                 t, sb_hits, sb_misses,
+                 ( sb_hits + sb_misses ) ? sb_hits * 100 / ( sb_hits + sb_misses ) : 0 ) ;
+    }
+    max_loop_time = 0 ;                               // Start new check
+    if ( parse_us )                                   // Parser used since last test?
+    {
+      dbgprint ( "Parser handled %d bytes in %d usec, %d kB/sec",
+                 parse_bytes, parse_us,
+                 (uint32_t)( (uint64_t)parse_bytes * 1000 / parse_us ) ) ;
+    }
     max_mp3loop_time = 0 ;                            // Start new check
+    parse_bytes = 0 ;                                 // Start new parser measurement
+    parse_us = 0 ;
+    dbgprint ( "Waited %d times for DREQ, total %d usec, max %d usec",
+               dreq_waits, dreq_wait_us, dreq_wait_max ) ;
+    dreq_waits = 0 ;                                  // Start new DREQ measurement
+    dreq_wait_us = 0 ;
+    dreq_wait_max = 0 ;
+    t = millis() - testtime ;                         // Duration of measurement period
+    if ( t )
+    {
+      dbgprint ( "SDI transactions %d per second",
+                 (uint32_t)( (uint64_t)sdi_transcount * 1000 / t ) ) ;
+    }
+    sdi_transcount = 0 ;                              // Start new transaction count
+    testtime = millis() ;
+    showspistats() ;                                  // Show SPI bus statistics
+    dbgprint ( "SCI: %d operations on the bus, %d answered from shadow registers, "
+               "%d volume ramp steps",
+               vs1053player->getSciBus(), vs1053player->getSciCached(),
+               vs1053player->getRampSteps() ) ;
+    for ( i = 0 ; i < PLGMAX ; i++ )                  // Show the plugins
+    {
+      if ( ( plg = vs1053player->getPlugin ( i ) ) )
+      {
+        dbgprint ( "Plugin %d: %s, %d words, loaded in %d usec",
+                   i, plg->name, plg->words, plg->loadus ) ;
+      }
+    }
+    dbgprint ( "Decoder: %s %d kbps %d Hz, %d sec decoded, status %04X, %d stalls",
+               tlm.getdecinfo().format, tlm.getdecinfo().kbps,
+               tlm.getdecinfo().samplerate, tlm.getdecinfo().decodetime,
+               tlm.getdecinfo().status, tlm.getdecinfo().stalls ) ;
+    dbgprint ( "Last gap between tracks was %d msec", trackgap ) ;
+    dbgprint ( "Metadata: %d blocks, %d changes", icymeta.blocks, icymeta.seq ) ;
+    dbgprint ( "Recovery: %d reconnects, %d redirects, %d next presets, %d WiFi, "
+               "%d recovered, last time to audio %d msec",
+               recov.steps[REC_RECONNECT], recov.steps[REC_REDIRECT],
+               recov.steps[REC_NEXTPRESET], recov.steps[REC_WIFI],
+               recov.recovered, recov.tta ) ;
+    if ( hls.getrefreshes() )                         // HLS used?
+    {
+      dbgprint ( "HLS: target %d sec, %d segments, %d prefetched in time, "
+                 "%d playlist loads, %d errors",
+                 hls.gettarget(), hls.getsegments(), hls.getprefetched(),
+                 hls.getrefreshes(), hls.geterrors() ) ;
+    }
+    if ( plcache.getcount() )                         // Playlist used?
+    {
+      dbgprint ( "Playlist %d entries, loaded in %d msec, %d entry switches from cache",
+                 plcache.getcount(), plcache.getloadms(), plcache.gethits() ) ;
+    }
+    dbgprint ( "Frames: %s %s, %d kbps, %d Hz, %s, %d frames, %d resyncs",
+               framesync.getformat(), framesync.issynced() ? "synced" : "searching",
+               framesync.getbitrate(), framesync.getsrate(), framesync.getchmode(),
+               framesync.getframes(), framesync.getresyncs() ) ;
+    dbgprint ( "Buffer holds %d msec of audio",
+               (uint32_t)( (uint64_t)dataring.fill() * 1000 / audiobyterate() ) ) ;
+    if ( framesync.getus() )                          // Frame parser used since last test?
+    {
+      dbgprint ( "Frame parser handled %d bytes in %d usec, %d kB/sec",
+                 framesync.getbytes(), framesync.getus(),
+                 (uint32_t)( (uint64_t)framesync.getbytes() * 1000 / framesync.getus() ) ) ;
+    }
+    framesync.resettiming() ;                         // Start new measurement
   }
   // Commands for bass/treble control
   else if ( argument.startsWith ( "tone" ) )          // Tone command
@@ -4462,7 +5985,12 @@ const char* analyzeCmd ( const char* par, const char* val )
   }
   else if ( argument == "rate" )                      // Rate command?
   {
+    ini_block.driftctl = false ;                      // Manual setting, stop drift control
+    drift.active = false ;                            // Controller must not reset the rate
+    drift.ppm = 0 ;
+    claimSPI ( "rate", SPI_VS1053 ) ;                 // Claim SPI bus
     vs1053player->AdjustRate ( ivalue ) ;             // Yes, adjust
+    releaseSPI() ;                                    // Release SPI bus
   }
   else if ( argument.startsWith ( "mqtt" ) )          // Parameter fo MQTT?
   {
@@ -4511,6 +6039,58 @@ const char* analyzeCmd ( const char* par, const char* val )
       ini_block.clk_dst = value.toInt() ;             // Yes, set DST offset
     }
   }
+  else if ( argument == "ringbuf" )                   // Size of ringbuffer?
+  {
+    ivalue = constrain ( ivalue, RINGBFMIN,           // Yes, check range
+                         RINGBFMAX ) ;
+    ini_block.ringbufsiz = RingBuf::roundsize ( ivalue ) ; // Will be used at restart
+    sprintf ( reply, "Ringbuffer size will be %d bytes",
+              ini_block.ringbufsiz ) ;
+  }
+  else if ( argument == "sdiburst" )                  // Max. duration of SDI burst?
+  {
+    ini_block.sdiburst = constrain ( ivalue,          // Yes, check range and set it
+                                     SDIBURSTMIN, SDIBURSTMAX ) ;
+    sprintf ( reply, "SDI burst set to %d usec",
+              ini_block.sdiburst ) ;
+  }
+  else if ( argument == "driftctl" )                  // Clock drift compensation?
+  {
+    ini_block.driftctl = ( ivalue != 0 ) ;            // Yes, set on/off
+  }
+  else if ( argument == "gapless" )                   // Gapless playing of SD tracks?
+  {
+    ini_block.gapless = ( ivalue != 0 ) ;             // Yes, set on/off
+  }
+  else if ( argument == "fastswitch" )                // Fast switching of stations?
+  {
+    ini_block.fastswitch = ( ivalue != 0 ) ;          // Yes, set on/off
+  }
+  else if ( argument == "standby" )                   // Standby connections?
+  {
+    ini_block.standby = ( ivalue != 0 ) ;             // Yes, set on/off
+  }
+  else if ( argument == "jitterbuf" )                 // Minimum start level of jitter buffer?
+  {
+    ini_block.jitterms = constrain ( ivalue, 0,       // Yes, check range and set in msec
+                                     JBMAXHOLD ) ;
+    sprintf ( reply, "Jitter buffer start level set to %d msec",
+              ini_block.jitterms ) ;
+  }
+  else if ( argument == "spectrum" )                  // Spectrum analyzer display?
+  {
+    ini_block.spectrum = ( ivalue != 0 ) ;            // Yes, set as requested
+  }
+  else if ( argument == "volramp" )                   // Speed of volume ramps?
+  {
+    ini_block.volramp = constrain ( ivalue, 0,        // Yes, check range and set in msec
+                                    VOLRAMPMAX ) ;
+    claimSPI ( "volramp", SPI_VS1053 ) ;              // Claim SPI bus, may finish a ramp
+    vs1053player->setRampTime ( ini_block.volramp ) ;
+    releaseSPI() ;                                    // Release SPI bus
+    sprintf ( reply, "Volume ramp set to %d msec",
+              ini_block.volramp ) ;
+  }
   else if ( argument.startsWith ( "bat" ) )           // Battery ADC value?
   {
     if ( argument.indexOf ( "100" ) == 3 )            // 100 percent value?
@@ -4575,6 +6155,11 @@ void displayinfo ( uint16_t inx )
     {
       dsp_fillRect ( 0, p->y - 4, width, 1, GREEN ) ;      // Yes, show divider above text
     }
+    if ( ( p->y < ( SPECY + SPECH ) ) &&                   // Segment overlaps spectrum?
+         ( ( p->y + p->height ) > SPECY ) )
+    {
+      spectrum.redraw = true ;                             // Yes, paint all bars again
+    }
     len = p->str.length() ;                                // Required length of buffer
     if ( len++ )                                           // Check string length, set buffer length
     {
@@ -4644,75 +6229,611 @@ void gettime()
 //                                H A N D L E _ T F T _ T X T                                      *
 //**************************************************************************************************
 // Check if tft refresh is requested.                                                              *
+// The display (and the SPI bus for a display on SPI) is claimed for one segment at a time, so     *
+// other clients can use the bus between the segments.                                             *
 //**************************************************************************************************
 bool handle_tft_txt()
 {
+  bool res = false ;                                      // Function result
+
   for ( uint16_t i = 0 ; i < TFTSECS ; i++ )              // Handle all sections
   {
     if ( tftdata[i].update_req )                          // Refresh requested?
     {
-      displayinfo ( i ) ;                                 // Yes, do the refresh
+      claimDSP ( "tfttxt" ) ;                             // Yes, claim for this segment only
+      displayinfo ( i ) ;                                 // Do the refresh
       dsp_update() ;                                      // Updates to the screen
+      releaseDSP() ;                                      // Give others a chance
       tftdata[i].update_req = false ;                     // Reset request
-      return true ;                                       // Just handle 1 request
+      res = true ;
     }
   }
-  return false ;                                          // Not a single request
+  return res ;                                            // True if anything refreshed
 }
 
 
 //**************************************************************************************************
 //                                     P L A Y T A S K                                             *
 //**************************************************************************************************
-// Play stream data from input queue.                                                              *
+// Play stream data from the ringbuffer.                                                           *
+// Start/stop requests from the control queue are executed when the playing position in the       *
+// datastream reaches the position at which they were queued.                                      *
+// If the FIFO of the VS1053 is full, the task sleeps until isr_dreq() signals a rising DREQ.      *
+// As long as DREQ stays high, data is sent to the VS1053 in one burst.  During a burst the SPI    *
+// bus is claimed and XDCS stays low.  A burst ends after "sdiburst" microseconds, so that other   *
+// SPI users (display, SD card) get a chance.                                                      *
+// The time between the last data of a track and the first data of the next track is kept in       *
+// "trackgap".  For gapless playing of SD tracks this is just the time between two bursts.         *
+// A QSTOPSONG request starts a fade-out.  No data is sent during the fade-out, its steps are      *
+// made between short waits without holding the bus.  The player is stopped when it ends.          *
+// A QCANCEL request (fast station switch) mutes the output at once and skips the old data in the  *
+// ringbuffer.  The decoder is cancelled with a short fill and the amplifier stays on, so the new  *
+// station can start as soon as its first data arrives.                                            *
+// A stream does not start playing before the jitter buffer has reached its start level.  After an *
+// underrun the buffer is filled to the start level again.  The underrun is logged with its time   *
+// and duration.  Local files are played at once.                                                  *
 // Handle all I/O to VS1053B during normal playing.                                                *
-// Handles display of text, time and volume on TFT as well.                                        *
 //**************************************************************************************************
 void playtask ( void * parameter )
 {
+  qctrl_struct ctrl ;                                               // Start/stop request
+  uint8_t*     p ;                                                  // Points to data in ringbuffer
+  uint32_t     n ;                                                  // Number of bytes in chunk
+  uint32_t     avail ;                                              // Number of bytes to play
+  uint32_t     t0, w ;                                              // For timing DREQ waits and bursts
+  bool         empty = false ;                                      // Ringbuffer was empty
+  bool         more ;                                               // More data fits in FIFO
+  uint32_t     lastdata = 0 ;                                       // Time of last burst
+  uint32_t     gapstart = 0 ;                                       // Time of last data of a track
+  bool         gapmeasure = false ;                                 // Measure gap to next track
+  bool         swmeasure = false ;                                  // Measure switch time
+  bool         holding = false ;                                    // Wait for start level
+  uint32_t     holdstart = 0 ;                                      // Start of wait
+  bool         underrun = false ;                                   // Waiting after underrun
+  bool         stopping = false ;                                   // Fade-out before stop
+
   while ( true )
   {
-    if ( xQueueReceive ( dataqueue, &inchunk, 5 ) )
+    if ( stopping )                                                 // Fading out for a stop?
     {
-      while ( !vs1053player->data_request() )                       // If FIFO is full..
+      claimSPI ( "fadeout", SPI_VS1053 ) ;                          // Yes, claim SPI bus
+      if ( vs1053player->rampStep() )                               // Next step of the fade-out
       {
-        vTaskDelay ( 1 ) ;                                          // Yes, take a break
+        releaseSPI() ;                                              // Not finished, release SPI bus
+        ulTaskNotifyTake ( pdTRUE, 1 ) ;                            // Short wait for next step
+        continue ;
       }
-      switch ( inchunk.datatyp )                                    // What kind of chunk?
+      vs1053player->stopSong() ;                                    // STOP, stop player
+      releaseSPI() ;                                                // Release SPI bus
+      stopping = false ;
+      vTaskDelay ( 500 / portTICK_PERIOD_MS ) ;                     // Pause for a short time
+      holding = false ;                                             // Forget about old stream
+      jitter.started = false ;
+      underrun = false ;
+      gapstart = lastdata ;                                         // Start of gap
+      gapmeasure = true ;
+    }
+    avail = dataring.fill() ;                                       // Check for data in ringbuffer
+    if ( xQueuePeek ( ctrlqueue, &ctrl, 0 ) )                       // Start/stop request pending?
+    {
+      if ( (int32_t)( dataring.readpos() - ctrl.pos ) >= 0 )        // Yes, position reached?
       {
-        case QDATA:
-          claimSPI ( "chunk" ) ;                                    // Claim SPI bus
-          vs1053player->playChunk ( inchunk.buf,                    // DATA, send to player
-                                    sizeof(inchunk.buf) ) ;
-          releaseSPI() ;                                            // Release SPI bus
-          totalcount += sizeof(inchunk.buf) ;                       // Count the bytes
-          break ;
-        case QSTARTSONG:
-          playingstat = 1 ;                                         // Status for MQTT
-          mqttpub.trigger ( MQTT_PLAYING ) ;                        // Request publishing to MQTT
-          claimSPI ( "startsong" ) ;                                // Claim SPI bus
-          vs1053player->startSong() ;                               // START, start player
-          releaseSPI() ;                                            // Release SPI bus
-          break ;
-        case QSTOPSONG:
-          playingstat = 0 ;                                         // Status for MQTT
-          mqttpub.trigger ( MQTT_PLAYING ) ;                        // Request publishing to MQTT
-          claimSPI ( "stopsong" ) ;                                 // Claim SPI bus
-          vs1053player->setVolume ( 0 ) ;                           // Mute
-          vs1053player->stopSong() ;                                // STOP, stop player
-          releaseSPI() ;                                            // Release SPI bus
-          vTaskDelay ( 500 / portTICK_PERIOD_MS ) ;                 // Pause for a short time
-          break ;
-        default:
+        xQueueReceive ( ctrlqueue, &ctrl, 0 ) ;                     // Yes, remove from queue
+        switch ( ctrl.func )                                        // What kind of request?
+        {
+          case QSTARTSONG:
+            playingstat = 1 ;                                       // Status for MQTT
+            mqttpub.trigger ( MQTT_PLAYING ) ;                      // Request publishing to MQTT
+            claimSPI ( "startsong", SPI_VS1053 ) ;                  // Claim SPI bus
+            vs1053player->startSong() ;                             // START, start player
+            vs1053player->fadeIn() ;                                // Ramp up from silence
+            releaseSPI() ;                                          // Release SPI bus
+            swmeasure = swtime.busy ;                               // Time first audio of switch
+            holding = !localfile ;                                  // Fill jitter buffer first
+            holdstart = millis() ;
+            jitter.started = !holding ;                             // Playing if no hold needed
+            break ;
+          case QSTOPSONG:
+            playingstat = 0 ;                                       // Status for MQTT
+            mqttpub.trigger ( MQTT_PLAYING ) ;                      // Request publishing to MQTT
+            claimSPI ( "stopsong", SPI_VS1053 ) ;                   // Claim SPI bus
+            vs1053player->fadeOut() ;                               // Start ramp down to silence
+            releaseSPI() ;                                          // Release SPI bus
+            stopping = true ;                                       // Stop after the fade-out
+            break ;
+          case QTRACKMARK:                                          // Next track follows (gapless)
+            gapstart = lastdata ;                                   // Start of gap
+            gapmeasure = true ;
+            break ;
+          case QCANCEL:                                             // Fast stop, old data skipped
+            playingstat = 0 ;                                       // Status for MQTT
+            mqttpub.trigger ( MQTT_PLAYING ) ;                      // Request publishing to MQTT
+            claimSPI ( "cancel", SPI_VS1053 ) ;                     // Claim SPI bus
+            if ( !vs1053player->cancelSong() )                      // Cancel decoding
+            {
+              vs1053player->stopSong() ;                            // Failed, try the slow way
+            }
+            releaseSPI() ;                                          // Release SPI bus
+            swtime.cancel = millis() - swtime.start ;               // Time to cancel
+            holding = false ;                                       // Forget about old stream
+            jitter.started = false ;
+            underrun = false ;
+            gapstart = lastdata ;                                   // Start of gap
+            gapmeasure = true ;
+            break ;
+          default:
+            break ;
+        }
+        continue ;                                                  // Check for more requests
+      }
+      avail = ctrl.pos - dataring.readpos() ;                       // Do not play beyond request
+      if ( ctrl.func == QCANCEL )                                   // Old data before fast switch?
+      {
+        claimSPI ( "mute", SPI_VS1053 ) ;                           // Yes, claim SPI bus
+        vs1053player->setMute ( true ) ;                            // Silence at once
+        releaseSPI() ;                                              // Release SPI bus
+        while ( avail )                                             // Skip the old data
+        {
+          n = dataring.peek ( &p ) ;                                // Get contiguous data
+          if ( n > avail )                                          // Limit to old data
+          {
+            n = avail ;
+          }
+          dataring.consume ( n ) ;                                  // Free space in ringbuffer
+          avail -= n ;
+        }
+        continue ;                                                  // Position is reached now
+      }
+    }
+    if ( avail == 0 )                                               // Anything to play?
+    {
+      if ( playingstat && !empty )                                  // No, underrun while playing?
+      {
+        dataring.countunderrun() ;                                  // Yes, count it
+        if ( !localfile )                                           // Stream?
+        {
+          holding = true ;                                          // Yes, fill buffer again
+          holdstart = millis() ;
+          underrun = true ;
+        }
+      }
+      empty = true ;
+      if ( vs1053player->isRamping() )                              // Volume ramp in progress?
+      {
+        claimSPI ( "ramp", SPI_VS1053 ) ;                           // Yes, claim SPI bus
+        vs1053player->rampStep() ;                                  // Next step of the ramp
+        releaseSPI() ;                                              // Release SPI bus
+        ulTaskNotifyTake ( pdTRUE, 1 ) ;                            // Short wait for next step
+        continue ;
+      }
+      ulTaskNotifyTake ( pdTRUE, 5 ) ;                              // Wait for new data or request
+      continue ;
+    }
+    empty = false ;
+    if ( holding )                                                  // Waiting for start level?
+    {
+      if ( ( dataring.fill() < jitter.wmbytes ) &&                  // Yes, level reached?
+           ( ( millis() - holdstart ) < JBMAXHOLD ) &&              // No, but do not wait forever
+           ( uxQueueMessagesWaiting ( ctrlqueue ) == 0 ) )          // and not if requests pending
+      {
+        ulTaskNotifyTake ( pdTRUE, 5 ) ;                            // Wait for more data
+        continue ;
+      }
+      holding = false ;                                             // Start playing
+      jitter.started = true ;                                       // Playback is established
+      jitter.holdms = millis() - holdstart ;                        // Time waited
+      if ( underrun )                                               // Restart after underrun?
+      {
+        n = jitter.urcount % URLOGSIZ ;                             // Yes, add to log
+        jitter.urtime[n] = holdstart ;
+        jitter.urdur[n] = jitter.holdms ;
+        jitter.urcount++ ;
+        underrun = false ;
+      }
+    }
+    if ( !vs1053player->data_request() )                            // FIFO full?
+    {
+      t0 = micros() ;                                               // Yes, start of wait
+      do
+      {
+        dreq_armed = true ;                                         // Let isr_dreq wake us up
+        if ( vs1053player->data_request() )                         // DREQ may be high already
+        {
           break ;
+        }
+        ulTaskNotifyTake ( pdTRUE, 2 ) ;                            // Wait for DREQ, timeout for safety
+      }
+      while ( !vs1053player->data_request() ) ;
+      dreq_armed = false ;
+      w = micros() - t0 ;                                           // Time waited
+      dreq_wait_us += w ;                                           // Update statistics
+      if ( w > dreq_wait_max )
+      {
+        dreq_wait_max = w ;
       }
+      dreq_waits++ ;
+    }
+    if ( gapmeasure )                                               // First data of new track?
+    {
+      trackgap = millis() - gapstart ;                              // Yes, remember the gap
+      gapmeasure = false ;
+    }
+    if ( swmeasure )                                                // First data after switch?
+    {
+      swtime.audio = millis() - swtime.start ;                      // Yes, switch is complete
+      swtime.busy = false ;
+      swmeasure = false ;
     }
+    claimSPI ( "chunk", SPI_VS1053 ) ;                              // Claim SPI bus
+    vs1053player->burstBegin() ;                                    // Start SDI transaction
+    sdi_transcount++ ;                                              // Count transactions
+    t0 = micros() ;                                                 // Start of burst
+    do                                                              // Send a burst of data
+    {
+      n = dataring.peek ( &p ) ;                                    // Get contiguous data
+      if ( n > avail )                                              // Limit to playable data
+      {
+        n = avail ;
+      }
+      if ( n > 32 )                                                 // Limit to one FIFO chunk
+      {
+        n = 32 ;
+      }
+      more = vs1053player->burstChunk ( p, n ) ;                    // DATA, send to player
+      dataring.consume ( n ) ;                                      // Free space in ringbuffer
+      totalcount += n ;                                             // Count the bytes
+      tlm.countsent ( n ) ;                                         // And for telemetry
+      avail -= n ;
+    }
+    while ( avail && more &&                                        // Until no data or FIFO full
+            ( ( micros() - t0 ) < ini_block.sdiburst ) ) ;          // or time is up
+    vs1053player->burstEnd() ;                                      // End SDI transaction
+    vs1053player->rampStep() ;                                      // Volume ramp between bursts
+    releaseSPI() ;                                                  // Release SPI bus
+    lastdata = millis() ;                                           // Time of last data
     //esp_task_wdt_reset() ;                                        // Protect against idle cpu
   }
   //vTaskDelete ( NULL ) ;                                          // Will never arrive here
 }
 
 
+//**************************************************************************************************
+//                                     S P E C T A S K                                             *
+//**************************************************************************************************
+// Handles the spectrum analyzer display at a fixed rate of one frame per SPECPERIOD msec.         *
+// Only started if the display has room for the bars.                                              *
+//**************************************************************************************************
+void spectask ( void * parameter )
+{
+  TickType_t wake = xTaskGetTickCount() ;                           // Time of next frame
+
+  while ( true )
+  {
+    vTaskDelayUntil ( &wake, SPECPERIOD / portTICK_PERIOD_MS ) ;    // Wait for next frame
+    if ( tft && ( ini_block.spectrum || spectrum.bands ||           // Bars to show or to clear?
+                  spectrum.clearing ) )
+    {
+      handle_spectrum() ;                                           // Yes, next frame
+    }
+  }
+  //vTaskDelete ( NULL ) ;                                          // Will never arrive here
+}
+
+
+//**************************************************************************************************
+//                                   S E T D R I F T                                               *
+//**************************************************************************************************
+// Send a rate correction in ppm to the VS1053.                                                    *
+//**************************************************************************************************
+void setdrift ( int16_t ppm )
+{
+  drift.ppm = ppm ;                                           // Remember current setting
+  claimSPI ( "drift", SPI_VS1053 ) ;                          // Claim SPI bus
+  vs1053player->AdjustRate ( 2 * ppm ) ;                      // Unit is ppm/2
+  releaseSPI() ;                                              // Release SPI bus
+}
+
+
+//**************************************************************************************************
+//                                  A U D I O B Y T E R A T E                                      *
+//**************************************************************************************************
+// Return the number of bytes per second of audio.  The rate from the frame headers is exact, also *
+// for VBR streams.  Before the first frames have been seen, the (measured) bitrate is used.       *
+//**************************************************************************************************
+uint32_t audiobyterate()
+{
+  uint32_t rate = framesync.getbyterate() ;                   // Rate from the frame headers
+
+  if ( rate == 0 )                                            // Known?
+  {
+    rate = ( mbitrate ? mbitrate : bitrate ) * 125 ;          // No, use bitrate, kbps to bytes/sec
+  }
+  if ( rate == 0 )
+  {
+    rate = 16000 ;                                            // Unknown, assume 128 kbps
+  }
+  return rate ;
+}
+
+
+//**************************************************************************************************
+//                                   J I T T E R U P D A T E                                       *
+//**************************************************************************************************
+// Update the jitter statistics after a read from the stream.  The start level of the jitter       *
+// buffer must cover the longest expected gap between two reads.  The longest gap seen is kept     *
+// and decays slowly, the deviation of the gaps adds some margin.  The level is converted to bytes *
+// with the byte rate of the stream and limited to 3/4 of the ringbuffer.                          *
+// If the read was limited by a full ringbuffer, the next read waits for playtask instead of the   *
+// network.  The gap to that read is not measured.                                                 *
+//**************************************************************************************************
+void jitterupdate ( bool limited )
+{
+  uint32_t now = millis() ;                                   // Time of this read
+  float    gap ;                                              // Time since previous read
+  uint32_t wm ;                                               // New start level in bytes
+
+  if ( jitter.lastarrival )                                   // Previous read known?
+  {
+    gap = now - jitter.lastarrival ;                          // Yes, update statistics
+    jitter.dev += ( fabs ( gap - jitter.mean ) - jitter.dev ) / 16 ;
+    jitter.mean += ( gap - jitter.mean ) / 16 ;
+    if ( gap > jitter.peak )                                  // Longer gap than ever?
+    {
+      jitter.peak = gap ;                                     // Yes, remember
+    }
+    else
+    {
+      jitter.peak -= ( jitter.peak - gap ) * gap / JBDECAY ;  // Decay slowly
+    }
+  }
+  jitter.lastarrival = limited ? 0 : now ;                    // Skip gap after backpressure
+  jitter.targetms = jitter.peak + 4 * jitter.dev ;            // Level needed to bridge a gap
+  if ( jitter.targetms < ini_block.jitterms )                 // But not below minimum
+  {
+    jitter.targetms = ini_block.jitterms ;
+  }
+  wm = jitter.targetms * audiobyterate() / 1000 ;             // Convert msec to bytes
+  if ( wm > ( dataring.getsize() * 3 / 4 ) )                  // Limit to ringbuffer size
+  {
+    wm = dataring.getsize() * 3 / 4 ;
+  }
+  jitter.wmbytes = wm ;                                       // Used by playtask
+}
+
+
+//**************************************************************************************************
+//                                   S H O W U N D E R R U N S                                     *
+//**************************************************************************************************
+// Log the underruns registered by playtask.  The longest gap is raised by the silent time, so the *
+// start level will be higher for the next time.  The longest gap is limited to the playing time   *
+// of a full ringbuffer, a larger start level cannot be reached anyway.                            *
+//**************************************************************************************************
+void showunderruns()
+{
+  uint32_t i ;                                                // Index in log
+  float    maxpeak ;                                          // Playing time of full ringbuffer
+
+  if ( ( jitter.urcount - jitter.urshown ) > URLOGSIZ )       // Log overflow?
+  {
+    jitter.urshown = jitter.urcount - URLOGSIZ ;              // Yes, skip the lost entries
+  }
+  while ( jitter.urshown != jitter.urcount )                  // New entries?
+  {
+    i = jitter.urshown % URLOGSIZ ;
+    dbgprint ( "Underrun at %d msec, silent for %d msec",
+               jitter.urtime[i], jitter.urdur[i] ) ;
+    jitter.peak += jitter.urdur[i] ;                          // Larger buffer needed
+    jitter.urshown++ ;
+  }
+  maxpeak = dataring.getsize() * 1000.0 / audiobyterate() ;   // Limit to ringbuffer capacity
+  if ( jitter.peak > maxpeak )
+  {
+    jitter.peak = maxpeak ;
+  }
+}
+
+
+//**************************************************************************************************
+//                                   D R I F T C O N T R O L                                       *
+//**************************************************************************************************
+// Compensate the difference between the clock of the server and the crystal of the VS1053.        *
+// Called once a second by spftask.  The buffered data (ringbuffer and TCP backlog) is smoothed.   *
+// After a settle period the smoothed level is fixed as the target.  A PI controller computes a    *
+// rate correction that keeps the level at the target.  More data than the target means that the   *
+// server is faster than our clock, so the VS1053 must play faster.                                *
+//**************************************************************************************************
+void driftcontrol()
+{
+  float prev ;                                                // Previous smoothed level
+  float err ;                                                 // Error in msec of audio
+  float corr ;                                                // New correction in ppm
+
+  if ( !ini_block.driftctl || localfile ||                    // Controller not applicable?
+       ( datamode != DATA ) || !playingstat ||
+       ( mbitrate == 0 ) )
+  {
+    drift.active = false ;                                    // Yes, stop controller
+    if ( drift.ppm )                                          // Correction still active?
+    {
+      setdrift ( 0 ) ;                                        // Yes, back to nominal rate
+    }
+    return ;
+  }
+  if ( !drift.active )                                        // Just started?
+  {
+    drift.active = true ;                                     // Yes, initialize
+    drift.settle = DRIFTSETTLE ;
+    drift.level = streamlevel ;
+    drift.trend = 0 ;
+    drift.integ = 0 ;
+  }
+  prev = drift.level ;
+  drift.level += ( streamlevel - drift.level ) / 32 ;         // Smooth with time constant 32 sec
+  drift.trend += ( ( drift.level - prev ) * 60 -              // Smoothed change per minute
+                   drift.trend ) / 32 ;
+  if ( drift.settle )                                         // Still settling?
+  {
+    drift.settle-- ;                                          // Yes, count down
+    drift.target = drift.level ;                              // Target follows level
+    return ;
+  }
+  err = ( drift.level - drift.target ) * 1000 /              // Error in msec of audio
+        audiobyterate() ;
+  drift.integ = constrain ( drift.integ + err * DRIFT_KI,     // Update integral part
+                            -DRIFTMAXPPM, DRIFTMAXPPM ) ;
+  corr = constrain ( err * DRIFT_KP + drift.integ,            // Total correction
+                     -DRIFTMAXPPM, DRIFTMAXPPM ) ;
+  if ( (int16_t)corr != drift.ppm )                           // Changed?
+  {
+    setdrift ( (int16_t)corr ) ;                              // Yes, send to VS1053
+  }
+}
+
+
+//**************************************************************************************************
+//                               H A N D L E _ S P E C T R U M                                     *
+//**************************************************************************************************
+// Read the bands of the spectrum analyzer plugin with one SPI transaction and paint the bars      *
+// that changed.  Only the difference between the old and the new height of a bar is painted.      *
+// The SPI bus is held for at most SPECBUDGET usec.  Work that does not fit in this frame is done  *
+// in the next frame: bars that were not painted and strips of the area that were not cleared.     *
+// A display that is not on the SPI bus is painted after the bus has been released.                *
+// Bits 0..5 of a band value are the current level.  If the number of bands is not legal, the      *
+// plugin is not running and no bars are shown.                                                    *
+//**************************************************************************************************
+void handle_spectrum()
+{
+  uint16_t buf[SPECMAXBANDS + 2] ;                            // Number of bands, unused, values
+  uint8_t  n = spectrum.bands ;                               // Number of bands to read
+  uint16_t colw = 0 ;                                         // Width of a column
+  uint16_t h ;                                                // New height of a bar
+  uint16_t old ;                                              // Old height of a bar
+  uint16_t level ;                                            // Level of a band
+  bool     changed = false ;                                  // Something painted
+  uint8_t  i ;                                                // Band number
+  uint32_t t0 ;                                               // Start of frame
+
+  if ( n == 0 )                                               // Number of bands known?
+  {
+    n = SPECMAXBANDS ;                                        // No, read as much as possible
+  }
+  claimSPI ( "spectrum", SPI_TFT ) ;                          // Claim SPI bus, low priority
+  t0 = micros() ;                                             // Start of budget
+  buf[0] = 0 ;                                                // Assume no bars
+  if ( ini_block.spectrum )                                   // Display wanted?
+  {
+    vs1053player->sciWramRead ( SPECWRAM, buf, n + 2 ) ;      // Yes, read bands
+    if ( buf[0] > SPECMAXBANDS )                              // Plugin running?
+    {
+      buf[0] = 0 ;                                            // No, no bars
+    }
+  }
+  if ( !dsp_usesSPI() )                                       // Display on another bus?
+  {
+    spectrum.busus += micros() - t0 ;                         // Yes, bus was only needed to read
+    releaseSPI() ;
+    claimDSP ( "spectrum" ) ;                                 // Lock the display
+  }
+  if ( buf[0] != spectrum.bands )                             // Number of bands changed?
+  {
+    spectrum.bands = buf[0] ;                                 // Yes, start again
+    spectrum.redraw = true ;
+    n = 0 ;                                                   // Values not read yet
+  }
+  if ( spectrum.redraw )                                      // Paint all bars?
+  {
+    spectrum.redraw = false ;                                 // Yes, clear area first
+    spectrum.clearing = true ;
+    spectrum.clearx = 0 ;
+    memset ( spectrum.height, 0, sizeof(spectrum.height) ) ;
+  }
+  while ( spectrum.clearing )                                 // Clear area in strips
+  {
+    if ( ( micros() - t0 ) > SPECBUDGET )                     // Budget spent?
+    {
+      spectrum.late++ ;                                       // Yes, rest in next frame
+      break ;
+    }
+    dsp_fillRect ( spectrum.clearx, SPECY, SPECSTRIP, SPECH, BLACK ) ;
+    spectrum.clearx += SPECSTRIP ;
+    spectrum.clearing = ( spectrum.clearx < dsp_getwidth() ) ;
+    changed = true ;
+  }
+  if ( spectrum.bands && !spectrum.clearing )                 // Area ready for the bars?
+  {
+    colw = dsp_getwidth() / spectrum.bands ;
+  }
+  for ( i = 0 ; colw && ( i < spectrum.bands ) ; i++ )
+  {
+    if ( ( micros() - t0 ) > SPECBUDGET )                     // Budget spent?
+    {
+      spectrum.late++ ;                                       // Yes, rest in next frame
+      break ;
+    }
+    level = 0 ;
+    if ( i < n )                                              // Value read?
+    {
+      level = buf[i + 2] & 0x3F ;                             // Yes, get current level
+      if ( level >= SPECLEVELS )
+      {
+        level = SPECLEVELS - 1 ;
+      }
+    }
+    h = level * SPECH / ( SPECLEVELS - 1 ) ;                  // New height of bar
+    old = spectrum.height[i] ;
+    if ( h > old )                                            // Higher?
+    {
+      dsp_fillRect ( i * colw, SPECY + SPECH - h,             // Yes, paint new part
+                     colw - 1, h - old, YELLOW ) ;
+    }
+    else if ( h < old )                                       // Lower?
+    {
+      dsp_fillRect ( i * colw, SPECY + SPECH - old,           // Yes, clear old part
+                     colw - 1, old - h, BLACK ) ;
+    }
+    if ( h != old )
+    {
+      spectrum.height[i] = h ;
+      changed = true ;
+    }
+  }
+  if ( changed )
+  {
+    dsp_update() ;                                            // Updates to the physical screen
+  }
+  if ( dsp_usesSPI() )                                        // Bus still held?
+  {
+    spectrum.busus += micros() - t0 ;                         // Yes, count time on the bus
+    releaseSPI() ;                                            // Release SPI bus
+  }
+  else
+  {
+    releaseDSP() ;                                            // Unlock the display
+  }
+  spectrum.frames++ ;
+}
+
+
+//**************************************************************************************************
+//                                  H A N D L E _ D E C O D E R                                    *
+//**************************************************************************************************
+// Read the state of the decoder and add it to the telemetry.  Called once a second by spftask.    *
+// Changes of the format, the rates or a new dropout are published to MQTT.                        *
+//**************************************************************************************************
+void handle_decoder()
+{
+  decstat_struct ds ;                                         // Registers of the decoder
+
+  claimSPI ( "decoder", SPI_VS1053 ) ;                        // Claim SPI bus
+  vs1053player->readDecoder ( &ds ) ;                         // Read registers in one transaction
+  releaseSPI() ;                                              // Release SPI bus
+  if ( tlm.decoder ( ds, audiobyterate() ) )                  // Add to telemetry
+  {
+    mqttpub.trigger ( MQTT_DECODER ) ;                        // Changed, publish
+  }
+}
+
+
 //**************************************************************************************************
 //                                   H A N D L E _ S P E C                                         *
 //**************************************************************************************************
@@ -4721,20 +6842,11 @@ void playtask ( void * parameter )
 void handle_spec()
 {
   // Do some special function if necessary
-  if ( dsp_usesSPI() )                                        // Does display uses SPI?
-  {
-    claimSPI ( "hspectft" ) ;                                 // Yes, claim SPI bus
-  }
   if ( tft )                                                  // Need to update TFT?
   {
-    handle_tft_txt() ;                                        // Yes, TFT refresh necessary
-    dsp_update() ;                                            // Be sure to paint physical screen
+    handle_tft_txt() ;                                        // Yes, claims per segment
   }
-  if ( dsp_usesSPI() )                                        // Does display uses SPI?
-  {
-    releaseSPI() ;                                            // Yes, release SPI bus
-  }
-  claimSPI ( "hspec" ) ;                                      // Claim SPI bus
+  claimSPI ( "hspecvs", SPI_VS1053 ) ;                        // Claim SPI bus for VS1053
   if ( muteflag )                                             // Mute or not?
   {
     vs1053player->setVolume ( 0 ) ;                           // Mute
@@ -4748,18 +6860,24 @@ void handle_spec()
     reqtone = false ;
     vs1053player->setTone ( ini_block.rtone ) ;               // Set SCI_BASS to requested value
   }
+  releaseSPI() ;                                              // Release SPI bus
   if ( time_req )                                             // Time to refresh timetxt?
   {
     time_req = false ;                                        // Yes, clear request
     if ( NetworkFound  )                                      // Time available?
     {
       gettime() ;                                             // Yes, get the current time
+      claimDSP ( "hspectim" ) ;                               // Claim display, also SPI if used
       displaytime ( timetxt ) ;                               // Write to TFT screen
+      releaseDSP() ;                                          // Release between the items
+      claimDSP ( "hspecvol" ) ;
       displayvolume() ;                                       // Show volume on display
+      releaseDSP() ;
+      claimDSP ( "hspecbat" ) ;
       displaybattery() ;                                      // Show battery charge on display
+      releaseDSP() ;
     }
   }
-  releaseSPI() ;                                              // Release SPI bus
   if ( mqtt_on )
   {
     if ( !mqttclient.connected() )                            // See if connected
@@ -4783,9 +6901,19 @@ void handle_spec()
 //**************************************************************************************************
 void spftask ( void * parameter )
 {
+  int count = 0 ;                                                   // Counter for 1 second actions
+
   while ( true )
   {
     handle_spec() ;                                                 // Maybe some special funcs?
+    tlm.sample ( playingstat && jitter.started ) ;                  // Sample ringbuffer fill
+    if ( ++count == 10 )                                            // One second passed?
+    {
+      count = 0 ;
+      driftcontrol() ;                                              // Yes, compensate clock drift
+      tlm.tick() ;                                                  // Add second to telemetry
+      handle_decoder() ;                                            // Add state of decoder
+    }
     vTaskDelay ( 100 / portTICK_PERIOD_MS ) ;                       // Pause for a short time
     adcval = ( 15 * adcval +                                        // Read ADC and do some filtering
                adc1_get_raw ( ADC1_CHANNEL_0 ) ) / 16 ;
@@ -46,6 +46,10 @@ Adafruit_ILI9341*     tft = NULL ;                                  // For insta
 #define dsp_update()                                               // Updates to the physical screen
 #define dsp_usesSPI()           true                               // Does use SPI
 
+// Area for the bars of the spectrum analyzer, below the text
+#define SPECY                   130                                // Top of the area
+#define SPECH                   100                                // Height of the area
+
 
 bool dsp_begin()
 {
@@ -23,6 +23,8 @@
 #define dsp_getwidth()      320                                    // Get width of screen
 #define dsp_getheight()     240                                    // Get height of screen
 #define dsp_usesSPI()       false                                  // Does not use SPI
+#define SPECY               0                                      // No spectrum analyzer
+#define SPECH               0
 
 void* tft = (void*)1 ;                                             // Dummy declaration
 
@@ -71,6 +71,10 @@ scrseg_struct     tftdata[TFTSECS] =                        // Screen divided in
 #define dsp_update()            tft->display()                     // Updates to the physical screen
 #define dsp_usesSPI()           false                              // Does not use SPI
 
+// Area for the bars of the spectrum analyzer, lower part of the middle segment
+#define SPECY                   24                                 // Top of the area
+#define SPECH                   15                                 // Height of the area
+
 bool dsp_begin()
 {
   dbgprint ( "Init SSD1306, I2C pins %d,%d", ini_block.tft_sda_pin,
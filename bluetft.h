@@ -46,6 +46,10 @@ Adafruit_ST7735*     tft = NULL ;                                  // For instan
 #define dsp_update()                                               // Updates to the physical screen
 #define dsp_usesSPI()           true                               // Does use SPI
 
+// Area for the bars of the spectrum analyzer, lower part of the middle segment
+#define SPECY                   60                                 // Top of the area
+#define SPECH                   24                                 // Height of the area
+
 
 bool dsp_begin()
 {
@@ -0,0 +1,389 @@
+//**************************************************************************************************
+// FrameSync class implementation.                                                                 *
+//**************************************************************************************************
+#include "esp32_radio.h"
+#include "esp32_framesync.h"
+
+// Bitrates in kbps for MPEG-1 layer I, II, III and MPEG-2/2.5 layer I and II/III.  Index 0 (free
+// format) and 15 (bad) are not valid.
+static const uint16_t mp3brtab[5][16] =
+{
+  { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+  { 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+  { 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0 },
+  { 0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+  { 0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160, 0 }
+} ;
+
+// Sample rates for MPEG-1.  MPEG-2 uses half, MPEG-2.5 a quarter of these.
+static const uint16_t mp3srtab[3] = { 44100, 48000, 32000 } ;
+
+// Sample rates for ADTS
+static const uint32_t adtssrtab[13] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                        22050, 16000, 12000, 11025, 8000, 7350 } ;
+
+// Get a little endian number from a byte array
+static uint64_t getle ( const uint8_t* p, int n )
+{
+  uint64_t res = 0 ;
+
+  while ( n-- )
+  {
+    res = ( res << 8 ) | p[n] ;
+  }
+  return res ;
+}
+
+void FrameSync::reset()
+{
+  format = FS_UNKNOWN ;
+  synced = false ;
+  confirming = false ;
+  skip = 0 ;
+  hdrlen = 0 ;
+  srate = 0 ;
+  channels = 0 ;
+  chmode = 0 ;
+  granvalid = false ;
+  frames = 0 ;
+  resyncs = 0 ;
+  fbytes = 0 ;
+  samples = 0 ;
+}
+
+// Return the number of bytes needed for the header that starts in hdr.  Returns 0 if hdr does not
+// start with a sync word.
+uint16_t FrameSync::headersize ( const uint8_t* p ) const
+{
+  uint16_t need ;                                       // Bytes needed
+  uint32_t body = 0 ;                                   // Size of Ogg page body
+  int      i ;                                          // Loop control
+
+  if ( hdrlen < 2 )                                     // Type of header known?
+  {
+    return 2 ;                                          // No, need 2 bytes
+  }
+  if ( p[0] == 0xFF )                                   // MP3 or ADTS?
+  {
+    if ( ( p[1] & 0xF6 ) == 0xF0 )                      // Layer bits 0 is ADTS
+    {
+      return 7 ;
+    }
+    if ( ( p[1] & 0xE0 ) == 0xE0 )                      // 11 bits sync for MP3
+    {
+      return 4 ;
+    }
+    return 0 ;
+  }
+  if ( ( p[0] != 'O' ) || ( p[1] != 'g' ) )             // Ogg page?
+  {
+    return 0 ;                                          // No sync word
+  }
+  if ( hdrlen < 27 )                                    // Fixed part present?
+  {
+    return 27 ;
+  }
+  need = 27 + p[26] ;                                   // Add segment table
+  if ( ( hdrlen < need ) || ( ( p[5] & 0x02 ) == 0 ) )  // First page of stream (BOS)?
+  {
+    return need ;                                       // No, this is all
+  }
+  for ( i = 27 ; i < need ; i++ )                       // Compute body size
+  {
+    body += p[i] ;
+  }
+  if ( body > FSIDSIZ )                                 // Part of id packet to examine
+  {
+    body = FSIDSIZ ;
+  }
+  return need + body ;
+}
+
+uint32_t FrameSync::parsemp3 ( const uint8_t* p )
+{
+  uint8_t  ver = ( p[1] >> 3 ) & 3 ;                    // 0 = 2.5, 2 = MPEG-2, 3 = MPEG-1
+  uint8_t  layer = 4 - ( ( p[1] >> 1 ) & 3 ) ;          // 1, 2 or 3 (4 is reserved)
+  uint8_t  bri = p[2] >> 4 ;                            // Bitrate index
+  uint8_t  sri = ( p[2] >> 2 ) & 3 ;                    // Sample rate index
+  uint8_t  pad = ( p[2] >> 1 ) & 1 ;                    // Padding slot
+  uint32_t br ;                                         // Bitrate in kbps
+  uint32_t sr ;                                         // Sample rate
+  uint32_t flen ;                                       // Frame length
+  uint32_t spf ;                                        // Samples per frame
+
+  if ( ( ver == 1 ) || ( layer == 4 ) || ( sri == 3 ) )
+  {
+    return 0 ;                                          // Reserved values
+  }
+  br = mp3brtab[ver == 3 ? layer - 1 : ( layer == 1 ? 3 : 4 )][bri] ;
+  if ( br == 0 )
+  {
+    return 0 ;                                          // Free format or bad
+  }
+  sr = mp3srtab[sri] >> ( ver == 3 ? 0 : ( ver == 2 ? 1 : 2 ) ) ;
+  if ( layer == 1 )
+  {
+    flen = ( 12000 * br / sr + pad ) * 4 ;
+    spf = 384 ;
+  }
+  else if ( ( layer == 3 ) && ( ver != 3 ) )            // Layer III, MPEG-2 or 2.5
+  {
+    flen = 72000 * br / sr + pad ;
+    spf = 576 ;
+  }
+  else
+  {
+    flen = 144000 * br / sr + pad ;
+    spf = 1152 ;
+  }
+  format = FS_MP3 ;
+  srate = sr ;
+  chmode = p[3] >> 6 ;
+  channels = ( chmode == 3 ) ? 1 : 2 ;
+  frames++ ;
+  fbytes += flen ;
+  samples += spf ;
+  return flen ;
+}
+
+uint32_t FrameSync::parseadts ( const uint8_t* p )
+{
+  uint8_t  sri = ( p[2] >> 2 ) & 0x0F ;                 // Sample rate index
+  uint32_t flen ;                                       // Frame length, including header
+
+  flen = ( ( p[3] & 0x03 ) << 11 ) | ( p[4] << 3 ) | ( p[5] >> 5 ) ;
+  if ( ( sri > 12 ) || ( flen < 7 ) )
+  {
+    return 0 ;                                          // Not a valid header
+  }
+  format = FS_ADTS ;
+  srate = adtssrtab[sri] ;
+  channels = ( ( p[2] & 0x01 ) << 2 ) | ( p[3] >> 6 ) ;
+  frames++ ;
+  fbytes += flen ;
+  samples += 1024 * ( ( p[6] & 0x03 ) + 1 ) ;           // 1024 samples per raw data block
+  return flen ;
+}
+
+uint32_t FrameSync::parseogg ( const uint8_t* p )
+{
+  uint8_t        segs = p[26] ;                         // Number of segments
+  uint32_t       flen = 27 + segs ;                     // Page length
+  uint64_t       granule = getle ( p + 6, 8 ) ;         // Granule position
+  const uint8_t* id = p + 27 + segs ;                   // Start of body
+  int            i ;                                    // Loop control
+
+  if ( ( p[2] != 'g' ) || ( p[3] != 'S' ) || ( p[4] != 0 ) )
+  {
+    return 0 ;                                          // Not "OggS", version 0
+  }
+  for ( i = 0 ; i < segs ; i++ )
+  {
+    flen += p[27 + i] ;                                 // Add segment sizes
+  }
+  if ( p[5] & 0x02 )                                    // First page of stream?
+  {
+    if ( ( hdrlen >= ( 27 + segs + 16 ) ) &&            // Yes, Vorbis id header?
+         ( memcmp ( id, "\x01vorbis", 7 ) == 0 ) )
+    {
+      channels = id[11] ;
+      srate = getle ( id + 12, 4 ) ;
+    }
+    else if ( ( hdrlen >= ( 27 + segs + 10 ) ) &&       // Opus id header?
+              ( memcmp ( id, "OpusHead", 8 ) == 0 ) )
+    {
+      channels = id[9] ;
+      srate = 48000 ;                                   // Granule is always at 48 kHz
+    }
+    granvalid = false ;                                 // Granule positions start again
+  }
+  if ( granule != 0xFFFFFFFFFFFFFFFFULL )               // Page with end of packet?
+  {
+    if ( granvalid && ( granule > lastgranule ) )       // Yes, previous position known?
+    {
+      samples += granule - lastgranule ;                // Yes, count samples
+      fbytes += flen ;
+    }
+    lastgranule = granule ;
+    granvalid = true ;
+  }
+  format = FS_OGG ;
+  frames++ ;
+  return flen ;
+}
+
+void FrameSync::hunt ( const uint8_t** p, size_t* len )
+{
+  while ( *len && ( **p != 0xFF ) && ( **p != 'O' ) )   // Search for first byte of sync word
+  {
+    (*p)++ ;
+    (*len)-- ;
+  }
+}
+
+void FrameSync::rehunt()
+{
+  const uint8_t* p = hdr + 1 ;                          // Skip the false sync byte
+  size_t         len = hdrlen - 1 ;
+
+  hunt ( &p, &len ) ;                                   // Next possible start in hdr
+  memmove ( hdr, p, len ) ;                             // Move to begin of hdr
+  hdrlen = len ;
+}
+
+void FrameSync::save()
+{
+  saved.format = format ;
+  saved.srate = srate ;
+  saved.channels = channels ;
+  saved.chmode = chmode ;
+  saved.lastgranule = lastgranule ;
+  saved.granvalid = granvalid ;
+  saved.frames = frames ;
+  saved.fbytes = fbytes ;
+  saved.samples = samples ;
+}
+
+void FrameSync::restore()
+{
+  format = saved.format ;
+  srate = saved.srate ;
+  channels = saved.channels ;
+  chmode = saved.chmode ;
+  lastgranule = saved.lastgranule ;
+  granvalid = saved.granvalid ;
+  frames = saved.frames ;
+  fbytes = saved.fbytes ;
+  samples = saved.samples ;
+  confirming = false ;                                  // Search again
+}
+
+void FrameSync::feed ( const uint8_t* p, size_t len )
+{
+  uint32_t t0 = micros() ;                              // For timing
+  uint32_t flen ;                                       // Length of frame
+  size_t   n ;                                          // Number of bytes in one step
+
+  bytes += len ;
+  while ( len )
+  {
+    if ( skip )                                         // Inside a frame?
+    {
+      n = ( skip < len ) ? skip : len ;                 // Yes, skip rest of frame
+      skip -= n ;
+      p += n ;
+      len -= n ;
+      continue ;
+    }
+    if ( ( hdrlen == 0 ) && !synced && !confirming )    // Searching for sync?
+    {
+      hunt ( &p, &len ) ;                               // Yes, skip to possible sync word
+      if ( len == 0 )
+      {
+        break ;
+      }
+    }
+    hdrneed = headersize ( hdr ) ;                      // Bytes needed for this header
+    if ( hdrneed == 0 )                                 // Not a sync word?
+    {
+      if ( synced )                                     // Expected a header here?
+      {
+        synced = false ;                                // Yes, lost sync
+        resyncs++ ;
+      }
+      else if ( confirming )                            // Second header expected here?
+      {
+        restore() ;                                     // Yes, first one was in the data
+      }
+      rehunt() ;                                        // Search in collected bytes
+      continue ;
+    }
+    if ( hdrlen < hdrneed )                             // Header complete?
+    {
+      n = hdrneed - hdrlen ;                            // No, copy next part
+      if ( n > len )
+      {
+        n = len ;
+      }
+      memcpy ( hdr + hdrlen, p, n ) ;
+      hdrlen += n ;
+      p += n ;
+      len -= n ;
+      continue ;                                        // Header size may grow (Ogg)
+    }
+    if ( !synced && !confirming )                       // First header after a search?
+    {
+      save() ;                                          // Yes, may have to be undone
+    }
+    if ( hdr[0] == 'O' )                                // Parse the complete header
+    {
+      flen = parseogg ( hdr ) ;
+    }
+    else if ( hdrneed == 7 )
+    {
+      flen = parseadts ( hdr ) ;
+    }
+    else
+    {
+      flen = parsemp3 ( hdr ) ;
+    }
+    if ( flen < hdrlen )                                // Valid header?
+    {
+      if ( synced )                                     // No, lost sync
+      {
+        synced = false ;
+        resyncs++ ;
+      }
+      else if ( confirming )                            // Not confirmed?
+      {
+        restore() ;                                     // Forget the first header
+      }
+      rehunt() ;                                        // Search in collected bytes
+      continue ;
+    }
+    if ( synced || confirming )                         // Header at expected position?
+    {
+      synced = true ;                                   // Yes, next header follows this frame
+      confirming = false ;
+    }
+    else
+    {
+      confirming = true ;                               // No, check the next header first
+    }
+    skip = flen - hdrlen ;                              // Skip rest of the frame
+    hdrlen = 0 ;
+  }
+  us += micros() - t0 ;
+}
+
+uint32_t FrameSync::getbyterate() const
+{
+  if ( ( samples == 0 ) || ( srate == 0 ) )             // Enough info?
+  {
+    return 0 ;                                          // No, rate unknown
+  }
+  return (uint32_t)( fbytes * srate / samples ) ;
+}
+
+uint32_t FrameSync::getbitrate() const
+{
+  return ( getbyterate() * 8 + 500 ) / 1000 ;
+}
+
+const char* FrameSync::getformat() const
+{
+  static const char* names[] = { "?", "MP3", "AAC", "Ogg" } ;
+
+  return names[format] ;
+}
+
+const char* FrameSync::getchmode() const
+{
+  static const char* modes[] = { "stereo", "joint stereo", "dual channel", "mono" } ;
+
+  if ( format == FS_MP3 )                               // MP3 has a channel mode
+  {
+    return modes[chmode] ;
+  }
+  return ( channels == 1 ) ? "mono" : "stereo" ;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "esp32_radio.h"
+//**************************************************************************************************
+// Frame synchronizer for MP3, AAC (ADTS) and Ogg streams.                                         *
+//**************************************************************************************************
+// The data to be played is fed to the parser in slices of any size.  Only the frame headers are   *
+// examined.  After a valid header, the rest of the frame is skipped with a single subtraction, so *
+// the cost is per frame and not per byte.  A header may be split over two slices; the parts are   *
+// collected in a small buffer.  If no header is found where one is expected, the parser searches  *
+// for the next sync word and counts a resync.                                                     *
+// A sync word may also occur inside the data, so after a search the parser locks only if a        *
+// second valid header follows at the computed frame length.  If it does not, the results of the   *
+// first header are undone and the search goes on.                                                 *
+// The result is the exact bitrate (also for VBR), sample rate, channels and the number of frames. *
+// The byte rate is used to convert buffer levels from bytes to milliseconds of audio.             *
+//**************************************************************************************************
+#define FSIDSIZ       30                                // Part of Ogg id packet to examine
+#define FSHDRSIZ      ( 27 + 255 + FSIDSIZ )            // Max. Ogg page header with id packet part
+
+enum fsformat_t { FS_UNKNOWN, FS_MP3, FS_ADTS, FS_OGG } ;
+
+struct fssave_struct                                    // Results before an unconfirmed header
+{
+  fsformat_t      format ;
+  uint32_t        srate ;
+  uint8_t         channels ;
+  uint8_t         chmode ;
+  uint64_t        lastgranule ;
+  bool            granvalid ;
+  uint32_t        frames ;
+  uint64_t        fbytes ;
+  uint64_t        samples ;
+} ;
+
+class FrameSync
+{
+  private:
+    fsformat_t    format     = FS_UNKNOWN ;             // Format of last frame
+    bool          synced     = false ;                  // Next header position is known
+    bool          confirming = false ;                  // Header found, check the next one
+    fssave_struct saved ;                               // Results before unconfirmed header
+    uint32_t      skip       = 0 ;                      // Bytes to skip to next header
+    uint8_t       hdr[FSHDRSIZ] ;                       // Collected header bytes
+    uint16_t      hdrlen     = 0 ;                      // Number of bytes in hdr
+    uint16_t      hdrneed    = 0 ;                      // Bytes needed for complete header
+    uint32_t      srate      = 0 ;                      // Sample rate in Hz
+    uint8_t       channels   = 0 ;                      // Number of channels
+    uint8_t       chmode     = 0 ;                      // MP3 channel mode (0 = stereo..3 = mono)
+    uint64_t      lastgranule = 0 ;                     // Granule position of previous Ogg page
+    bool          granvalid  = false ;                  // lastgranule is valid
+    // Statistics
+    uint32_t      frames     = 0 ;                      // Number of frames (Ogg: pages)
+    uint32_t      resyncs    = 0 ;                      // Number of times sync was lost
+    uint64_t      fbytes     = 0 ;                      // Bytes in frames
+    uint64_t      samples    = 0 ;                      // Samples in frames
+    uint32_t      us         = 0 ;                      // Time spent in feed()
+    uint32_t      bytes      = 0 ;                      // Bytes fed
+
+    uint16_t      headersize ( const uint8_t* p ) const ;  // Header size for first bytes
+    uint32_t      parsemp3 ( const uint8_t* p ) ;          // Parse headers, return frame length
+    uint32_t      parseadts ( const uint8_t* p ) ;
+    uint32_t      parseogg ( const uint8_t* p ) ;
+    void          hunt ( const uint8_t** p, size_t* len ) ; // Search for a sync word
+    void          rehunt() ;                               // Search sync in rest of hdr
+    void          save() ;                                 // Save results before a new header
+    void          restore() ;                              // Forget an unconfirmed header
+  public:
+    void          reset() ;                                // Start with a new stream
+    void          feed ( const uint8_t* p, size_t len ) ;  // Parse a slice of data
+    uint32_t      getbyterate() const ;                    // Bytes per second, 0 if unknown
+    uint32_t      getbitrate() const ;                     // Average bitrate in kbps
+    const char*   getformat() const ;                      // "MP3", "AAC", "Ogg" or "?"
+    const char*   getchmode() const ;                      // Like "joint stereo"
+    inline bool   issynced() const
+    {
+      return synced ;
+    }
+    inline uint32_t getsrate() const
+    {
+      return srate ;
+    }
+    inline uint8_t  getchannels() const
+    {
+      return channels ;
+    }
+    inline uint32_t getframes() const
+    {
+      return frames ;
+    }
+    inline uint32_t getresyncs() const
+    {
+      return resyncs ;
+    }
+    inline uint32_t getus() const                          // Time spent in feed() in usec
+    {
+      return us ;
+    }
+    inline uint32_t getbytes() const                       // Bytes fed
+    {
+      return bytes ;
+    }
+    inline void     resettiming()                          // Start new timing period
+    {
+      us = 0 ;
+      bytes = 0 ;
+    }
+} ;
+
+extern FrameSync         framesync ;                    // Frame parser for the datastream
@@ -0,0 +1,726 @@
+//**************************************************************************************************
+// HlsFetch and Hls class implementation.                                                          *
+//**************************************************************************************************
+#include "esp32_radio.h"
+#include "esp32_hls.h"
+#include "esp32_telemetry.h"
+
+void HlsFetch::dnscb ( const char* name, const ip_addr_t* ipaddr, void* arg )
+{
+  HlsFetch* f = (HlsFetch*)arg ;                        // The download
+
+  if ( ( f->state != FETCH_RESOLVE ) ||                 // Late reply?
+       ( f->hostwoext != name ) )
+  {
+    return ;                                            // Yes, ignore
+  }
+  if ( ipaddr )                                         // Lookup succeeded?
+  {
+    f->ip = *ipaddr ;                                   // Yes, save IP address
+  }
+  else
+  {
+    f->dnsfail = true ;                                 // No, signal failure
+  }
+  f->dnsdone = true ;
+}
+
+bool HlsFetch::start ( const String& u )
+{
+  stop() ;                                              // Close old connection
+  url = u ;
+  redirects = 0 ;
+  return connect() ;
+}
+
+bool HlsFetch::connect()
+{
+  err_t err ;                                           // Result of DNS request
+
+  splithost ( url, hostwoext, port, extension ) ;       // Get host, port and extension
+  dnsdone = false ;
+  dnsfail = false ;
+  state = FETCH_RESOLVE ;
+  t0 = millis() ;
+  err = dns_gethostbyname ( hostwoext.c_str(), &ip, dnscb, this ) ;
+  if ( err == ERR_OK )                                  // IP address or cached?
+  {
+    dnsdone = true ;                                    // Yes, result is available now
+  }
+  else if ( err != ERR_INPROGRESS )                     // Lookup started?
+  {
+    fail ( "DNS error" ) ;                              // No, give up
+    return false ;
+  }
+  return true ;
+}
+
+void HlsFetch::fail ( const char* reason )
+{
+  dbgprint ( "HLS download of %s failed, %s", url.c_str(), reason ) ;
+  stop() ;
+  state = FETCH_FAILED ;
+}
+
+void HlsFetch::stop()
+{
+  if ( state == FETCH_CONNECT )                         // Socket not yet in client?
+  {
+    close ( fd ) ;                                      // Yes, close it
+  }
+  client.stop() ;                                       // Close connection
+  state = FETCH_IDLE ;
+}
+
+void HlsFetch::headerline()
+{
+  char* val ;                                           // Value of a field
+
+  line[linex] = '\0' ;                                  // Take care of delimiter
+  linex = 0 ;                                           // Prepare for next line
+  if ( strncmp ( line, "HTTP/", 5 ) == 0 )              // Status line?
+  {
+    status = atoi ( line + 9 ) ;                        // Yes, get status code
+    return ;
+  }
+  switch ( matchhdrline ( line, &val ) )                // Check for known fields
+  {
+    case HF_LOCATION :                                  // Redirection
+      location = val ;
+      break ;
+    case HF_CONTENTLENGTH :
+      clen = atoi ( val ) ;
+      break ;
+    case HF_TRANSFERENC :
+      chunked = hdrendswith ( val, "chunked" ) ;
+      break ;
+    default :
+      break ;
+  }
+}
+
+void HlsFetch::handle()
+{
+  int     res ;                                         // Result of sockpoll()
+  int     c ;                                           // Character from header
+
+  switch ( state )
+  {
+    case FETCH_RESOLVE :                                // Waiting for DNS
+      if ( !dnsdone )                                   // Reply received?
+      {
+        if ( ( millis() - t0 ) > CONNTO_DNS )           // No, time-out?
+        {
+          fail ( "DNS time-out" ) ;
+        }
+        break ;
+      }
+      if ( dnsfail )
+      {
+        fail ( "host not found" ) ;
+        break ;
+      }
+      fd = sockstart ( &ip, port ) ;                    // Start connect
+      if ( fd < 0 )
+      {
+        fail ( "connect error" ) ;
+        break ;
+      }
+      state = FETCH_CONNECT ;
+      t0 = millis() ;
+      break ;
+    case FETCH_CONNECT :                                // Waiting for connection
+      res = sockpoll ( fd ) ;
+      if ( res == 0 )                                   // Still busy?
+      {
+        if ( ( millis() - t0 ) > CONNTO_CONNECT )       // Yes, time-out?
+        {
+          fail ( "connect time-out" ) ;
+        }
+        break ;
+      }
+      if ( res < 0 )
+      {
+        fail ( "connection refused" ) ;
+        break ;
+      }
+      client = WiFiClient ( fd ) ;                      // Client owns the socket now
+      sendrequest ( client, hostwoext, extension ) ;    // Send GET request
+      linex = 0 ;                                       // Prepare for header
+      LFcount = 0 ;
+      status = 0 ;
+      location = "" ;
+      clen = -1 ;
+      chunked = false ;
+      chunkleft = 0 ;
+      state = FETCH_HEADER ;
+      t0 = millis() ;
+      break ;
+    case FETCH_HEADER :                                 // Parse the header
+      if ( ( millis() - t0 ) > HLSTIMEOUT )             // Time-out?
+      {
+        fail ( "no headers" ) ;
+        break ;
+      }
+      while ( ( state == FETCH_HEADER ) &&
+              ( ( c = client.read() ) >= 0 ) )
+      {
+        if ( ( c > 0x7F ) || ( c == '\r' ) || ( c == '\0' ) )
+        {
+          continue ;                                    // Ignore unprintable characters and CR
+        }
+        if ( c != '\n' )                                // Normal character?
+        {
+          if ( linex < ( sizeof(line) - 1 ) )           // Yes, room in line?
+          {
+            line[linex++] = (char)c ;
+          }
+          LFcount = 0 ;
+          continue ;
+        }
+        if ( ++LFcount < 2 )                            // Linefeed, end of header?
+        {
+          headerline() ;                                // No, handle the line
+          continue ;
+        }
+        if ( ( status / 100 == 3 ) &&                   // Redirected?
+             location.startsWith ( "http://" ) &&
+             ( redirects < HLSMAXREDIR ) )
+        {
+          client.stop() ;                               // Yes, follow
+          url = location.substring ( 7 ) ;
+          redirects++ ;
+          connect() ;
+        }
+        else if ( status != 200 )                       // Okay?
+        {
+          fail ( "bad status" ) ;
+        }
+        else
+        {
+          linex = 0 ;                                   // Prepare for chunk sizes
+          state = ( clen == 0 ) ? FETCH_DONE :          // Body follows, if any
+                                  FETCH_BODY ;
+          t0 = millis() ;
+        }
+      }
+      break ;
+    default :
+      break ;
+  }
+}
+
+int HlsFetch::read ( uint8_t* buf, int len )
+{
+  int res = 0 ;                                         // Number of bytes read
+  int n ;                                               // Bytes in one read
+  int c ;                                               // Character of chunk size line
+
+  if ( state != FETCH_BODY )                            // Body reached?
+  {
+    return 0 ;                                          // No, nothing to read
+  }
+  while ( ( res < len ) && ( state == FETCH_BODY ) )
+  {
+    if ( chunked && ( chunkleft == 0 ) )                // Expecting a chunk size?
+    {
+      if ( ( c = client.read() ) < 0 )                  // Yes, get next character
+      {
+        break ;
+      }
+      if ( c != '\n' )                                  // End of line?
+      {
+        if ( ( c != '\r' ) && ( linex < ( sizeof(line) - 1 ) ) )
+        {
+          line[linex++] = (char)c ;                     // No, collect hex digits
+        }
+        continue ;
+      }
+      if ( linex == 0 )                                 // Empty line after chunk data?
+      {
+        continue ;                                      // Yes, skip
+      }
+      line[linex] = '\0' ;
+      linex = 0 ;
+      chunkleft = strtoul ( line, NULL, 16 ) ;          // Size of next chunk
+      if ( chunkleft == 0 )                             // Last chunk?
+      {
+        state = FETCH_DONE ;                            // Yes, download complete
+      }
+      continue ;
+    }
+    n = client.available() ;                            // Limit to available data
+    if ( n <= 0 )
+    {
+      break ;
+    }
+    if ( n > ( len - res ) )
+    {
+      n = len - res ;
+    }
+    if ( chunked && ( n > (int)chunkleft ) )            // Limit to end of chunk
+    {
+      n = chunkleft ;
+    }
+    if ( ( clen >= 0 ) && ( n > clen ) )                // Limit to content length
+    {
+      n = clen ;
+    }
+    n = client.read ( buf + res, n ) ;
+    if ( n <= 0 )
+    {
+      break ;
+    }
+    res += n ;
+    if ( chunked )
+    {
+      chunkleft -= n ;
+    }
+    if ( clen >= 0 )
+    {
+      clen -= n ;
+      if ( clen == 0 )                                  // All data received?
+      {
+        state = FETCH_DONE ;                            // Yes, download complete
+      }
+    }
+  }
+  if ( res )                                            // Data seen?
+  {
+    t0 = millis() ;                                     // Yes, restart time-out
+  }
+  else if ( ( state == FETCH_BODY ) && !client.connected() )
+  {
+    state = FETCH_DONE ;                                // Closed by server, complete
+  }
+  else if ( ( state == FETCH_BODY ) && ( ( millis() - t0 ) > HLSTIMEOUT ) )
+  {
+    fail ( "no data" ) ;
+  }
+  return res ;
+}
+
+void Hls::start ( const String& u )
+{
+  stop() ;
+  plurl = u ;
+  if ( plurl.startsWith ( "http://" ) )                 // Remove "http://" if present
+  {
+    plurl = plurl.substring ( 7 ) ;
+  }
+  dbgprint ( "Start HLS stream %s", plurl.c_str() ) ;
+  active = true ;
+  firstload = true ;
+  endlist = false ;
+  pending = false ;
+  varurl = "" ;
+  target = 0 ;
+  nextseq = 0 ;
+  qhead = 0 ;
+  qcount = 0 ;
+  cur = 0 ;
+  segstart = true ;
+  pktx = 0 ;
+  pmtpid = 0 ;
+  apid = 0 ;
+  linex = 0 ;
+  seq = 0 ;
+  isvariant = false ;
+  added = 0 ;
+  plfetch.start ( plurl ) ;                             // Get the playlist
+  refreshes++ ;
+}
+
+void Hls::stop()
+{
+  if ( active )
+  {
+    plfetch.stop() ;                                    // Close all connections
+    seg[0].stop() ;
+    seg[1].stop() ;
+    active = false ;
+  }
+}
+
+String Hls::resolve ( const char* uri ) const
+{
+  int inx ;                                             // Position of '/'
+
+  if ( strncmp ( uri, "http://", 7 ) == 0 )             // Absolute URL?
+  {
+    return String ( uri + 7 ) ;                         // Yes, remove "http://"
+  }
+  if ( strstr ( uri, "://" ) )                          // Other protocol like https?
+  {
+    return String ( "" ) ;                              // Yes, not supported
+  }
+  if ( *uri == '/' )                                    // Relative to host?
+  {
+    inx = plurl.indexOf ( '/' ) ;                       // Yes, find end of host
+    return ( inx > 0 ? plurl.substring ( 0, inx ) : plurl ) + uri ;
+  }
+  inx = plurl.lastIndexOf ( '/' ) ;                     // Relative to directory of playlist
+  return ( inx > 0 ? plurl.substring ( 0, inx ) : plurl ) + "/" + uri ;
+}
+
+void Hls::plline()
+{
+  String u ;                                            // URL of segment or variant
+
+  while ( linex && ( line[linex - 1] == ' ' ) )         // Remove trailing spaces
+  {
+    linex-- ;
+  }
+  line[linex] = '\0' ;                                  // Take care of delimiter
+  linex = 0 ;
+  if ( line[0] == '\0' )                                // Empty line?
+  {
+    return ;
+  }
+  if ( line[0] == '#' )                                 // Tag or comment?
+  {
+    if ( strncmp ( line, "#EXT-X-TARGETDURATION:", 22 ) == 0 )
+    {
+      target = atoi ( line + 22 ) ;
+    }
+    else if ( strncmp ( line, "#EXT-X-MEDIA-SEQUENCE:", 22 ) == 0 )
+    {
+      seq = atoi ( line + 22 ) ;                        // Sequence number of first segment
+    }
+    else if ( strncmp ( line, "#EXT-X-STREAM-INF:", 18 ) == 0 )
+    {
+      isvariant = true ;                                // Master playlist, variant follows
+    }
+    else if ( strncmp ( line, "#EXT-X-ENDLIST", 14 ) == 0 )
+    {
+      endlist = true ;
+    }
+    return ;
+  }
+  u = resolve ( line ) ;                                // URI of segment or variant
+  if ( u == "" )
+  {
+    dbgprint ( "HLS URI %s not supported", line ) ;
+    return ;
+  }
+  if ( isvariant )                                      // Variant stream?
+  {
+    isvariant = false ;
+    if ( varurl == "" )                                 // Yes, use the first one
+    {
+      varurl = u ;
+    }
+    return ;
+  }
+  if ( !firstload && ( seq < nextseq ) )                // Segment already seen?
+  {
+    seq++ ;                                             // Yes, skip
+    return ;
+  }
+  if ( qcount == HLSMAXSEG )                            // Queue full?
+  {
+    seq++ ;                                             // Yes, this one and the rest are added
+    pending = true ;                                    // by a next download of the playlist
+    return ;
+  }
+  queue[( qhead + qcount ) % HLSMAXSEG] = u ;           // Add to queue
+  qcount++ ;
+  added++ ;
+  nextseq = ++seq ;                                     // Next new segment
+}
+
+void Hls::plend()
+{
+  if ( linex )                                          // Last line without linefeed?
+  {
+    plline() ;                                          // Yes, handle it
+  }
+  if ( varurl != "" )                                   // Master playlist?
+  {
+    dbgprint ( "HLS variant %s", varurl.c_str() ) ;
+    plurl = varurl ;                                    // Yes, get the media playlist
+    varurl = "" ;
+    refresh = millis() ;                                // At once
+    return ;
+  }
+  if ( firstload && !endlist )                          // Start of live stream?
+  {
+    if ( pending )                                      // Yes, more segments than queued?
+    {
+      while ( qcount )                                  // Yes, forget the queue
+      {
+        queue[qhead] = "" ;
+        qhead = ( qhead + 1 ) % HLSMAXSEG ;
+        qcount-- ;
+      }
+      nextseq = seq - HLSLIVESEG ;                      // Get the last segments at once
+      pending = false ;
+      refresh = millis() ;
+      firstload = false ;
+      return ;
+    }
+    while ( qcount > HLSLIVESEG )                       // Start near the end
+    {
+      queue[qhead] = "" ;
+      qhead = ( qhead + 1 ) % HLSMAXSEG ;
+      qcount-- ;
+    }
+  }
+  firstload = false ;
+  if ( target == 0 )                                    // Target duration known?
+  {
+    target = 10 ;                                       // No, assume 10 seconds
+  }
+  // Refresh after the target duration, or after half of it if nothing has changed
+  refresh = millis() + ( added ? target * 1000 : target * 500 ) ;
+}
+
+void Hls::startseg()
+{
+  uint8_t i ;                                           // 0 for current, 1 for next
+
+  for ( i = 0 ; i < 2 ; i++ )
+  {
+    HlsFetch& f = seg[( cur + i ) % 2] ;                // Current or next segment
+    if ( ( f.getstate() == FETCH_IDLE ) && qcount )     // Free and segment waiting?
+    {
+      f.start ( queue[qhead] ) ;                        // Yes, start download
+      queue[qhead] = "" ;                               // Release memory
+      qhead = ( qhead + 1 ) % HLSMAXSEG ;
+      qcount-- ;
+    }
+  }
+}
+
+void Hls::tspacket ( const uint8_t* p )
+{
+  uint16_t       pid = ( ( p[1] & 0x1F ) << 8 ) | p[2] ;  // Packet ID
+  bool           pusi = p[1] & 0x40 ;                   // Start of PES packet or table
+  uint8_t        afc = ( p[3] >> 4 ) & 3 ;              // Adaptation field control
+  const uint8_t* d = p + 4 ;                            // Payload
+  int            len = TSPKTSIZ - 4 ;                   // Length of payload
+  int            i ;                                    // Index in table
+  int            end ;                                  // End of table entries
+  uint16_t       epid ;                                 // PID of elementary stream
+
+  if ( afc & 2 )                                        // Adaptation field present?
+  {
+    len -= 1 + d[0] ;                                   // Yes, skip it
+    d += 1 + d[0] ;
+  }
+  if ( ( ( afc & 1 ) == 0 ) || ( len <= 0 ) )           // Payload present?
+  {
+    return ;
+  }
+  if ( ( pid == 0 ) || ( pid == pmtpid ) )              // PAT or PMT?
+  {
+    if ( !pusi || ( ( 1 + d[0] + 12 ) > len ) )         // Yes, table starts here?
+    {
+      return ;
+    }
+    len -= 1 + d[0] ;                                   // Skip pointer field
+    d += 1 + d[0] ;
+    end = 3 + ( ( ( d[1] & 0x0F ) << 8 ) | d[2] ) - 4 ; // End of entries, before CRC
+    if ( end > len )
+    {
+      end = len ;
+    }
+    if ( pid == 0 )                                     // PAT?
+    {
+      for ( i = 8 ; ( i + 4 ) <= end ; i += 4 )         // Yes, search first program
+      {
+        if ( ( d[i] | d[i + 1] ) != 0 )                 // Skip network PID
+        {
+          pmtpid = ( ( d[i + 2] & 0x1F ) << 8 ) | d[i + 3] ;
+          break ;
+        }
+      }
+      return ;
+    }
+    i = 12 + ( ( ( d[10] & 0x0F ) << 8 ) | d[11] ) ;    // Skip program info
+    while ( ( i + 5 ) <= end )                          // Search first audio stream
+    {
+      epid = ( ( d[i + 1] & 0x1F ) << 8 ) | d[i + 2] ;
+      if ( ( d[i] == 0x03 ) || ( d[i] == 0x04 ) ||      // MPEG audio or AAC ADTS, LATM (0x11)
+           ( d[i] == 0x0F ) )                           // cannot be decoded by the VS1053
+      {
+        if ( apid != epid )
+        {
+          dbgprint ( "HLS audio stream type 0x%02X on PID %d", d[i], epid ) ;
+          apid = epid ;
+        }
+        return ;
+      }
+      i += 5 + ( ( ( d[i + 3] & 0x0F ) << 8 ) | d[i + 4] ) ;
+    }
+    return ;
+  }
+  if ( ( pid != apid ) || ( apid == 0 ) )               // Audio stream?
+  {
+    return ;                                            // No, skip
+  }
+  if ( pusi )                                           // Start of PES packet?
+  {
+    if ( ( len < 9 ) || d[0] || d[1] || ( d[2] != 1 ) ) // Yes, check start code
+    {
+      return ;
+    }
+    i = 9 + d[8] ;                                      // Skip PES header
+    len -= i ;
+    d += i ;
+    if ( len <= 0 )
+    {
+      return ;
+    }
+  }
+  queuedata ( d, len ) ;                                // Send audio to the player
+}
+
+void Hls::demux ( const uint8_t* p, int len )
+{
+  int n ;                                               // Bytes to copy
+
+  while ( len > 0 )
+  {
+    if ( pktx == 0 )                                    // At start of a packet?
+    {
+      if ( *p != 0x47 )                                 // Yes, sync byte?
+      {
+        p++ ;                                           // No, search for it
+        len-- ;
+        continue ;
+      }
+      if ( len >= TSPKTSIZ )                            // Complete packet in buffer?
+      {
+        tspacket ( p ) ;                                // Yes, handle it in place
+        p += TSPKTSIZ ;
+        len -= TSPKTSIZ ;
+        continue ;
+      }
+    }
+    n = TSPKTSIZ - pktx ;                               // Collect packet split over two reads
+    if ( n > len )
+    {
+      n = len ;
+    }
+    memcpy ( pkt + pktx, p, n ) ;
+    pktx += n ;
+    p += n ;
+    len -= n ;
+    if ( pktx == TSPKTSIZ )                             // Packet complete?
+    {
+      tspacket ( pkt ) ;                                // Yes, handle it
+      pktx = 0 ;
+    }
+  }
+}
+
+int Hls::handle ( uint8_t* buf, int len, int maxaudio )
+{
+  int       res = 0 ;                                   // Number of bytes read
+  int       n ;                                         // Bytes of playlist
+  int       i ;                                         // Index in playlist data
+  HlsFetch& s = seg[cur] ;                              // Current segment
+
+  if ( !active )
+  {
+    return 0 ;
+  }
+  plfetch.handle() ;                                    // Advance all downloads
+  seg[0].handle() ;
+  seg[1].handle() ;
+  switch ( plfetch.getstate() )                         // Handle the playlist
+  {
+    case FETCH_BODY :
+      n = plfetch.read ( buf, len ) ;                   // Read part of the playlist
+      for ( i = 0 ; i < n ; i++ )
+      {
+        if ( buf[i] == '\n' )                           // End of line?
+        {
+          plline() ;                                    // Yes, handle it
+        }
+        else if ( ( buf[i] != '\r' ) && ( linex < ( sizeof(line) - 1 ) ) )
+        {
+          line[linex++] = (char)buf[i] ;
+        }
+      }
+      break ;
+    case FETCH_DONE :                                   // Playlist complete
+      plend() ;
+      plfetch.stop() ;
+      break ;
+    case FETCH_FAILED :                                 // Download failed
+      errors++ ;
+      plfetch.stop() ;
+      refresh = millis() + 2000 ;                       // Retry later
+      break ;
+    case FETCH_IDLE :                                   // Time for a new download?
+      if ( pending ? ( qcount <= ( HLSMAXSEG / 2 ) ) :  // Room for rest of the playlist?
+                     ( !endlist && ( (int32_t)( millis() - refresh ) >= 0 ) ) )
+      {
+        linex = 0 ;                                     // Yes, start parser
+        seq = 0 ;
+        isvariant = false ;
+        added = 0 ;
+        pending = false ;
+        plfetch.start ( plurl ) ;
+        refreshes++ ;
+      }
+      break ;
+    default :
+      break ;
+  }
+  startseg() ;                                          // Start downloads of segments
+  switch ( s.getstate() )                               // Handle the current segment
+  {
+    case FETCH_BODY :
+      if ( maxaudio == 0 )                              // Room in ringbuffer?
+      {
+        s.touch() ;                                     // No, waiting is not a time-out
+        break ;
+      }
+      res = s.read ( buf, maxaudio ) ;                  // Read audio
+      if ( res > 0 )
+      {
+        tlm.countin ( res ) ;                           // Count for telemetry
+        if ( segstart )                                 // First data of this segment?
+        {
+          ts = ( buf[0] == 0x47 ) ;                     // Yes, transport stream?
+          pktx = 0 ;
+          segstart = false ;
+        }
+        if ( ts )
+        {
+          demux ( buf, res ) ;                          // Get audio from transport stream
+        }
+        else
+        {
+          queuedata ( buf, res ) ;                      // Audio only, send to player
+        }
+      }
+      break ;
+    case FETCH_DONE :                                   // Segment complete
+    case FETCH_FAILED :                                 // or failed
+      if ( s.getstate() == FETCH_DONE )
+      {
+        segments++ ;
+      }
+      else
+      {
+        errors++ ;
+      }
+      s.stop() ;                                        // Next segment becomes current
+      cur ^= 1 ;
+      if ( seg[cur].getstate() == FETCH_BODY )          // Headers of next segment done?
+      {
+        prefetched++ ;                                  // Yes, count for statistics
+      }
+      seg[cur].touch() ;                                // Restart time-out for its data
+      segstart = true ;
+      startseg() ;                                      // Start prefetch of the next one
+      break ;
+    default :
+      break ;
+  }
+  return res ;
+}
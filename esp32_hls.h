@@ -0,0 +1,163 @@
+#pragma once
+#include "esp32_radio.h"
+//**************************************************************************************************
+// HTTP Live Streaming (HLS) input.                                                                *
+//**************************************************************************************************
+// A HLS station is a playlist (.m3u8) with a list of short segments.  The playlist is downloaded  *
+// again on the schedule of the target duration; new segments are added to a queue.  A master      *
+// playlist with variant streams is followed to the first variant.                                 *
+// Segments are downloaded one after the other.  While the current segment is played, the          *
+// connection for the next segment is made and its headers are handled, so the data of the next    *
+// segment is available at once.  There is not enough RAM to keep a complete segment.              *
+// If the queue is full, the rest of the playlist is skipped.  It is added by a next download,     *
+// that resumes at the first sequence number not in the queue.  So a long VOD playlist is played   *
+// from the start.  After #EXT-X-ENDLIST the stream ends when all queued segments are played.      *
+// Segments may contain AAC (ADTS) or MP3 data, or an MPEG transport stream.  For a transport      *
+// stream the audio is taken from the PES packets of the first audio stream in the PMT.  The audio *
+// is sent to the player with queuedata().                                                         *
+// All connections are non-blocking, see HlsFetch.                                                 *
+//**************************************************************************************************
+#define HLSMAXSEG     8                                 // Max. number of segments in queue
+#define HLSLIVESEG    3                                 // Start this number of segments from end
+#define HLSTIMEOUT    10000                             // Time-out for each phase of a download
+#define HLSMAXREDIR   3                                 // Max. number of redirections
+#define TSPKTSIZ      188                               // Size of a transport stream packet
+
+enum fetchstate_t { FETCH_IDLE, FETCH_RESOLVE,          // States of a download
+                    FETCH_CONNECT, FETCH_HEADER,
+                    FETCH_BODY, FETCH_DONE,
+                    FETCH_FAILED } ;
+
+//**************************************************************************************************
+// Non-blocking download of a file with HTTP GET.  Follows redirections and handles chunked        *
+// transfer encoding.                                                                              *
+//**************************************************************************************************
+class HlsFetch
+{
+  private:
+    fetchstate_t  state     = FETCH_IDLE ;              // Current state
+    String        url ;                                 // URL without "http://"
+    String        hostwoext ;                           // Host without extension and portnumber
+    String        extension ;                           // Like "/live/seg123.ts"
+    uint16_t      port ;                                // Port number of host
+    ip_addr_t     ip ;                                  // IP address of host
+    volatile bool dnsdone ;                             // DNS reply received
+    volatile bool dnsfail ;                             // DNS lookup failed
+    int           fd ;                                  // Socket during connect
+    WiFiClient    client ;                              // Connection after connect
+    uint32_t      t0 ;                                  // millis() at start of state or last data
+    char          line[128] ;                           // Header line or chunk size
+    uint16_t      linex ;                               // Index in line
+    uint8_t       LFcount ;                             // For detection of end of header
+    int           status ;                              // HTTP status code
+    String        location ;                            // Redirection
+    uint8_t       redirects ;                           // Number of redirections
+    int32_t       clen ;                                // Body bytes left, -1 if unknown
+    bool          chunked ;                             // Chunked transfer encoding
+    uint32_t      chunkleft ;                           // Bytes left in current chunk
+
+    static void   dnscb ( const char* name,             // Callback for DNS lookup
+                          const ip_addr_t* ipaddr, void* arg ) ;
+    bool          connect() ;                           // Start DNS lookup for url
+    void          fail ( const char* reason ) ;         // Close connection after failure
+    void          headerline() ;                        // Handle a line of the header
+  public:
+    bool          start ( const String& u ) ;           // Start download
+    void          stop() ;                              // Close connection
+    void          handle() ;                            // Advance connect and headers
+    int           read ( uint8_t* buf, int len ) ;      // Read body data
+    inline void   touch()                               // Restart time-out for body data
+    {
+      t0 = millis() ;
+    }
+    inline fetchstate_t getstate() const
+    {
+      return state ;
+    }
+    inline const String& geturl() const
+    {
+      return url ;
+    }
+} ;
+
+class Hls
+{
+  private:
+    bool          active    = false ;                   // HLS stream is playing
+    String        plurl ;                               // URL of the media playlist
+    HlsFetch      plfetch ;                             // Download of the playlist
+    HlsFetch      seg[2] ;                              // Current and next segment
+    uint8_t       cur       = 0 ;                       // Index of current segment in seg[]
+    bool          segstart ;                            // No data of current segment seen yet
+    char          line[256] ;                           // Line of the playlist
+    uint16_t      linex ;                               // Index in line
+    // State of the playlist parser
+    uint32_t      seq ;                                 // Sequence number of next URI
+    bool          isvariant ;                           // Next URI is a variant stream
+    String        varurl ;                              // URL of the first variant stream
+    bool          endlist ;                             // No more segments will be added
+    bool          pending ;                             // Playlist has segments not yet queued
+    bool          firstload ;                           // First download of the playlist
+    uint32_t      nextseq ;                             // First sequence number not in queue
+    uint32_t      added ;                               // Segments added by this download
+    uint32_t      target ;                              // Target duration in seconds
+    uint32_t      refresh ;                             // millis() of next download of playlist
+    String        queue[HLSMAXSEG] ;                    // URLs of segments to play
+    uint8_t       qhead ;                               // Index of first segment in queue
+    uint8_t       qcount ;                              // Number of segments in queue
+    // State of the transport stream demultiplexer
+    bool          ts ;                                  // Current segment is a transport stream
+    uint8_t       pkt[TSPKTSIZ] ;                       // Packet split over two reads
+    uint8_t       pktx ;                                // Number of bytes in pkt
+    uint16_t      pmtpid ;                              // PID of the PMT
+    uint16_t      apid ;                                // PID of the audio stream
+    // Statistics
+    uint32_t      segments  = 0 ;                       // Segments played
+    uint32_t      prefetched = 0 ;                      // Next segment was ready in time
+    uint32_t      refreshes = 0 ;                       // Downloads of the playlist
+    uint32_t      errors    = 0 ;                       // Failed downloads
+
+    String        resolve ( const char* uri ) const ;   // Make URL from URI in playlist
+    void          plline() ;                            // Handle a line of the playlist
+    void          plend() ;                             // Handle end of the playlist
+    void          startseg() ;                          // Start download of queued segments
+    void          demux ( const uint8_t* p, int len ) ; // Get audio from transport stream
+    void          tspacket ( const uint8_t* p ) ;       // Handle one transport stream packet
+  public:
+    void          start ( const String& u ) ;           // Start playing a HLS stream
+    void          stop() ;                              // Stop playing
+    int           handle ( uint8_t* buf, int len,       // Advance downloads, feed audio
+                           int maxaudio ) ;
+    inline bool   isactive() const
+    {
+      return active ;
+    }
+    inline bool   isended() const                       // All segments of a VOD stream played?
+    {
+      return active && endlist && !pending && ( qcount == 0 ) &&
+             ( seg[0].getstate() == FETCH_IDLE ) &&
+             ( seg[1].getstate() == FETCH_IDLE ) ;
+    }
+    inline uint32_t gettarget() const
+    {
+      return target ;
+    }
+    inline uint32_t getsegments() const
+    {
+      return segments ;
+    }
+    inline uint32_t getprefetched() const
+    {
+      return prefetched ;
+    }
+    inline uint32_t getrefreshes() const
+    {
+      return refreshes ;
+    }
+    inline uint32_t geterrors() const
+    {
+      return errors ;
+    }
+} ;
+
+extern Hls               hls ;                          // HLS input
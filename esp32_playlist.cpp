@@ -0,0 +1,174 @@
+//**************************************************************************************************
+// Playlist class implementation.                                                                  *
+//**************************************************************************************************
+#include "esp32_radio.h"
+#include "esp32_playlist.h"
+
+void Playlist::begin ( const String& u )
+{
+  url = u ;
+  valid = false ;
+  count = 0 ;
+  poolused = 0 ;
+  pendtitle = PLNONE ;
+  for ( uint16_t i = 0 ; i < PLMAXENTRIES ; i++ )       // No .pls titles yet
+  {
+    plstitles[i] = PLNONE ;
+  }
+  t0 = millis() ;
+  if ( pool == NULL )                                   // Pool allocated?
+  {
+    pool = (char*)malloc ( PLPOOLSIZ ) ;                // No, get space for the strings
+  }
+}
+
+uint16_t Playlist::addstring ( const char* str )
+{
+  uint16_t len = strlen ( str ) + 1 ;                   // Space needed, including delimiter
+  uint16_t off = poolused ;                             // Position in pool
+
+  if ( ( pool == NULL ) || ( ( poolused + len ) > PLPOOLSIZ ) )
+  {
+    return PLNONE ;                                     // No room
+  }
+  memcpy ( pool + off, str, len ) ;
+  poolused += len ;
+  return off ;
+}
+
+void Playlist::addentry ( const char* u, uint16_t num )
+{
+  const char* p ;                                       // Position of "http://"
+  uint16_t    off ;                                     // Offset of URL in pool
+
+  if ( count == PLMAXENTRIES )                          // Room in table?
+  {
+    return ;                                            // No, skip
+  }
+  if ( ( p = strstr ( u, "http://" ) ) )                // Does URL contain "http://"?
+  {
+    u = p + 7 ;                                         // Yes, remove it
+  }
+  off = addstring ( u ) ;
+  if ( off == PLNONE )                                  // Room in pool?
+  {
+    return ;
+  }
+  entries[count].urloff = off ;
+  entries[count].plsnum = num ;
+  entries[count].titleoff = PLNONE ;
+  if ( num == 0 )                                       // .m3u entry?
+  {
+    entries[count].titleoff = pendtitle ;               // Yes, use title of #EXTINF, if any
+    pendtitle = PLNONE ;
+  }
+  else if ( num <= PLMAXENTRIES )                       // .pls title seen before URL?
+  {
+    entries[count].titleoff = plstitles[num - 1] ;      // Yes, use it
+    plstitles[num - 1] = PLNONE ;
+  }
+  count++ ;
+}
+
+void Playlist::settitle ( uint16_t off, uint16_t num )
+{
+  uint16_t i ;                                          // Index in table
+
+  if ( num == 0 )                                       // .m3u title?
+  {
+    pendtitle = off ;                                   // Yes, keep for the URL that follows
+    return ;
+  }
+  for ( i = 0 ; i < count ; i++ )                       // .pls, URL already seen?
+  {
+    if ( entries[i].plsnum == num )
+    {
+      entries[i].titleoff = off ;                       // Yes, set title
+      return ;
+    }
+  }
+  if ( num <= PLMAXENTRIES )                            // Keep for the URL that follows
+  {
+    plstitles[num - 1] = off ;
+  }
+}
+
+void Playlist::addline ( char* line )
+{
+  char*  p ;                                            // Position in line
+  size_t len ;                                          // Length of line
+
+  while ( ( *line == ' ' ) || ( *line == '\t' ) )       // Skip leading spaces
+  {
+    line++ ;
+  }
+  len = strlen ( line ) ;                               // Remove CR and trailing spaces
+  while ( len && ( (uint8_t)line[len - 1] <= ' ' ) )
+  {
+    line[--len] = '\0' ;
+  }
+  if ( len < 5 )                                        // Skip short lines
+  {
+    return ;
+  }
+  if ( strncmp ( line, "#EXTINF:", 8 ) == 0 )           // Info for the next entry?
+  {
+    if ( ( p = strchr ( line, ',' ) ) )                 // Yes, title follows comma
+    {
+      settitle ( addstring ( p + 1 ), 0 ) ;
+    }
+    return ;
+  }
+  if ( ( *line == '#' ) || ( *line == '[' ) )           // Comment or "[playlist]"?
+  {
+    return ;                                            // Yes, ignore
+  }
+  p = strchr ( line, '=' ) ;                            // Key like "File1=" of .pls?
+  if ( p && ( strcspn ( line, "/:." ) > (size_t)( p - line ) ) )
+  {
+    if ( ( strncasecmp ( line, "file", 4 ) == 0 ) && isdigit ( line[4] ) )
+    {
+      addentry ( p + 1, atoi ( line + 4 ) ) ;           // URL of an entry
+    }
+    else if ( ( strncasecmp ( line, "title", 5 ) == 0 ) && isdigit ( line[5] ) )
+    {
+      settitle ( addstring ( p + 1 ), atoi ( line + 5 ) ) ;
+    }
+    return ;                                            // Other keys are ignored
+  }
+  addentry ( line, 0 ) ;                                // URL in .m3u file
+}
+
+void Playlist::finish()
+{
+  loadms = millis() - t0 ;                              // Time needed for download
+  t0 = millis() ;                                       // Start of expiration period
+  valid = true ;
+  dbgprint ( "Playlist has %d entries, %d bytes, loaded in %d msec",
+             count, poolused, loadms ) ;
+}
+
+bool Playlist::isvalid ( const String& u ) const
+{
+  return valid && count && ( u == url ) &&
+         ( ( millis() - t0 ) < PLEXPIRE ) ;
+}
+
+const char* Playlist::geturl ( uint16_t n ) const
+{
+  if ( ( n == 0 ) || ( n > count ) )                    // Legal entry?
+  {
+    return "" ;
+  }
+  return pool + entries[n - 1].urloff ;
+}
+
+const char* Playlist::gettitle ( uint16_t n ) const
+{
+  if ( ( n == 0 ) || ( n > count ) ||                   // Legal entry with a title?
+       ( entries[n - 1].titleoff == PLNONE ) )
+  {
+    return "" ;
+  }
+  return pool + entries[n - 1].titleoff ;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "esp32_radio.h"
+//**************************************************************************************************
+// Table with the entries of a .m3u or .pls playlist.                                              *
+//**************************************************************************************************
+// A playlist is downloaded and parsed once.  The URL and the title of every entry are kept in a   *
+// string pool, the table only holds offsets in this pool.  Selecting the next or previous entry   *
+// of the same playlist connects to the URL of that entry directly, without downloading the        *
+// playlist again.  The table is refreshed after PLEXPIRE msec or after a "reload" command.        *
+// In a .m3u file an "#EXTINF:<length>,<title>" line precedes the URL.  A .pls file has lines like *
+// "File1=<URL>" and "Title1=<title>" in any order.  A title that comes before its URL is kept by  *
+// entry number until the URL follows.                                                             *
+// A server may keep the connection open after the playlist.  Without a Content-Length the end of  *
+// the playlist is then detected by PLBODYTIME msec without data.                                  *
+//**************************************************************************************************
+#define PLMAXENTRIES  64                                // Max. number of entries in the table
+#define PLPOOLSIZ     4096                              // Size of pool for URLs and titles
+#define PLEXPIRE      3600000                           // Download playlist again after msec
+#define PLBODYTIME    3000                              // End of playlist after msec without data
+#define PLNONE        0xFFFF                            // No string in pool
+
+struct plentry_struct                                   // Entry in the table
+{
+  uint16_t urloff ;                                     // Offset of URL in pool
+  uint16_t titleoff ;                                   // Offset of title in pool or PLNONE
+  uint16_t plsnum ;                                     // Number in .pls file, 0 for .m3u
+} ;
+
+class Playlist
+{
+  private:
+    String          url ;                               // URL of the playlist
+    bool            valid     = false ;                 // Table is complete
+    char*           pool      = NULL ;                  // String pool
+    uint16_t        poolused  = 0 ;                     // Bytes used in pool
+    plentry_struct  entries[PLMAXENTRIES] ;             // The table
+    uint16_t        count     = 0 ;                     // Number of entries in table
+    uint16_t        pendtitle = PLNONE ;                // Title for an entry that follows (.m3u)
+    uint16_t        plstitles[PLMAXENTRIES] ;           // Titles by entry number before URL (.pls)
+    uint32_t        t0 ;                                // Start of download or end of download
+    uint32_t        loadms    = 0 ;                     // Time needed for download and parse
+    uint32_t        hits      = 0 ;                     // Entries selected from the table
+
+    uint16_t        addstring ( const char* str ) ;     // Add a string to the pool
+    void            addentry ( const char* u,           // Add an URL to the table
+                               uint16_t num ) ;
+    void            settitle ( uint16_t off,            // Set title of an entry
+                               uint16_t num ) ;
+  public:
+    void            begin ( const String& u ) ;         // Start a new download
+    void            addline ( char* line ) ;            // Parse a line of the playlist
+    void            finish() ;                          // Download complete
+    bool            isvalid ( const String& u ) const ; // Table for this URL and not expired?
+    const char*     geturl ( uint16_t n ) const ;       // URL of entry n (1..count)
+    const char*     gettitle ( uint16_t n ) const ;     // Title of entry n, "" if unknown
+    inline void     invalidate()                        // Force a new download
+    {
+      valid = false ;
+    }
+    inline void     hit()                               // Count an entry selected from table
+    {
+      hits++ ;
+    }
+    inline uint16_t getcount() const
+    {
+      return count ;
+    }
+    inline uint32_t getloadms() const
+    {
+      return loadms ;
+    }
+    inline uint32_t gethits() const
+    {
+      return hits ;
+    }
+} ;
+
+extern Playlist          plcache ;                      // Entries of the last playlist
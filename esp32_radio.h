@@ -185,8 +185,21 @@
 #include <driver/adc.h>
 #include <Update.h>
 #include <base64.h>
-// Number of entries in the queue
-#define QSIZ 400
+#include <lwip/dns.h>
+#include <lwip/sockets.h>
+// Default size of the ringbuffer for the MP3/Ogg datastream.  May be changed by preference "ringbuf".
+// The size is always a power of 2, other values are rounded up.
+#define RINGBFSIZ 16384
+#define RINGBFMIN 4096
+#define RINGBFMAX 65536
+// Number of entries in the queue for control functions (start/stop song)
+#define CQSIZ 10
+// Default max. duration of an SDI burst to the VS1053 in microseconds.  Preference "sdiburst".
+// The maximum limits how long playtask may keep the SPI bus from the display and the SD card.
+// A burst always sends at least one 32 byte chunk, that takes about 50 usec at 5 MHz.
+#define SDIBURST 2000
+#define SDIBURSTMIN 32
+#define SDIBURSTMAX 2048
 // Debug buffer size
 #define DEBUG_BUFFER_SIZE 150
 // Access point name if connection to WiFi network fails.  Also the hostname for WiFi and OTA.
@@ -201,8 +214,49 @@
 #define TIMEPOS -52
 // SPI speed for SD card
 #define SDSPEED 1000000
+// Parameters for the clock drift controller.  Settle time in seconds, max. correction in ppm and
+// proportional and integral gain (ppm per msec of audio).
+#define DRIFTSETTLE 30
+#define DRIFTMAXPPM 300
+#define DRIFT_KP    0.5
+#define DRIFT_KI    0.005
+// Number of entries in the SPI wait/hold time histograms.  Entry n counts times < 2^n usec.
+#define SPIHISTSIZ 16
+// Jitter buffer.  Default minimum start level in msec of audio (preference "jitterbuf"), max. time
+// to wait for the start level and number of underruns kept in the log.
+#define JITTERMS   250
+#define JBMAXHOLD  5000
+#define URLOGSIZ   8
+// Time constant in msec for the decay of the longest gap between reads
+#define JBDECAY    30000
+// Default and max. time in msec for a volume ramp of 40 dB (preference "volramp")
+#define VOLRAMP    100
+#define VOLRAMPMAX 2000
+// Max. size in bytes of a VS1053 plugin file on SD, the file is kept in RAM
+#define PLGMAXSIZ  32768
+// Spectrum analyzer display.  The bands are read every SPECPERIOD msec, the SPI bus is held for at
+// most SPECBUDGET usec per frame.  The spectrum analyzer plugin of VLSI keeps the number of bands
+// at SPECWRAM, followed by an unused word and the band values.
+#define SPECPERIOD   50
+#define SPECBUDGET   2000
+#define SPECWRAM     0x1802
+#define SPECMAXBANDS 23
+#define SPECLEVELS   32
+#define SPECSTRIP    16                                  // Width of a strip when clearing the area
+// Time-outs in msec for the phases of a connection to a host
+#define CONNTO_DNS     5000
+#define CONNTO_CONNECT 5000
+#define CONNTO_HEADER  8000
+// Stream recovery.  No audio for RECSTALL msec starts the recovery.  The wait before the next step
+// starts at RECBACKOFF msec and is doubled for every step, up to RECMAXBACKOFF msec.
+#define RECSTALL      10000
+#define RECBACKOFF    10000
+#define RECMAXBACKOFF 60000
 // Size of metaline buffer
 #define METASIZ 1024
+// Sizes of the fields in the ICY metadata record
+#define ICYTITLESIZ 150
+#define ICYURLSIZ   128
 // Max. number of NVS keys in table
 #define MAXKEYS 200
 // Time-out [sec] for blanking TFT display (BL pin)
@@ -215,12 +269,31 @@
 //
 #define otaclient mp3client                   // OTA uses mp3client for connection to host
 
+enum spiclient_t { SPI_VS1053, SPI_SD, SPI_TFT,           // Users of the SPI bus, highest
+                   SPI_OTHER, SPI_NUMCLIENTS } ;          // priority first
+enum connstate_t { CONN_IDLE, CONN_RESOLVE,               // States of the connection to a
+                   CONN_CONNECT, CONN_REQUEST,            // host, see handleconnect()
+                   CONN_HEADER } ;
+enum hdrfield_t  { HF_NONE, HF_LOCATION,                  // Known fields in a HTTP response
+                   HF_CONTENTTYPE, HF_CONTENTLENGTH,      // header, see matchhdrline()
+                   HF_TRANSFERENC, HF_ICYBR,
+                   HF_ICYMETAINT, HF_ICYNAME,
+                   HF_ICYGENRE, HF_ICYURL,
+                   HF_ICYDESCR, HF_ICYOTHER } ;
+
 //**************************************************************************************************
 // Forward declaration and prototypes of various functions.                                        *
 //**************************************************************************************************
+void        claimSPI ( const char* p, spiclient_t client = SPI_OTHER ) ;
+void        releaseSPI() ;
+bool        yieldSPI() ;
+void        claimDSP ( const char* p ) ;
+void        releaseDSP() ;
 void        displaytime ( const char* str, uint16_t color = 0xFFFF ) ;
-void        showstreamtitle ( const char* ml, bool full ) ;
+bool        showstreamtitle ( const char* ml, bool full ) ;
 void        handlebyte_ch ( uint8_t b ) ;
+void        handlebytes_ch ( uint8_t* buf, int len ) ;
+void        queuedata ( const uint8_t* p, int len ) ;
 void        handleFSf ( const String& pagename ) ;
 void        handleCmd()  ;
 char*       dbgprint( const char* format, ... ) ;
@@ -233,8 +306,17 @@ void        mp3loop() ;
 void        tftlog ( const char *str ) ;
 void        playtask ( void * parameter ) ;       // Task to play the stream
 void        spftask ( void * parameter ) ;        // Task for special functions
+void        spectask ( void * parameter ) ;       // Task for the spectrum analyzer display
 void        gettime() ;
 void        reservepin ( int8_t rpinnr ) ;
+void        splithost ( const String& h, String& hostwoext,
+                        uint16_t& port, String& extension ) ;
+int         sockstart ( const ip_addr_t* ip, uint16_t port ) ;
+int         sockpoll ( int fd ) ;
+void        sendrequest ( WiFiClient& client, const String& hostwoext,
+                          const String& extension ) ;
+hdrfield_t  matchhdrline ( char* line, char** val ) ;
+bool        hdrendswith ( const char* val, const char* token ) ;
 
 
 //**************************************************************************************************
@@ -251,11 +333,13 @@ struct scrseg_struct                                  // For screen segments
   String   str ;                                      // String to be displayed
 } ;
 
-enum qdata_type { QDATA, QSTARTSONG, QSTOPSONG } ;    // datatyp in qdata_struct
-struct qdata_struct
+enum qdata_type { QSTARTSONG, QSTOPSONG,             // func in qctrl_struct
+                 QTRACKMARK,                          // Start of next track (gapless)
+                 QCANCEL } ;                          // Fast stop, older data is skipped
+struct qctrl_struct                                   // Control function for playtask
 {
-  int datatyp ;                                       // Identifier
-  __attribute__((aligned(4))) uint8_t buf[32] ;       // Buffer for chunk
+  int      func ;                                     // Identifier
+  uint32_t pos ;                                      // Execute when playtask reaches this position
 } ;
 
 struct ini_struct
@@ -292,6 +376,114 @@ struct ini_struct
   int8_t         spi_mosi_pin ;                       // GPIO connected to SPI MOSI pin
   uint16_t       bat0 ;                               // ADC value for 0 percent battery charge
   uint16_t       bat100 ;                             // ADC value for 100 percent battery charge
+  uint32_t       ringbufsiz ;                         // Size of ringbuffer for datastream
+  uint16_t       sdiburst ;                           // Max. duration of an SDI burst in usec
+  bool           driftctl ;                           // Clock drift compensation on/off
+  bool           gapless ;                            // Gapless playing of SD tracks on/off
+  bool           fastswitch ;                         // Fast switching of stations on/off
+  bool           standby ;                            // Standby connections to neighbours on/off
+  uint16_t       jitterms ;                           // Minimum start level of jitter buffer (msec)
+  uint16_t       volramp ;                            // Time for volume ramp of 40 dB (msec)
+  bool           spectrum ;                           // Spectrum analyzer display on/off
+} ;
+
+struct drift_struct                                   // State of clock drift controller
+{
+  bool           active ;                             // Controller is running
+  int16_t        settle ;                             // Seconds left before target is fixed
+  float          level ;                              // Smoothed buffer level in bytes
+  float          target ;                             // Target buffer level in bytes
+  float          trend ;                              // Change of level in bytes per minute
+  float          integ ;                              // Integral part of correction in ppm
+  int16_t        ppm ;                                // Correction sent to VS1053 in ppm
+} ;
+
+struct jitter_struct                                  // State of the jitter buffer
+{
+  uint32_t       lastarrival ;                        // millis() of last read from stream
+  float          mean ;                               // Average time between reads (msec)
+  float          dev ;                                // Average deviation from mean (msec)
+  float          peak ;                               // Slowly decaying longest gap (msec)
+  uint32_t       targetms ;                           // Start level in msec of audio
+  uint32_t       wmbytes ;                            // Start level in bytes, used by playtask
+  uint32_t       holdms ;                             // Time waited for start level, last start
+  volatile bool  started ;                            // Start level reached after start of song
+  uint32_t       urtime[URLOGSIZ] ;                   // millis() of underruns
+  uint32_t       urdur[URLOGSIZ] ;                    // Duration of underruns (msec)
+  uint32_t       urcount ;                            // Number of underruns in log (playtask)
+  uint32_t       urshown ;                            // Number of underruns printed (mp3loop)
+} ;
+
+struct conn_struct                                    // Connection to a host in progress
+{
+  connstate_t    state ;                              // Current state
+  uint32_t       t0 ;                                 // millis() at start of current state
+  uint32_t       gen ;                                // Generation, to ignore late DNS replies
+  volatile bool  dnsdone ;                            // DNS reply received
+  volatile bool  dnsfail ;                            // DNS lookup failed
+  ip_addr_t      ip ;                                 // IP address of host
+  int            fd ;                                 // Socket during connect
+  String         hostwoext ;                          // Host without extension and portnumber
+  uint16_t       port ;                               // Port number of host
+  String         extension ;                          // Like "/mp3"
+  uint32_t       tdns ;                               // Duration of DNS lookup (msec)
+  uint32_t       tconnect ;                           // Duration of TCP connect (msec)
+  uint32_t       theader ;                            // Duration of header phase (msec)
+  uint32_t       timeouts ;                           // Number of time-outs
+} ;
+
+struct switch_struct                                  // Timing of last station switch
+{
+  uint32_t       start ;                              // millis() at stop of old station
+  bool           busy ;                               // Switch in progress
+  // Phases in msec after start:
+  uint32_t       stop ;                               // Old input closed
+  uint32_t       connect ;                            // New host connected or file opened
+  uint32_t       header ;                             // Headers handled, first data
+  uint32_t       cancel ;                             // Decoder cancelled by playtask
+  uint32_t       audio ;                              // First data sent to decoder
+} ;
+
+struct icymeta_struct                                 // Last ICY metadata
+{
+  char           title[ICYTITLESIZ] ;                 // Complete StreamTitle
+  char           artist[ICYTITLESIZ] ;                // Part of title before " - ", or empty
+  char           song[ICYTITLESIZ] ;                  // Part of title after " - "
+  char           url[ICYURLSIZ] ;                     // StreamUrl
+  uint32_t       seq ;                                // Incremented on every change
+  uint32_t       blocks ;                             // Number of metadata blocks seen
+} ;
+
+enum recstep_t { REC_IDLE, REC_RECONNECT, REC_REDIRECT,   // Steps of the stream recovery
+                 REC_NEXTPRESET, REC_WIFI, REC_RESTART } ;
+
+struct recovery_struct                                // State of the stream recovery
+{
+  String         url ;                                // URL as requested, before redirections
+  String         redirect ;                           // Target of the last redirection
+  bool           keepurl ;                            // Next host request is a redirection or retry
+  bool           wifiwait ;                           // Waiting for WiFi after re-association
+  uint32_t       lastcount ;                          // Last seen value of totalcount
+  uint32_t       lastdata ;                           // millis() of last audio sent to decoder
+  recstep_t      step ;                               // Last step taken, REC_IDLE if none
+  uint32_t       t0 ;                                 // millis() of detection of the stall
+  uint32_t       next ;                               // millis() of the next step
+  uint32_t       backoff ;                            // Wait before the next step
+  uint32_t       tta ;                                // Time to audio of last recovery in msec
+  uint16_t       steps[REC_RESTART] ;                 // Number of times a step was taken
+  uint16_t       recovered ;                          // Number of successful recoveries
+} ;
+
+struct spectrum_struct                                // State of the spectrum analyzer display
+{
+  uint8_t        bands ;                              // Number of bands shown, 0 is none
+  uint8_t        height[SPECMAXBANDS] ;               // Height of the bars on the screen
+  bool           redraw ;                             // Bars overwritten, paint all of them
+  bool           clearing ;                           // Area is being cleared in strips
+  uint16_t       clearx ;                             // Next strip to clear
+  uint32_t       frames ;                             // Number of frames
+  uint32_t       busus ;                              // Total time the SPI bus was held (usec)
+  uint32_t       late ;                               // Frames with bars left for the next frame
 } ;
 
 struct WifiInfo_t                                     // For list with WiFi info
@@ -322,6 +514,19 @@ struct nvs_page                                       // For nvs entries
   nvs_entry Entry[126] ;
 } ;
 
+struct hdrkey_struct                                  // Entry in table of known header fields
+{
+  const char* name ;                                  // Name of field in lower case
+  hdrfield_t  field ;                                 // Field id
+} ;
+
+struct plgflash_struct                                // VS1053 plugin compiled into the program
+{
+  const char*     name ;                              // Name used in preference "plugin_0x"
+  const uint16_t* img ;                               // Image in compressed VLSI format
+  uint16_t        size ;                              // Size of image in words
+} ;
+
 struct keyname_t                                      // For keys in NVS
 {
   char      Key[16] ;                                 // Mac length is 15 plus delimeter
@@ -356,18 +561,26 @@ extern TaskHandle_t      maintask ;                             // Taskhandle fo
 extern TaskHandle_t      xplaytask ;                            // Task handle for playtask
 extern TaskHandle_t      xspftask ;                             // Task handle for special functions
 extern SemaphoreHandle_t SPIsem ;                        // For exclusive SPI usage
+extern SemaphoreHandle_t dspsem ;                        // For exclusive display usage (not SPI)
+extern portMUX_TYPE      spimux ;                               // Protects spi_waiting
+extern volatile uint8_t  spi_waiting[SPI_NUMCLIENTS] ;          // Number of waiters per SPI client
+extern spiclient_t       spi_holder ;                           // Client that owns the SPI bus
+extern const char*       spi_holdname ;                         // Id of the owner of the SPI bus
+extern uint32_t          spi_granttime ;                        // Time (micros) SPI bus was granted
+extern const uint32_t    spi_maxhold[SPI_NUMCLIENTS] ;          // Max. hold time per client (usec)
+extern uint32_t          spi_waithist[SPI_NUMCLIENTS][SPIHISTSIZ] ; // Histogram of wait times
+extern uint32_t          spi_holdhist[SPI_NUMCLIENTS][SPIHISTSIZ] ; // Histogram of hold times
+extern uint32_t          spi_overholds[SPI_NUMCLIENTS] ;        // Number of grants held too long
 extern hw_timer_t*       timer ;                         // For timer
 extern char              timetxt[9] ;                           // Converted timeinfo
 extern char              cmd[130] ;                             // Command from MQTT or Serial
 extern uint8_t           tmpbuff[6000] ;                        // Input buffer for mp3 or data stream 
-extern QueueHandle_t     dataqueue ;                            // Queue for mp3 datastream
+extern QueueHandle_t     ctrlqueue ;                            // Queue for start/stop song requests
 extern QueueHandle_t     spfqueue ;                             // Queue for special functions
-extern qdata_struct      outchunk ;                             // Data to queue
-extern qdata_struct      inchunk ;                              // Data from queue
-extern uint8_t*          outqp ;                 // Pointer to buffer in outchunk
 extern uint32_t          totalcount ;                       // Counter mp3 data
 extern datamode_t        datamode ;                             // State of datastream
 extern int               metacount ;                            // Number of bytes in metadata
+extern bool              metadrop ;                             // Skip rest of metadata block
 extern int               datacount ;                            // Counter databytes before metadata
 extern char              metalinebf[METASIZ + 1] ;              // Buffer for metaline/ID3 tags
 extern int16_t           metalinebfx ;                          // Index for metalinebf
@@ -405,12 +618,28 @@ extern uint32_t          ir_1 ;                          // Average duration of
 extern struct tm         timeinfo ;                             // Will be filled by NTP server
 extern bool              time_req ;                     // Set time requested
 extern bool              SD_okay ;                      // True if SD card in place and readable
-extern String            SD_nodelist ;                          // Nodes of mp3-files on SD
-extern int               SD_nodecount ;                     // Number of nodes in SD_nodelist
+extern int               SD_nodecount ;                     // Number of tracks on SD
 extern String            SD_currentnode ;                  // Node ID of song playing ("0" if random)
 extern uint16_t          adcval ;                               // ADC value (battery voltage)
 extern uint32_t          clength ;                              // Content length found in http header
 extern uint32_t          max_mp3loop_time ;                 // To check max handling time in mp3loop (msec)
+extern uint32_t          parse_bytes ;                      // Bytes handled by stream parser
+extern uint32_t          parse_us ;                         // Time spent in stream parser (usec)
+extern volatile bool     dreq_armed ;                       // Playtask waits for DREQ interrupt
+extern uint32_t          dreq_waits ;                       // Number of waits for DREQ
+extern uint32_t          dreq_wait_us ;                     // Total time waited for DREQ (usec)
+extern uint32_t          dreq_wait_max ;                    // Longest wait for DREQ (usec)
+extern uint32_t          sdi_transcount ;                   // Number of SDI transactions (bursts)
+extern uint32_t          streamlevel ;                      // Buffered stream data (ring + TCP)
+extern drift_struct      drift ;                            // State of clock drift controller
+extern switch_struct     swtime ;                           // Timing of last station switch
+extern conn_struct       conn ;                             // Connection to a host in progress
+extern jitter_struct     jitter ;                           // State of the jitter buffer
+extern icymeta_struct    icymeta ;                          // Last ICY metadata
+extern recovery_struct   recov ;                            // State of the stream recovery
+extern spectrum_struct   spectrum ;                         // State of the spectrum analyzer display
+extern uint32_t          max_loop_time ;                    // Max. duration of loop() (msec)
+extern uint32_t          trackgap ;                         // Last gap between tracks in msec
 extern int16_t           scanios ;                              // TEST*TEST*TEST
 extern int16_t           scaniocount ;                          // TEST*TEST*TEST
 extern uint16_t          bltimer ;                          // Backlight time-out counter
@@ -1,4 +1,11 @@
 #include "esp32_radio.h"
+#include "esp32_ringbuf.h"
+#include "esp32_sdindex.h"
+#include "esp32_standby.h"
+#include "esp32_framesync.h"
+#include "esp32_playlist.h"
+#include "esp32_hls.h"
+#include "esp32_telemetry.h"
 //**************************************************************************************************
 // Global data section.                                                                            *
 //**************************************************************************************************
@@ -33,18 +40,36 @@ TaskHandle_t      maintask ;                             // Taskhandle for main
 TaskHandle_t      xplaytask ;                            // Task handle for playtask
 TaskHandle_t      xspftask ;                             // Task handle for special functions
 SemaphoreHandle_t SPIsem = NULL ;                        // For exclusive SPI usage
+SemaphoreHandle_t dspsem = NULL ;                        // For exclusive display usage (not SPI)
+portMUX_TYPE      spimux = portMUX_INITIALIZER_UNLOCKED ; // Protects spi_waiting
+volatile uint8_t  spi_waiting[SPI_NUMCLIENTS] ;          // Number of waiters per SPI client
+spiclient_t       spi_holder = SPI_OTHER ;               // Client that owns the SPI bus
+const char*       spi_holdname = "" ;                    // Id of the owner of the SPI bus
+uint32_t          spi_granttime ;                        // Time (micros) SPI bus was granted
+const uint32_t    spi_maxhold[SPI_NUMCLIENTS] =          // Max. hold time per client (usec)
+                  { 5000, 3000, 3000, 3000 } ;           // VS1053, SD, TFT, other
+uint32_t          spi_waithist[SPI_NUMCLIENTS][SPIHISTSIZ] ; // Histogram of wait times
+uint32_t          spi_holdhist[SPI_NUMCLIENTS][SPIHISTSIZ] ; // Histogram of hold times
+uint32_t          spi_overholds[SPI_NUMCLIENTS] ;        // Number of grants held too long
 hw_timer_t*       timer = NULL ;                         // For timer
 char              timetxt[9] ;                           // Converted timeinfo
 char              cmd[130] ;                             // Command from MQTT or Serial
 uint8_t           tmpbuff[6000] ;                        // Input buffer for mp3 or data stream 
-QueueHandle_t     dataqueue ;                            // Queue for mp3 datastream
+RingBuf           dataring ;                             // Ringbuffer for mp3 datastream
+QueueHandle_t     ctrlqueue ;                            // Queue for start/stop song requests
+SDIndex           sdindex ;                              // Index of tracks on SD card
+Standby           standby[SBSLOTS] ;                     // Warm standby connections
+uint32_t          sb_hits = 0 ;                          // Preset changes served from standby
+uint32_t          sb_misses = 0 ;                        // Preset changes without standby
+FrameSync         framesync ;                            // Frame parser for the datastream
+Playlist          plcache ;                              // Entries of the last playlist
+Hls               hls ;                                  // HLS input
+Telemetry         tlm ;                                  // Telemetry of the stream pipeline
 QueueHandle_t     spfqueue ;                             // Queue for special functions
-qdata_struct      outchunk ;                             // Data to queue
-qdata_struct      inchunk ;                              // Data from queue
-uint8_t*          outqp = outchunk.buf ;                 // Pointer to buffer in outchunk
 uint32_t          totalcount = 0 ;                       // Counter mp3 data
 datamode_t        datamode ;                             // State of datastream
 int               metacount ;                            // Number of bytes in metadata
+bool              metadrop = false ;                     // Skip rest of metadata block
 int               datacount ;                            // Counter databytes before metadata
 char              metalinebf[METASIZ + 1] ;              // Buffer for metaline/ID3 tags
 int16_t           metalinebfx ;                          // Index for metalinebf
@@ -82,12 +107,28 @@ uint32_t          ir_1 = 1650 ;                          // Average duration of
 struct tm         timeinfo ;                             // Will be filled by NTP server
 bool              time_req = false ;                     // Set time requested
 bool              SD_okay = false ;                      // True if SD card in place and readable
-String            SD_nodelist ;                          // Nodes of mp3-files on SD
-int               SD_nodecount = 0 ;                     // Number of nodes in SD_nodelist
+int               SD_nodecount = 0 ;                     // Number of tracks on SD
 String            SD_currentnode = "" ;                  // Node ID of song playing ("0" if random)
 uint16_t          adcval ;                               // ADC value (battery voltage)
 uint32_t          clength ;                              // Content length found in http header
 uint32_t          max_mp3loop_time = 0 ;                 // To check max handling time in mp3loop (msec)
+uint32_t          parse_bytes = 0 ;                      // Bytes handled by stream parser
+uint32_t          parse_us = 0 ;                         // Time spent in stream parser (usec)
+volatile bool     dreq_armed = false ;                   // Playtask waits for DREQ interrupt
+uint32_t          dreq_waits = 0 ;                       // Number of waits for DREQ
+uint32_t          dreq_wait_us = 0 ;                     // Total time waited for DREQ (usec)
+uint32_t          dreq_wait_max = 0 ;                    // Longest wait for DREQ (usec)
+uint32_t          sdi_transcount = 0 ;                   // Number of SDI transactions (bursts)
+uint32_t          streamlevel = 0 ;                      // Buffered stream data (ring + TCP)
+drift_struct      drift ;                                // State of clock drift controller
+switch_struct     swtime ;                               // Timing of last station switch
+conn_struct       conn ;                                 // Connection to a host in progress
+jitter_struct     jitter ;                               // State of the jitter buffer
+icymeta_struct    icymeta ;                              // Last ICY metadata
+recovery_struct   recov ;                                // State of the stream recovery
+spectrum_struct   spectrum ;                             // State of the spectrum analyzer display
+uint32_t          max_loop_time = 0 ;                    // Max. duration of loop() (msec)
+uint32_t          trackgap = 0 ;                         // Last gap between tracks in msec
 int16_t           scanios ;                              // TEST*TEST*TEST
 int16_t           scaniocount ;                          // TEST*TEST*TEST
 uint16_t          bltimer = 0 ;                          // Backlight time-out counter
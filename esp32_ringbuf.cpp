@@ -0,0 +1,120 @@
+//**************************************************************************************************
+// RingBuf class implementation.                                                                   *
+//**************************************************************************************************
+// Note that head and tail are volatile.  The Xtensa compiler inserts a memory barrier (MEMW) for  *
+// every volatile access, so the data is always in memory before the counter is updated.           *
+//**************************************************************************************************
+#include "esp32_radio.h"
+#include "esp32_ringbuf.h"
+
+uint32_t RingBuf::roundsize ( uint32_t siz )
+{
+  uint32_t p2 = 1 ;                                      // Size rounded up to a power of 2
+
+  while ( p2 < siz )                                     // The counters wrap at 2^32, so the index
+  {                                                      // is only continuous if size is a power of 2
+    p2 <<= 1 ;
+  }
+  return p2 ;
+}
+
+bool RingBuf::begin ( uint32_t siz )
+{
+  siz = roundsize ( siz ) ;                              // Force a power of 2
+  buf = (uint8_t*)malloc ( siz ) ;                       // Get space for the buffer
+  if ( buf == NULL )
+  {
+    dbgprint ( "No memory for ringbuffer of %d bytes!", siz ) ;
+    return false ;
+  }
+  size = siz ;
+  head = 0 ;                                             // Buffer is empty
+  tail = 0 ;
+  resetstats() ;
+  return true ;
+}
+
+size_t RingBuf::reserve ( uint8_t** p )
+{
+  uint32_t hinx = head & ( size - 1 ) ;                  // Index of first free byte
+  uint32_t len = space() ;                               // Total free space
+
+  if ( len > ( size - hinx ) )                           // Free space wraps around?
+  {
+    len = size - hinx ;                                  // Yes, limit to end of buffer
+  }
+  *p = buf + hinx ;                                      // Start of free area
+  return len ;
+}
+
+void RingBuf::commit ( size_t len )
+{
+  uint32_t f ;                                           // New fill level
+
+  head += len ;                                          // Data is available for consumer now
+  f = fill() ;
+  if ( f > maxfill )                                     // New maximum?
+  {
+    maxfill = f ;
+  }
+}
+
+size_t RingBuf::write ( const uint8_t* p, size_t len )
+{
+  uint8_t* wp ;                                          // Points to free area
+  size_t   n ;                                           // Size of free area
+  size_t   res = 0 ;                                     // Number of bytes written
+
+  while ( len )                                          // Max. 2 loops, because of wrap around
+  {
+    n = reserve ( &wp ) ;                                // Get contiguous free space
+    if ( n == 0 )                                        // Buffer full?
+    {
+      dropped += len ;                                   // Yes, count the lost bytes
+      break ;
+    }
+    if ( n > len )
+    {
+      n = len ;
+    }
+    memcpy ( wp, p, n ) ;                                // Copy the data
+    commit ( n ) ;                                       // and make it available
+    p += n ;
+    len -= n ;
+    res += n ;
+  }
+  return res ;
+}
+
+size_t RingBuf::peek ( uint8_t** p )
+{
+  uint32_t tinx = tail & ( size - 1 ) ;                  // Index of first data byte
+  uint32_t len = fill() ;                                // Total number of bytes in buffer
+
+  if ( len > ( size - tinx ) )                           // Data wraps around?
+  {
+    len = size - tinx ;                                  // Yes, limit to end of buffer
+  }
+  *p = buf + tinx ;                                      // Start of data
+  return len ;
+}
+
+void RingBuf::consume ( size_t len )
+{
+  uint32_t f ;                                           // New fill level
+
+  tail += len ;                                          // Space is available for producer now
+  f = fill() ;
+  if ( f < minfill )                                     // New minimum?
+  {
+    minfill = f ;
+  }
+}
+
+void RingBuf::resetstats()
+{
+  maxfill = fill() ;                                     // Start with current level
+  minfill = maxfill ;
+  dropped = 0 ;
+  underruns = 0 ;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "esp32_radio.h"
+//**************************************************************************************************
+// Ringbuffer for the MP3/Ogg datastream between mp3loop() and playtask.                           *
+//**************************************************************************************************
+// There is exactly one producer (mp3loop on CPU 1) and one consumer (playtask on CPU 0), so no    *
+// locking is required.  Head and tail are free running byte counters.  Only the producer changes  *
+// head, only the consumer changes tail.  The fill level is always head - tail.                    *
+// The size is rounded up to a power of 2.  Then the index "head & ( size - 1 )" does not jump     *
+// when the counters wrap around at 2^32 after about 4 GB of data.                                 *
+// The producer may reserve a contiguous area, fill it and then commit it.  The consumer gets a    *
+// contiguous area with peek() and frees it with consume().                                        *
+//**************************************************************************************************
+class RingBuf
+{
+  private:
+    uint8_t*          buf       = NULL ;             // The buffer space
+    uint32_t          size      = 0 ;                // Size of buffer in bytes
+    volatile uint32_t head      = 0 ;                // Total number of bytes written
+    volatile uint32_t tail      = 0 ;                // Total number of bytes read
+    // Statistics.  Every item is updated by one side only.
+    uint32_t          maxfill   = 0 ;                // Highest fill level seen (producer)
+    uint32_t          minfill   = 0 ;                // Lowest fill level seen (consumer)
+    uint32_t          dropped   = 0 ;                // Bytes discarded because of full buffer
+    uint32_t          underruns = 0 ;                // Number of times found empty while playing
+
+  public:
+    static uint32_t roundsize ( uint32_t siz ) ;         // Round up to the next power of 2
+    bool            begin ( uint32_t siz ) ;             // Allocate the buffer space (power of 2)
+    size_t          reserve ( uint8_t** p ) ;            // Get contiguous free area (producer)
+    void            commit ( size_t len ) ;              // Add reserved area to data (producer)
+    size_t          write ( const uint8_t* p,            // Copy data to buffer (producer)
+                            size_t len ) ;
+    size_t          peek ( uint8_t** p ) ;               // Get contiguous data area (consumer)
+    void            consume ( size_t len ) ;             // Free data area (consumer)
+    void            resetstats() ;                       // Start new statistics period
+    inline uint32_t getsize() const                      // Get size of the buffer
+    {
+      return size ;
+    }
+    inline uint32_t fill() const                         // Number of bytes in buffer
+    {
+      return head - tail ;
+    }
+    inline uint32_t space() const                        // Free space in buffer
+    {
+      return size - ( head - tail ) ;
+    }
+    inline uint32_t written() const                      // Total number of bytes written
+    {
+      return head ;
+    }
+    inline uint32_t readpos() const                      // Total number of bytes read
+    {
+      return tail ;
+    }
+    inline void     countunderrun()                      // Register an underrun (consumer)
+    {
+      underruns++ ;
+    }
+    inline uint32_t getmaxfill() const
+    {
+      return maxfill ;
+    }
+    inline uint32_t getminfill() const
+    {
+      return minfill ;
+    }
+    inline uint32_t getdropped() const
+    {
+      return dropped ;
+    }
+    inline uint32_t getunderruns() const
+    {
+      return underruns ;
+    }
+} ;
+
+extern RingBuf           dataring ;                     // Ringbuffer for mp3 datastream
@@ -0,0 +1,563 @@
+//**************************************************************************************************
+// SDIndex class implementation.                                                                   *
+//**************************************************************************************************
+#include "esp32_radio.h"
+#include "esp32_sdindex.h"
+
+#define SDLOOKAHEAD 16                                  // Records to search ahead in old index
+
+// Add a number of bytes to a FNV-1a hash
+static uint32_t fnv1a ( uint32_t h, const void* p, size_t n )
+{
+  const uint8_t* b = (const uint8_t*)p ;
+
+  while ( n-- )
+  {
+    h = ( h ^ *b++ ) * 16777619 ;                       // FNV prime
+  }
+  return h ;
+}
+
+// Compute the hash of a node ID
+static uint32_t nodehash ( const uint16_t* node )
+{
+  return fnv1a ( 2166136261, node, SDINDEXDEPTH * sizeof(uint16_t) ) ;
+}
+
+// Copy the text of an ID3 text frame.  Encoding 0 and 3 are copied as is, for UTF-16 (encoding 1
+// and 2) only the ASCII characters are kept.
+static void id3text ( const uint8_t* txt, int n, char* dest )
+{
+  char* d = dest ;
+  int   i ;
+
+  for ( i = 1 ; ( i < n ) && ( ( d - dest ) < ( SDTAGLEN - 1 ) ) ; i++ )
+  {
+    if ( ( txt[0] == 0 ) || ( txt[0] == 3 ) )           // ISO-8859-1 or UTF-8?
+    {
+      if ( txt[i] == 0 )                                // Yes, end of string?
+      {
+        break ;
+      }
+      *d++ = txt[i] ;
+    }
+    else if ( ( txt[i] >= 0x20 ) && ( txt[i] < 0x7F ) ) // UTF-16, ASCII part only
+    {
+      *d++ = txt[i] ;
+    }
+  }
+  *d = '\0' ;
+}
+
+bool SDIndex::ishidden ( const char* name )
+{
+  const char* p = strrchr ( name, '/' ) ;               // Skip directory part
+
+  p = p ? p + 1 : name ;
+  return ( *p == '.' ) ;                                // Hidden (like the index itself)?
+}
+
+uint32_t SDIndex::signature()
+{
+  uint32_t    sig = 2166136261 ;                        // FNV-1a offset basis
+  uint64_t    used = SD.usedBytes() ;                   // Changes if files are added or removed
+  File        root, file ;                              // Root directory and entry
+  const char* p ;                                       // Name of entry
+  uint32_t    fsize ;                                   // Size of entry
+
+  sig = fnv1a ( sig, &used, sizeof(used) ) ;
+  root = SD.open ( "/" ) ;
+  while ( root && ( file = root.openNextFile() ) )      // Add all entries of root directory
+  {
+    if ( ishidden ( file.name() ) )                     // Hidden (like the index itself)?
+    {
+      continue ;                                        // Yes, skip
+    }
+    p = strrchr ( file.name(), '/' ) ;                  // Skip directory part
+    p = p ? p + 1 : file.name() ;
+    fsize = file.isDirectory() ? 0 : file.size() ;
+    sig = fnv1a ( sig, p, strlen ( p ) ) ;
+    sig = fnv1a ( sig, &fsize, sizeof(fsize) ) ;
+  }
+  return sig ;
+}
+
+bool SDIndex::readrecs ( File& f, sdindex_hdr& hdr, sdindex_rec** r )
+{
+  size_t len ;                                          // Size of records in bytes
+
+  if ( ( f.read ( (uint8_t*)&hdr, sizeof(hdr) ) != sizeof(hdr) ) ||
+       ( hdr.magic != SDINDEXMAGIC ) ||                 // Check header
+       !f.seek ( hdr.recoff ) )
+  {
+    return false ;
+  }
+  len = hdr.count * sizeof(sdindex_rec) ;
+  *r = (sdindex_rec*)malloc ( len + 1 ) ;               // Space for the records
+  if ( *r == NULL )
+  {
+    dbgprint ( "No memory for SD index of %d tracks", hdr.count ) ;
+    return false ;
+  }
+  if ( f.read ( (uint8_t*)*r, len ) != len )            // Read all records at once
+  {
+    free ( *r ) ;
+    *r = NULL ;
+    return false ;
+  }
+  return true ;
+}
+
+bool SDIndex::readstrings ( File& f, uint32_t off, char* path, char* title, char* artist )
+{
+  char  buf[SDPATHLEN + 2 * SDTAGLEN + 1] ;             // Room for path, title and artist
+  char* p = buf ;                                       // Points to next string
+  char* pend ;                                          // End of data in buf
+  int   n ;                                             // Number of bytes read
+
+  if ( !f.seek ( off ) ||
+       ( ( n = f.read ( (uint8_t*)buf, sizeof(buf) - 1 ) ) <= 0 ) )
+  {
+    return false ;
+  }
+  pend = buf + n ;
+  *pend = '\0' ;                                        // Make sure last string is terminated
+  strlcpy ( path, p, SDPATHLEN ) ;
+  p += strlen ( p ) + 1 ;
+  *title = '\0' ;
+  *artist = '\0' ;
+  if ( p < pend )
+  {
+    strlcpy ( title, p, SDTAGLEN ) ;
+    p += strlen ( p ) + 1 ;
+  }
+  if ( p < pend )
+  {
+    strlcpy ( artist, p, SDTAGLEN ) ;
+  }
+  return true ;
+}
+
+void SDIndex::readtags ( const char* path, char* title, char* artist )
+{
+  File     f ;                                          // The mp3 file
+  uint8_t  hdr[10] ;                                    // ID3 header or frame header
+  uint8_t  majv ;                                       // Major version of ID3 tag
+  uint32_t tagend ;                                     // End of ID3 tag in file
+  uint32_t fsiz ;                                       // Size of a frame
+  uint32_t pos = 10 ;                                   // Position of next frame
+  uint8_t  txt[SDTAGLEN] ;                              // Contents of a text frame
+  char*    dest ;                                       // Where to store the text
+  int      n ;                                          // Number of bytes read
+
+  *title = '\0' ;
+  *artist = '\0' ;
+  f = SD.open ( path ) ;
+  if ( !f )
+  {
+    return ;
+  }
+  if ( ( f.read ( hdr, 10 ) == 10 ) &&                  // Read ID3 header
+       ( memcmp ( hdr, "ID3", 3 ) == 0 ) &&
+       ( ( hdr[5] & 0x40 ) == 0 ) )                     // Extended headers are not parsed
+  {
+    majv = hdr[3] ;
+    tagend = 10 + ( ( hdr[6] << 21 ) | ( hdr[7] << 14 ) | ( hdr[8] << 7 ) | hdr[9] ) ;
+    while ( ( ( pos + 10 ) < tagend ) && ( !*title || !*artist ) )
+    {
+      if ( !f.seek ( pos ) || ( f.read ( hdr, 10 ) != 10 ) || ( hdr[0] == 0 ) )
+      {
+        break ;                                         // End of frames
+      }
+      if ( majv >= 4 )                                  // Version 2.4 uses synchsafe sizes
+      {
+        fsiz = ( hdr[4] << 21 ) | ( hdr[5] << 14 ) | ( hdr[6] << 7 ) | hdr[7] ;
+      }
+      else
+      {
+        fsiz = ( hdr[4] << 24 ) | ( hdr[5] << 16 ) | ( hdr[6] << 8 ) | hdr[7] ;
+      }
+      pos += 10 + fsiz ;                                // Position of next frame
+      dest = NULL ;
+      if ( memcmp ( hdr, "TIT2", 4 ) == 0 )             // Song title?
+      {
+        dest = title ;
+      }
+      else if ( memcmp ( hdr, "TPE1", 4 ) == 0 )        // Artist?
+      {
+        dest = artist ;
+      }
+      if ( dest && ( fsiz > 1 ) )
+      {
+        n = f.read ( txt, ( fsiz < SDTAGLEN ) ? fsiz : SDTAGLEN ) ;
+        id3text ( txt, n, dest ) ;
+      }
+    }
+  }
+  f.close() ;
+}
+
+bool SDIndex::findold ( const char* path, uint32_t fsize, char* title, char* artist )
+{
+  char     oldpath[SDPATHLEN] ;                         // Path in old index
+  uint32_t i ;                                          // Index in oldrecs
+
+  // Files are found in the same order as in the old index, so only search a few records ahead
+  for ( i = oldinx ; ( i < oldcount ) && ( i < ( oldinx + SDLOOKAHEAD ) ) ; i++ )
+  {
+    if ( ( oldrecs[i].fsize == fsize ) &&
+         readstrings ( oldfile, oldrecs[i].stroff, oldpath, title, artist ) &&
+         ( strcmp ( oldpath, path ) == 0 ) )
+    {
+      oldinx = i + 1 ;                                  // Continue search after this one
+      reused++ ;
+      return true ;
+    }
+  }
+  return false ;
+}
+
+void SDIndex::makehash()
+{
+  uint32_t i, h ;                                       // Index in recs and hashtab
+  uint32_t mask ;                                       // Mask for index in hashtab
+
+  free ( hashtab ) ;                                    // Forget old table
+  hashtab = NULL ;
+  hashsize = 16 ;
+  while ( hashsize < ( 2 * count ) )                    // Table at most half filled
+  {
+    hashsize <<= 1 ;
+  }
+  if ( count < 0xFFFF )                                 // Index must fit in 16 bits
+  {
+    hashtab = (uint16_t*)calloc ( hashsize, sizeof(uint16_t) ) ;
+  }
+  if ( hashtab == NULL )
+  {
+    dbgprint ( "No memory for hash table of %d tracks", count ) ;
+    hashsize = 0 ;
+    return ;
+  }
+  mask = hashsize - 1 ;
+  for ( i = 0 ; i < count ; i++ )
+  {
+    h = nodehash ( recs[i].node ) & mask ;
+    while ( hashtab[h] )                                // Find a free slot
+    {
+      h = ( h + 1 ) & mask ;
+    }
+    hashtab[h] = i + 1 ;                                // Store index + 1
+  }
+}
+
+int32_t SDIndex::find ( const char* nodeid ) const
+{
+  uint16_t    node[SDINDEXDEPTH] ;                      // Node ID as numbers
+  const char* p = nodeid ;                              // Points into nodeid
+  uint32_t    mask = hashsize - 1 ;                     // Mask for index in hashtab
+  uint32_t    h ;                                       // Index in hashtab
+  uint16_t    i ;                                       // Entry in hashtab
+
+  if ( hashsize == 0 )
+  {
+    return -1 ;
+  }
+  memset ( node, 0, sizeof(node) ) ;
+  for ( i = 0 ; ( i < SDINDEXDEPTH ) && *p ; i++ )      // Convert "2,1,4,0" to numbers
+  {
+    node[i] = strtoul ( p, (char**)&p, 10 ) ;
+    if ( *p == ',' )
+    {
+      p++ ;                                             // Skip separator
+    }
+  }
+  h = nodehash ( node ) & mask ;
+  while ( ( i = hashtab[h] ) )                          // Search until free slot
+  {
+    if ( memcmp ( recs[i - 1].node, node, sizeof(node) ) == 0 )
+    {
+      return i - 1 ;                                    // Found
+    }
+    h = ( h + 1 ) & mask ;
+  }
+  return -1 ;                                           // Not found
+}
+
+bool SDIndex::uptodate()
+{
+  bool res ;                                            // Function result
+
+  claimSPI ( "sdindex", SPI_SD ) ;
+  res = cursig && ( signature() == cursig ) ;           // Card unchanged?
+  releaseSPI() ;
+  return res ;
+}
+
+bool SDIndex::load()
+{
+  File        f ;                                       // The index file
+  sdindex_hdr hdr ;                                     // Header of index file
+  bool        res = false ;                             // Function result
+
+  // Called once during setup, so the SPI bus is claimed for the whole load
+  claimSPI ( "sdindex", SPI_SD ) ;
+  f = SD.open ( SDINDEXFILE ) ;
+  if ( f )
+  {
+    if ( readrecs ( f, hdr, &recs ) )                   // Read header and all records
+    {
+      if ( hdr.signature == signature() )               // Index still valid?
+      {
+        count = hdr.count ;                             // Yes, accept
+        maxcount = count ;
+        cursig = hdr.signature ;
+        ixname = SDINDEXFILE ;
+        res = true ;
+      }
+      else
+      {
+        dbgprint ( "SD index is outdated" ) ;
+        free ( recs ) ;
+        recs = NULL ;
+      }
+    }
+    f.close() ;
+  }
+  releaseSPI() ;
+  if ( res )
+  {
+    makehash() ;                                        // Make track table accessible
+  }
+  return res ;
+}
+
+bool SDIndex::beginbuild()
+{
+  sdindex_hdr hdr ;                                     // Header of old/new index file
+
+  if ( building )                                       // Previous build not finished?
+  {
+    abortbuild() ;                                      // Yes, clean up first
+  }
+  free ( hashtab ) ;                                    // Forget current index, find() will
+  hashtab = NULL ;                                      // fail until endbuild()
+  hashsize = 0 ;
+  free ( recs ) ;
+  recs = NULL ;
+  count = 0 ;
+  maxcount = 0 ;
+  reused = 0 ;
+  cursig = 0 ;
+  oldinx = 0 ;
+  oldcount = 0 ;
+  claimSPI ( "sdindex", SPI_SD ) ;
+  oldfile = SD.open ( SDINDEXFILE ) ;                   // Old index for reuse of tags
+  if ( oldfile && readrecs ( oldfile, hdr, &oldrecs ) )
+  {
+    oldcount = hdr.count ;
+  }
+  SD.remove ( SDINDEXTEMP ) ;                           // Remove leftover of failed build
+  ixfile = SD.open ( SDINDEXTEMP, FILE_WRITE ) ;
+  memset ( &hdr, 0, sizeof(hdr) ) ;                     // Header not valid until endbuild()
+  writing = ixfile && ( ixfile.write ( (uint8_t*)&hdr, sizeof(hdr) ) == sizeof(hdr) ) ;
+  if ( !writing )                                       // Temporary file not created?
+  {
+    dbgprint ( "SD index cannot be written, track table in memory only" ) ;
+    ixfile.close() ;                                    // Yes, old index is useless as well
+    oldfile.close() ;
+    free ( oldrecs ) ;
+    oldrecs = NULL ;
+    oldcount = 0 ;
+  }
+  releaseSPI() ;
+  building = true ;                                     // Track table is always built
+  return writing ;
+}
+
+void SDIndex::add ( const uint16_t* node, File& file )
+{
+  sdindex_rec  r ;                                      // New record
+  sdindex_rec* p ;                                      // Enlarged space for records
+  char         title[SDTAGLEN] ;                        // Title of the track
+  char         artist[SDTAGLEN] ;                       // Artist of the track
+  const char*  path = file.name() ;                     // Full path of the track
+
+  if ( !building )
+  {
+    return ;
+  }
+  if ( count == maxcount )                              // Room for another record?
+  {
+    p = (sdindex_rec*)realloc ( recs, ( maxcount + 256 ) * sizeof(sdindex_rec) ) ;
+    if ( p == NULL )
+    {
+      dbgprint ( "No memory for SD index, build stopped" ) ;
+      abortbuild() ;                                    // Index will not be written
+      return ;
+    }
+    recs = p ;
+    maxcount += 256 ;
+  }
+  memcpy ( r.node, node, sizeof(r.node) ) ;
+  r.fsize = file.size() ;
+  r.stroff = 0 ;                                        // No strings if not writing
+  if ( writing )                                        // Strings go to the index file?
+  {
+    claimSPI ( "sdindex", SPI_SD ) ;
+    if ( !findold ( path, r.fsize, title, artist ) )    // Known from previous index?
+    {
+      readtags ( path, title, artist ) ;                // No, read the tags from the file
+    }
+    r.stroff = ixfile.position() ;                      // Strings for this track start here
+    ixfile.write ( (const uint8_t*)path, strlen ( path ) + 1 ) ;
+    ixfile.write ( (const uint8_t*)title, strlen ( title ) + 1 ) ;
+    ixfile.write ( (const uint8_t*)artist, strlen ( artist ) + 1 ) ;
+    releaseSPI() ;
+  }
+  recs[count++] = r ;
+}
+
+bool SDIndex::endbuild()
+{
+  sdindex_hdr hdr ;                                     // Header of new index file
+  size_t      len = count * sizeof(sdindex_rec) ;       // Size of records
+  bool        res ;                                     // Function result
+
+  if ( !building )                                      // Build aborted by add()?
+  {
+    return false ;                                      // Yes, already cleaned up
+  }
+  building = false ;
+  if ( !writing )                                       // Track table in memory only?
+  {
+    ixname = NULL ;                                     // Yes, gettrack() walks the directories
+    makehash() ;
+    return false ;
+  }
+  writing = false ;
+  claimSPI ( "sdindex", SPI_SD ) ;
+  hdr.magic = SDINDEXMAGIC ;
+  hdr.count = count ;
+  hdr.recoff = ixfile.position() ;                      // Records follow the strings
+  res = ( ixfile.write ( (uint8_t*)recs, len ) == len ) ;
+  ixfile.close() ;
+  oldfile.close() ;
+  free ( oldrecs ) ;                                    // Old index not needed anymore
+  oldrecs = NULL ;
+  oldcount = 0 ;
+  ixname = SDINDEXTEMP ;                                // Strings are in temporary file
+  if ( res )
+  {
+    SD.remove ( SDINDEXFILE ) ;                         // Replace old index by new one
+    res = SD.rename ( SDINDEXTEMP, SDINDEXFILE ) ;
+  }
+  if ( res )
+  {
+    ixname = SDINDEXFILE ;
+    // The signature can only be computed now, because writing the index changes the used space.
+    // Rewriting the header does not change the size of the file.
+    hdr.signature = signature() ;
+    ixfile = SD.open ( SDINDEXFILE, "r+" ) ;
+    res = ixfile && ( ixfile.write ( (uint8_t*)&hdr, sizeof(hdr) ) == sizeof(hdr) ) ;
+    ixfile.close() ;
+    cursig = hdr.signature ;
+  }
+  releaseSPI() ;
+  makehash() ;                                          // Track table usable even if not written
+  if ( !res )
+  {
+    dbgprint ( "SD index could not be written" ) ;
+  }
+  return res ;
+}
+
+void SDIndex::abortbuild()
+{
+  claimSPI ( "sdindex", SPI_SD ) ;
+  ixfile.close() ;                                      // Close both files
+  oldfile.close() ;
+  SD.remove ( SDINDEXTEMP ) ;                           // Incomplete index is useless
+  releaseSPI() ;
+  free ( oldrecs ) ;                                    // Old index not needed anymore
+  oldrecs = NULL ;
+  oldcount = 0 ;
+  free ( recs ) ;                                       // Strings of the records are lost
+  recs = NULL ;
+  count = 0 ;
+  maxcount = 0 ;
+  ixname = SDINDEXFILE ;
+  building = false ;
+  writing = false ;
+}
+
+String SDIndex::nodeid ( uint32_t inx ) const
+{
+  String res ;                                          // Function result
+  int    i ;                                            // Loop control
+
+  for ( i = 0 ; i < SDINDEXDEPTH ; i++ )
+  {
+    if ( i )                                            // Need to add separating comma?
+    {
+      res += String ( "," ) ;                           // Yes, add comma
+    }
+    res += String ( recs[inx].node[i] ) ;               // Add sequence number
+  }
+  return res ;
+}
+
+bool SDIndex::walkpath ( const uint16_t* node, char* path )
+{
+  File     dir, file ;                                  // Directory and entry in it
+  uint16_t n ;                                          // Sequence number in this level
+  int      i ;                                          // Level in node ID
+
+  strcpy ( path, "/" ) ;                                // Start at root
+  for ( i = 0 ; ( i < SDINDEXDEPTH ) && node[i] ; i++ )
+  {
+    claimSPI ( "sdindex", SPI_SD ) ;
+    dir = SD.open ( path ) ;                            // Open the directory of this level
+    n = node[i] ;
+    while ( n && dir && ( file = dir.openNextFile() ) ) // Count entries like listsdtracks()
+    {
+      if ( !ishidden ( file.name() ) )
+      {
+        n-- ;
+      }
+    }
+    releaseSPI() ;
+    if ( n )                                            // Entry found?
+    {
+      return false ;                                    // No, card has changed
+    }
+    strlcpy ( path, file.name(), SDPATHLEN ) ;          // Directory or file of this level
+  }
+  return true ;
+}
+
+bool SDIndex::gettrack ( uint32_t inx, char* path, char* title, char* artist )
+{
+  File f ;                                              // The index file
+  bool res = false ;                                    // Function result
+
+  if ( ( inx >= count ) || building )                   // Valid entry of a complete table?
+  {
+    return false ;
+  }
+  if ( ixname == NULL )                                 // Strings not on the card?
+  {
+    *title = '\0' ;                                     // Yes, no tags known
+    *artist = '\0' ;
+    return walkpath ( recs[inx].node, path ) ;          // Find path from the node ID
+  }
+  claimSPI ( "sdindex", SPI_SD ) ;
+  f = SD.open ( ixname ) ;
+  if ( f )
+  {
+    res = readstrings ( f, recs[inx].stroff, path, title, artist ) ;
+    f.close() ;
+  }
+  releaseSPI() ;
+  return res ;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "esp32_radio.h"
+//**************************************************************************************************
+// Index of the mp3 tracks on the SD card.  The index is kept in a file on the card itself.        *
+//**************************************************************************************************
+// Layout of the index file:                                                                       *
+//   header     : sdindex_hdr                                                                      *
+//   stringpool : for every track the path, title and artist, each terminated by a zero byte        *
+//   records    : hdr.count entries of sdindex_rec, starting at hdr.recoff                          *
+// At boot the header and the records are read in one sequential read.  The index is valid if the  *
+// signature matches the signature of the card.  The signature is computed from the used space on  *
+// the card and the names and sizes in the root directory.                                         *
+// If the index is not valid, a new one is built while listsdtracks() walks the directories.  The  *
+// tags of files that did not change (same path and size) are copied from the old index, so only   *
+// new files have to be opened to read their ID3 tags.                                             *
+// During a build the hash table is empty, so find() fails until endbuild() makes the new table.   *
+// If the index file cannot be written, the track table is still built in memory.  There are no    *
+// strings then, so the path of a track is found by walking the directories with the node ID.      *
+// Hidden files and directories (like the index) are not counted in the node IDs.                  *
+// If a build cannot be completed, abortbuild() closes the files and frees all memory.             *
+// The records stay in memory and form the track table.  A hash table on the node ID gives direct  *
+// access to a track.  The strings stay on the card; a path is found with a single seek and read.  *
+//**************************************************************************************************
+#define SDINDEXFILE   "/.sdindex"                       // Index file, hidden for listsdtracks()
+#define SDINDEXTEMP   "/.sdindex.new"                   // Index file during build
+#define SDINDEXMAGIC  0x32444953                        // "SID2", hidden files not in node IDs
+#define SDINDEXDEPTH  4                                 // Number of levels in a node ID
+#define SDTAGLEN      64                                // Max. length of cached title/artist
+#define SDPATHLEN     256                               // Max. length of a path
+
+struct sdindex_hdr                                      // Header of index file
+{
+  uint32_t magic ;                                      // Should be SDINDEXMAGIC
+  uint32_t signature ;                                  // Signature of the card
+  uint32_t count ;                                      // Number of tracks
+  uint32_t recoff ;                                     // Offset of records in file
+} ;
+
+struct sdindex_rec                                      // Record for one track
+{
+  uint16_t node[SDINDEXDEPTH] ;                         // Node ID, like 2,1,4,0
+  uint32_t fsize ;                                      // File size, for change detection
+  uint32_t stroff ;                                     // Offset of path, title and artist
+} ;
+
+class SDIndex
+{
+  private:
+    File          ixfile ;                              // Index file being built
+    File          oldfile ;                             // Previous index file during build
+    sdindex_rec*  recs     = NULL ;                     // Records in memory
+    uint32_t      count    = 0 ;                        // Number of records
+    uint32_t      maxcount = 0 ;                        // Number of allocated records
+    sdindex_rec*  oldrecs  = NULL ;                     // Records of previous index during build
+    uint32_t      oldcount = 0 ;                        // Number of records in oldrecs
+    uint32_t      oldinx   = 0 ;                        // Next expected record in oldrecs
+    uint32_t      reused   = 0 ;                        // Number of tags copied from old index
+    bool          building = false ;                    // True between beginbuild() and endbuild()
+    bool          writing  = false ;                    // Index file is written during build
+    uint16_t*     hashtab  = NULL ;                     // Hash table, record index + 1 or 0 (free)
+    uint32_t      hashsize = 0 ;                        // Size of hashtab, power of 2
+    uint32_t      cursig   = 0 ;                        // Signature of the current index
+    const char*   ixname   = SDINDEXFILE ;              // File that holds the strings, NULL if none
+
+    bool          readrecs ( File& f, sdindex_hdr& hdr,          // Read records of an index file
+                             sdindex_rec** r ) ;
+    bool          readstrings ( File& f, uint32_t off,           // Read path, title and artist
+                                char* path, char* title, char* artist ) ;
+    void          readtags ( const char* path,                   // Read ID3 title and artist
+                             char* title, char* artist ) ;
+    bool          findold ( const char* path, uint32_t fsize,    // Find unchanged file in old index
+                            char* title, char* artist ) ;
+    void          makehash() ;                                   // Fill the hash table
+    bool          walkpath ( const uint16_t* node,               // Find path of a node on the card
+                             char* path ) ;
+  public:
+    static bool   ishidden ( const char* name ) ;                // Check for hidden file or directory
+    uint32_t      signature() ;                                  // Compute signature of the card
+    bool          load() ;                                       // Load index from card
+    bool          beginbuild() ;                                 // Start building a new index
+    void          add ( const uint16_t* node, File& file ) ;     // Add a track while building
+    bool          endbuild() ;                                   // Write new index to card
+    void          abortbuild() ;                                 // Stop a build, free everything
+    bool          uptodate() ;                                   // Check if index matches card
+    String        nodeid ( uint32_t inx ) const ;                // Get node ID as a string
+    int32_t       find ( const char* nodeid ) const ;            // Get index of a node ID
+    bool          gettrack ( uint32_t inx, char* path,           // Get path and tags of a track
+                             char* title, char* artist ) ;
+    inline bool   isbuilding() const                             // Index is being built?
+    {
+      return building ;
+    }
+    inline uint32_t getcount() const                             // Number of tracks in index
+    {
+      return count ;
+    }
+    inline uint32_t getreused() const                            // Tags reused in last build
+    {
+      return reused ;
+    }
+} ;
+
+extern SDIndex           sdindex ;                      // Index of tracks on SD card
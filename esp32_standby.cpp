@@ -0,0 +1,353 @@
+//**************************************************************************************************
+// Standby class implementation.                                                                   *
+//**************************************************************************************************
+#include "esp32_radio.h"
+#include "esp32_standby.h"
+
+void Standby::dnscb ( const char* name, const ip_addr_t* ipaddr, void* arg )
+{
+  Standby* sb = (Standby*)arg ;                         // The standby connection
+
+  if ( ( sb->state != SB_RESOLVE ) ||                   // Late reply?
+       ( sb->hostwoext != name ) )
+  {
+    return ;                                            // Yes, ignore
+  }
+  if ( ipaddr )                                         // Lookup succeeded?
+  {
+    sb->ip = *ipaddr ;                                  // Yes, save IP address
+  }
+  else
+  {
+    sb->dnsfail = true ;                                // No, signal failure
+  }
+  sb->dnsdone = true ;
+}
+
+bool Standby::start ( int8_t pset, const String& h )
+{
+  err_t err ;                                           // Result of DNS request
+
+  stop() ;                                              // Close old connection
+  if ( buf == NULL )                                    // Window allocated?
+  {
+    if ( ESP.getFreeHeap() < ( SBMINHEAP + SBPREFIX ) ) // No, enough memory?
+    {
+      return false ;                                    // No, skip standby
+    }
+    buf = (uint8_t*)malloc ( SBPREFIX ) ;               // Get space for the window
+    if ( buf == NULL )
+    {
+      return false ;
+    }
+  }
+  preset = pset ;
+  url = h ;
+  splithost ( url, hostwoext, port, extension ) ;       // Get host, port and extension
+  dbgprint ( "Standby connect to preset %d, %s", preset, url.c_str() ) ;
+  dnsdone = false ;
+  dnsfail = false ;
+  state = SB_RESOLVE ;
+  t0 = millis() ;
+  err = dns_gethostbyname ( hostwoext.c_str(), &ip, dnscb, this ) ;
+  if ( err == ERR_OK )                                  // IP address or cached?
+  {
+    dnsdone = true ;                                    // Yes, result is available now
+  }
+  else if ( err != ERR_INPROGRESS )                     // Lookup started?
+  {
+    fail ( "DNS error" ) ;                              // No, give up
+    return false ;
+  }
+  return true ;
+}
+
+void Standby::fail ( const char* reason )
+{
+  int8_t pset = preset ;                                // Keep preset for retry
+
+  dbgprint ( "Standby for preset %d failed, %s", preset, reason ) ;
+  stop() ;
+  preset = pset ;
+  state = SB_FAILED ;                                   // Retry later
+  t0 = millis() ;
+}
+
+void Standby::stop()
+{
+  if ( state == SB_CONNECT )                            // Socket not yet in client?
+  {
+    close ( fd ) ;                                      // Yes, close it
+  }
+  client.stop() ;                                       // Close connection
+  state = SB_IDLE ;
+  preset = -1 ;
+}
+
+void Standby::headerline()
+{
+  char* val ;                                           // Value of the field
+
+  line[linex] = '\0' ;                                  // Take care of delimiter
+  switch ( matchhdrline ( line, &val ) )                // Check for known fields
+  {
+    case HF_LOCATION :                                  // Redirection?
+      fail ( "redirected" ) ;                           // Yes, not for standby
+      break ;
+    case HF_CONTENTTYPE :                               // Line with "Content-Type: xxxx/yyy"
+      ctseen = true ;
+      break ;
+    case HF_ICYBR :
+      sbbitrate = atoi ( val ) ;                        // Found bitrate tag, read the bitrate
+      if ( sbbitrate == 0 )                             // For Ogg br is like "Quality 2"
+      {
+        sbbitrate = 87 ;                                // Dummy bitrate
+      }
+      break ;
+    case HF_ICYMETAINT :
+      sbmetaint = atoi ( val ) ;                        // Found metaint tag, read the value
+      break ;
+    case HF_ICYNAME :
+      sbicyname = val ;                                 // Get station name
+      break ;
+    case HF_TRANSFERENC :
+      if ( hdrendswith ( val, "chunked" ) )
+      {
+        fail ( "chunked" ) ;                            // Chunked, not for standby
+      }
+      break ;
+    default :
+      break ;
+  }
+  linex = 0 ;                                           // Prepare for next line
+}
+
+void Standby::store ( const uint8_t* p, int len )
+{
+  uint32_t hinx ;                                       // Index in window
+  int      n ;                                          // Bytes until end of window
+
+  if ( len > SBPREFIX )                                 // More than fits?
+  {
+    p += len - SBPREFIX ;                               // Yes, keep the last part
+    head += len - SBPREFIX ;
+    len = SBPREFIX ;
+  }
+  while ( len )                                         // Max. 2 loops, because of wrap around
+  {
+    hinx = head % SBPREFIX ;
+    n = SBPREFIX - hinx ;
+    if ( n > len )
+    {
+      n = len ;
+    }
+    memcpy ( buf + hinx, p, n ) ;                       // Overwrite oldest data
+    head += n ;
+    p += n ;
+    len -= n ;
+  }
+}
+
+void Standby::handledata ( const uint8_t* p, int len )
+{
+  int run ;                                             // Number of bytes to handle in one go
+
+  while ( len > 0 )
+  {
+    if ( ( sbmetaint == 0 ) || ( sbdatacount > 0 ) )    // Audio data?
+    {
+      run = len ;
+      if ( sbmetaint && ( run > sbdatacount ) )         // Stop at begin of metadata
+      {
+        run = sbdatacount ;
+      }
+      store ( p, run ) ;                                // Keep in window
+      if ( sbmetaint )
+      {
+        sbdatacount -= run ;
+        if ( sbdatacount == 0 )                         // End of datablock?
+        {
+          metaskip = -1 ;                               // Expecting length byte
+        }
+      }
+      p += run ;
+      len -= run ;
+    }
+    else if ( metaskip < 0 )                            // Length of metadata?
+    {
+      metaskip = *p++ * 16 ;                            // Yes, number of bytes to skip
+      len-- ;
+      if ( metaskip )                                   // Metadata follows?
+      {
+        titlex = 0 ;                                    // Yes, collect it
+      }
+      else
+      {
+        sbdatacount = sbmetaint ;                       // No, audio follows
+      }
+    }
+    else
+    {
+      if ( titlex < ( SBTITLELEN - 1 ) )                // Room in title?
+      {
+        title[titlex++] = (char)*p ;                    // Yes, keep metadata
+        title[titlex] = '\0' ;
+      }
+      p++ ;
+      len-- ;
+      if ( --metaskip == 0 )                            // End of metadata?
+      {
+        sbdatacount = sbmetaint ;                       // Yes, audio follows
+      }
+    }
+  }
+}
+
+void Standby::handle()
+{
+  uint8_t b[256] ;                                      // Data read from stream
+  int     res ;                                         // Result of read or sockpoll()
+  int     i ;                                           // Loop control
+
+  switch ( state )
+  {
+    case SB_RESOLVE :                                   // Waiting for DNS
+      if ( !dnsdone )                                   // Reply received?
+      {
+        if ( ( millis() - t0 ) > CONNTO_DNS )           // No, time-out?
+        {
+          fail ( "DNS time-out" ) ;
+        }
+        break ;
+      }
+      if ( dnsfail )
+      {
+        fail ( "host not found" ) ;
+        break ;
+      }
+      fd = sockstart ( &ip, port ) ;                    // Start connect
+      if ( fd < 0 )
+      {
+        fail ( "connect error" ) ;
+        break ;
+      }
+      state = SB_CONNECT ;
+      t0 = millis() ;
+      break ;
+    case SB_CONNECT :                                   // Waiting for connection
+      res = sockpoll ( fd ) ;
+      if ( res == 0 )                                   // Still busy?
+      {
+        if ( ( millis() - t0 ) > CONNTO_CONNECT )       // Yes, time-out?
+        {
+          fail ( "connect time-out" ) ;
+        }
+        break ;
+      }
+      if ( res < 0 )
+      {
+        fail ( "connection refused" ) ;
+        break ;
+      }
+      client = WiFiClient ( fd ) ;                      // Client owns the socket now
+      sendrequest ( client, hostwoext, extension ) ;    // Send GET request
+      linex = 0 ;                                       // Prepare for header
+      LFcount = 0 ;
+      ctseen = false ;
+      sbmetaint = 0 ;
+      sbbitrate = 0 ;
+      sbicyname = "" ;
+      state = SB_HEADER ;
+      t0 = millis() ;
+      break ;
+    case SB_HEADER :                                    // Parse the header
+      if ( ( millis() - t0 ) > CONNTO_HEADER )          // Time-out?
+      {
+        fail ( "no headers" ) ;
+        break ;
+      }
+      while ( ( state == SB_HEADER ) && client.available() )
+      {
+        b[0] = client.read() ;
+        if ( ( b[0] > 0x7F ) || ( b[0] == '\r' ) || ( b[0] == '\0' ) )
+        {
+          continue ;                                    // Ignore unprintable characters and CR
+        }
+        if ( b[0] == '\n' )                             // Linefeed?
+        {
+          LFcount++ ;
+          headerline() ;                                // Handle the line
+          if ( ( LFcount == 2 ) && ( state == SB_HEADER ) )
+          {
+            if ( !ctseen )                              // End of header, content type seen?
+            {
+              fail ( "no content-type" ) ;
+              break ;
+            }
+            head = 0 ;                                  // Window is empty
+            sbdatacount = sbmetaint ;                   // Bytes before first metadata
+            metaskip = 0 ;
+            title[0] = '\0' ;
+            state = SB_READY ;                          // Keep audio from now on
+            dbgprint ( "Standby for preset %d ready", preset ) ;
+          }
+          continue ;
+        }
+        if ( linex < ( sizeof(line) - 1 ) )             // Normal character, room in line?
+        {
+          line[linex++] = (char)b[0] ;
+        }
+        LFcount = 0 ;
+      }
+      break ;
+    case SB_READY :                                     // Keep the latest audio
+      for ( i = 0 ; i < 8 ; i++ )                       // Limit time spent here
+      {
+        res = client.available() ;
+        if ( res <= 0 )
+        {
+          break ;
+        }
+        if ( res > (int)sizeof(b) )
+        {
+          res = sizeof(b) ;
+        }
+        res = client.read ( b, res ) ;
+        if ( res <= 0 )
+        {
+          break ;
+        }
+        handledata ( b, res ) ;
+      }
+      if ( !client.connected() )                        // Still connected?
+      {
+        fail ( "disconnected" ) ;
+      }
+      break ;
+    default :
+      break ;
+  }
+}
+
+void Standby::handover ( WiFiClient& dest, RingBuf& ring )
+{
+  uint32_t n = head ;                                   // Audio bytes in window
+  uint32_t tinx ;                                       // Index of oldest byte
+
+  if ( n > SBPREFIX )
+  {
+    n = SBPREFIX ;
+  }
+  tinx = ( head - n ) % SBPREFIX ;
+  if ( ( tinx + n ) > SBPREFIX )                        // Wraps around?
+  {
+    ring.write ( buf + tinx, SBPREFIX - tinx ) ;        // Yes, oldest part first
+    n -= SBPREFIX - tinx ;
+    tinx = 0 ;
+  }
+  ring.write ( buf + tinx, n ) ;                        // Rest of the data
+  dest = client ;                                       // Connection is shared now
+  client = WiFiClient() ;                               // Release without closing
+  state = SB_IDLE ;
+  preset = -1 ;
+}
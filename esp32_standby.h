@@ -0,0 +1,118 @@
+#pragma once
+#include "esp32_radio.h"
+#include "esp32_ringbuf.h"
+//**************************************************************************************************
+// Warm standby connections to the presets next to the current one.                                *
+//**************************************************************************************************
+// A standby connection is made in the background, without blocking loop().  After the headers     *
+// have been parsed, the audio data is kept in a small rolling window.  Older data is discarded,   *
+// so the window always holds the latest SBPREFIX bytes.  The metadata is stripped, but the        *
+// position in the metaint cycle is tracked, so the stream can be handed over to mp3client and     *
+// handlebyte_ch() at any time.  The last StreamTitle is kept for the display.                     *
+// Chunked streams, redirects and playlists are not kept in standby.                               *
+//**************************************************************************************************
+#define SBSLOTS       2                                 // Standby connections, next and previous
+#define SBPREFIX      8192                              // Audio kept per standby connection
+#define SBTITLELEN    96                                // Max. length of StreamTitle kept
+#define SBMINHEAP     40000                             // Do not start standby below this free heap
+#define SBRETRY       30000                             // Retry a failed standby after msec
+
+enum sbstate_t { SB_IDLE, SB_RESOLVE, SB_CONNECT,       // States of a standby connection
+                 SB_HEADER, SB_READY, SB_FAILED } ;
+
+class Standby
+{
+  private:
+    sbstate_t     state     = SB_IDLE ;                 // Current state
+    int8_t        preset    = -1 ;                      // Preset for this connection
+    String        url ;                                 // Host as in preferences
+    String        hostwoext ;                           // Host without extension and portnumber
+    String        extension ;                           // Like "/mp3"
+    uint16_t      port ;                                // Port number of host
+    ip_addr_t     ip ;                                  // IP address of host
+    volatile bool dnsdone ;                             // DNS reply received
+    volatile bool dnsfail ;                             // DNS lookup failed
+    int           fd ;                                  // Socket during connect
+    WiFiClient    client ;                              // Connection after connect
+    uint32_t      t0 ;                                  // millis() at start of state
+    char          line[80] ;                            // Header line
+    uint16_t      linex ;                               // Index in line
+    uint8_t       LFcount ;                             // For detection of end of header
+    bool          ctseen ;                              // Content-type seen in header
+    uint8_t*      buf       = NULL ;                    // Rolling window with audio
+    uint32_t      head      = 0 ;                       // Total audio bytes stored
+    int           sbmetaint ;                           // Metaint of this stream
+    int           sbdatacount ;                         // Audio bytes before next metadata
+    int           metaskip ;                            // Metadata bytes to skip, -1 is length byte
+    char          title[SBTITLELEN] ;                   // Last metadata
+    uint16_t      titlex ;                              // Index in title
+    String        sbicyname ;                           // Station name
+    int           sbbitrate ;                           // Bitrate from header
+
+    static void   dnscb ( const char* name,             // Callback for DNS lookup
+                          const ip_addr_t* ipaddr, void* arg ) ;
+    void          fail ( const char* reason ) ;         // Close connection after failure
+    void          headerline() ;                        // Handle a line of the header
+    void          store ( const uint8_t* p, int len ) ; // Store audio in rolling window
+    void          handledata ( const uint8_t* p,        // Strip metadata from received data
+                               int len ) ;
+  public:
+    bool          start ( int8_t pset, const String& h ) ; // Start standby connection to a host
+    void          stop() ;                              // Close standby connection
+    void          handle() ;                            // Advance connection, read data
+    void          handover ( WiFiClient& dest,          // Give connection and buffered audio to
+                             RingBuf& ring ) ;          // the player
+    inline bool   isready() const                       // Ready to be used?
+    {
+      return ( state == SB_READY ) ;
+    }
+    inline bool   isactive() const                      // Connection in use or in progress?
+    {
+      return ( state != SB_IDLE ) && ( state != SB_FAILED ) ;
+    }
+    inline bool   mayretry() const                      // Failed, but SBRETRY has passed?
+    {
+      return ( state == SB_FAILED ) &&
+             ( ( millis() - t0 ) > SBRETRY ) ;
+    }
+    inline int8_t getpreset() const
+    {
+      return preset ;
+    }
+    inline const String& geturl() const
+    {
+      return url ;
+    }
+    inline int    getmetaint() const
+    {
+      return sbmetaint ;
+    }
+    inline int    getdatacount() const
+    {
+      return sbdatacount ;
+    }
+    inline int    getmetaskip() const
+    {
+      return metaskip ;
+    }
+    inline const char* gettitle() const
+    {
+      return title ;
+    }
+    inline const String& geticyname() const
+    {
+      return sbicyname ;
+    }
+    inline int    getbitrate() const
+    {
+      return sbbitrate ;
+    }
+    inline uint32_t getbudget() const                   // Memory used for the rolling window
+    {
+      return buf ? SBPREFIX : 0 ;
+    }
+} ;
+
+extern Standby           standby[SBSLOTS] ;             // Warm standby connections
+extern uint32_t          sb_hits ;                      // Preset changes served from standby
+extern uint32_t          sb_misses ;                    // Preset changes without standby
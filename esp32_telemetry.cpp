@@ -0,0 +1,271 @@
+//**************************************************************************************************
+// Telemetry class implementation.                                                                 *
+//**************************************************************************************************
+#include "esp32_radio.h"
+#include "esp32_ringbuf.h"
+#include "esp32_telemetry.h"
+
+bool Telemetry::begin()
+{
+  recs = (tlmrec_struct*)calloc ( TLMSIZ, sizeof(tlmrec_struct) ) ;
+  if ( recs == NULL )
+  {
+    dbgprint ( "No memory for telemetry!" ) ;
+    return false ;
+  }
+  seconds = 0 ;
+  lastin = incount ;                                    // Start of first second
+  lastqueued = dataring.written() ;
+  lastsent = sentcount ;
+  lastunderruns = dataring.getunderruns() ;
+  nsamples = 0 ;
+  return true ;
+}
+
+void Telemetry::sample ( bool playing )
+{
+  uint32_t f = dataring.fill() ;                        // Current fill level
+
+  if ( nsamples == 0 )                                  // First sample of this second?
+  {
+    fmin = f ;                                          // Yes, start again
+    fmax = f ;
+    fsum = 0 ;
+    splaying = true ;
+  }
+  if ( !playing )                                       // Start hold or stopped?
+  {
+    splaying = false ;                                  // Yes, not a playing second
+  }
+  if ( f < fmin )
+  {
+    fmin = f ;
+  }
+  if ( f > fmax )
+  {
+    fmax = f ;
+  }
+  fsum += f ;
+  nsamples++ ;
+}
+
+void Telemetry::tick()
+{
+  tlmrec_struct* r ;                                    // Record for this second
+  uint32_t       in = incount ;                         // Copy of the counters
+  uint32_t       queued = dataring.written() ;
+  uint32_t       sent = sentcount ;
+  uint32_t       ur = dataring.getunderruns() ;
+
+  if ( recs == NULL )                                   // Ring available?
+  {
+    return ;
+  }
+  r = recs + ( seconds % TLMSIZ ) ;                     // Overwrite the oldest record
+  r->in = in - lastin ;
+  r->queued = queued - lastqueued ;
+  r->sent = sent - lastsent ;
+  if ( nsamples )                                       // Fill level sampled?
+  {
+    r->fillmin = fmin ;
+    r->fillavg = fsum / nsamples ;
+    r->fillmax = fmax ;
+    r->playing = splaying ;
+  }
+  else
+  {
+    r->fillmin = r->fillavg = r->fillmax = dataring.fill() ;
+    r->playing = false ;
+  }
+  if ( ur < lastunderruns )                             // Statistics of dataring reset?
+  {
+    lastunderruns = 0 ;                                 // Yes, count from zero
+  }
+  r->underruns = ur - lastunderruns ;
+  r->loopms = __atomic_exchange_n ( &loopmax, 0,       // Take maximum and start new second
+                                    __ATOMIC_RELAXED ) ;
+  r->decoded = 0 ;                                      // Filled in by decoder()
+  r->drop = DROP_NONE ;
+  lastin = in ;
+  lastqueued = queued ;
+  lastsent = sent ;
+  lastunderruns = ur ;
+  nsamples = 0 ;
+  seconds++ ;                                           // Record is complete
+}
+
+// Called once a second after tick().  The decode time is reset by the decoder for a new stream, so
+// any change counts as progress.  Seconds that were not playing, like the start hold after a
+// station change, are never a dropout.
+bool Telemetry::decoder ( const decstat_struct& ds, uint32_t byterate )
+{
+  tlmrec_struct* r ;                                    // Record of the last second
+  bool           changed ;                              // Format, rates or dropouts changed
+  dropcause_t    cause = DROP_NONE ;                    // Cause of a new dropout
+  const char*    format = VS1053::formatName ( ds.hdat1 ) ;
+  uint16_t       kbps = ds.byterate * 8 / 1000 ;        // Measured bitrate
+
+  if ( ( recs == NULL ) || ( seconds == 0 ) )           // Record available?
+  {
+    return false ;
+  }
+  r = recs + ( ( seconds - 1 ) % TLMSIZ ) ;
+  if ( ds.decodetime != lastdecodetime )                // Progress?
+  {
+    stallsec = 0 ;
+    r->decoded = ( ds.decodetime > lastdecodetime ) ?   // Yes, count seconds
+                 ds.decodetime - lastdecodetime : 1 ;
+  }
+  else if ( r->playing && ( stallsec < 255 ) )
+  {
+    if ( ++stallsec == DECSTALL )                       // No progress while playing, stalled?
+    {
+      dec.stalls++ ;                                    // Yes, count once
+    }
+  }
+  lastdecodetime = ds.decodetime ;
+  if ( ds.byterate )                                    // Decoder knows the rate?
+  {
+    byterate = ds.byterate ;                            // Yes, use it
+  }
+  if ( r->playing && ( r->underruns || ( r->fillmin == 0 ) ) )
+  {
+    cause = ( r->in < byterate ) ? DROP_NETWORK :       // Ringbuffer ran empty
+                                   DROP_BUFFER ;
+  }
+  else if ( r->playing && ( stallsec >= DECSTALL ) )
+  {
+    cause = DROP_CHIP ;                                 // Decoder stalled with data available
+  }
+  changed = ( format != dec.format ) ||
+            ( kbps != dec.kbps ) ||
+            ( ( ds.audata & 0xFFFE ) != dec.samplerate ) ;
+  if ( cause == DROP_NONE )
+  {
+    indrop = false ;                                    // No dropout (anymore)
+  }
+  else if ( !indrop )                                   // Start of a dropout?
+  {
+    indrop = true ;                                     // Yes, count it once
+    r->drop = cause ;
+    dec.drops[cause]++ ;
+    dec.lastdrop = cause ;
+    changed = true ;
+  }
+  dec.format = format ;
+  dec.samplerate = ds.audata & 0xFFFE ;                 // Bit 0 is the stereo bit
+  dec.stereo = ( ds.audata & 1 ) != 0 ;
+  dec.kbps = kbps ;
+  dec.decodetime = ds.decodetime ;
+  dec.status = ds.status ;
+  return changed ;
+}
+
+void Telemetry::decodertext ( char* buf, size_t siz ) const
+{
+  snprintf ( buf, siz, "%s %d kbps %d Hz %s, dropouts %d/%d/%d (net/buf/chip)",
+             dec.format ? dec.format : "none", dec.kbps, dec.samplerate,
+             dec.stereo ? "stereo" : "mono",
+             dec.drops[DROP_NETWORK], dec.drops[DROP_BUFFER], dec.drops[DROP_CHIP] ) ;
+}
+
+const tlmrec_struct* Telemetry::getrec ( uint32_t n ) const
+{
+  if ( ( n >= seconds ) ||                              // Record available?
+       ( ( seconds - n ) > TLMSIZ ) )                   // Or already overwritten?
+  {
+    return NULL ;
+  }
+  return recs + ( n % TLMSIZ ) ;
+}
+
+// Give a summary of all records in buf.  The average rates are compared with the byterate of the
+// audio to see what limits the pipeline:
+//  "SPI-bound"     - less data than needed sent to the VS1053 while there is enough in the
+//                    ringbuffer.
+//  "network-bound" - underruns or an empty ringbuffer while playing.
+// The lowest fill, the underruns and the dropouts are taken from the playing seconds only, so the
+// start hold after a station change does not count.
+void Telemetry::summary ( char* buf, size_t siz, uint32_t byterate ) const
+{
+  uint32_t             sec = seconds ;                  // Number of newest record + 1
+  uint32_t             n ;                              // Number of records
+  const tlmrec_struct* r ;                              // Record examined
+  uint64_t             in = 0 ;                         // Sums over all records
+  uint64_t             queued = 0 ;
+  uint64_t             sent = 0 ;
+  uint64_t             fill = 0 ;
+  uint32_t             fillmin = 0xFFFFFFFF ;
+  uint32_t             fillmax = 0 ;
+  uint32_t             underruns = 0 ;
+  uint32_t             nplaying = 0 ;                   // Number of playing seconds
+  uint32_t             loopms = 0 ;
+  uint32_t             drops[DROP_NUMCAUSES] = {} ;     // Dropouts per cause
+  const char*          verdict = "ok" ;                 // What limits the pipeline
+  uint32_t             i ;                              // Loop control
+
+  n = ( sec < TLMSIZ ) ? sec : TLMSIZ ;
+  if ( n == 0 )                                         // Anything to summarize?
+  {
+    snprintf ( buf, siz, "No telemetry yet" ) ;
+    return ;
+  }
+  for ( i = sec - n ; i < sec ; i++ )
+  {
+    r = getrec ( i ) ;
+    if ( r == NULL )                                    // Overwritten in the meantime?
+    {
+      continue ;
+    }
+    in += r->in ;
+    queued += r->queued ;
+    sent += r->sent ;
+    fill += r->fillavg ;
+    if ( r->fillmax > fillmax )
+    {
+      fillmax = r->fillmax ;
+    }
+    if ( r->loopms > loopms )
+    {
+      loopms = r->loopms ;
+    }
+    if ( !r->playing )                                  // Start hold or stopped?
+    {
+      continue ;                                        // Yes, no underruns to count
+    }
+    nplaying++ ;
+    if ( r->fillmin < fillmin )
+    {
+      fillmin = r->fillmin ;
+    }
+    underruns += r->underruns ;
+    drops[r->drop]++ ;
+  }
+  if ( nplaying == 0 )                                  // Lowest fill known?
+  {
+    fillmin = 0 ;                                       // No, show as zero
+  }
+  in /= n ;                                             // Averages per second
+  queued /= n ;
+  sent /= n ;
+  fill /= n ;
+  if ( sent == 0 )                                      // Playing at all?
+  {
+    verdict = "idle" ;
+  }
+  else if ( ( sent * 100 < (uint64_t)byterate * 95 ) && // Too slow to the VS1053?
+            ( fill * 2 > dataring.getsize() ) )         // With enough data available?
+  {
+    verdict = "SPI-bound" ;
+  }
+  else if ( nplaying &&                                 // Ringbuffer ran empty while playing?
+            ( underruns || ( fillmin == 0 ) ) )
+  {
+    verdict = "network-bound" ;
+  }
+  snprintf ( buf, siz, "Last %d sec (%d playing): in %d, queued %d, sent %d B/s, need %d B/s, "
+             "fill %d/%d/%d, underruns %d, max loop %d msec, %s, dropouts %d/%d/%d",
+             n, nplaying, (uint32_t)in, (uint32_t)queued, (uint32_t)sent, byterate,
+             fillmin, (uint32_t)fill, fillmax, underruns, loopms, verdict,
+             drops[DROP_NETWORK], drops[DROP_BUFFER], drops[DROP_CHIP] ) ;
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include "esp32_radio.h"
+#include "esp32_vs1053.h"
+//**************************************************************************************************
+// Throughput and stall telemetry of the stream pipeline.                                          *
+//**************************************************************************************************
+// Every second a record is added to a ring with the statistics of the last TLMSIZ seconds.  A     *
+// record holds the bytes read from the input (network or SD), the bytes put in the ringbuffer,    *
+// the bytes sent to the VS1053, the lowest, average and highest fill of the ringbuffer, the       *
+// number of underruns and the longest loop() in that second.                                      *
+// The fill level is sampled by spftask every 100 msec.  The byte counters are updated by the task *
+// that moves the data, so they are only written by one task each.                                 *
+// A second counts as playing if playback was established at every sample, so not during the       *
+// start hold of the jitter buffer.  Only playing seconds are used for underruns and dropouts.     *
+// The ring is sent as CSV with the "telemetry" command of the web interface, a summary is given   *
+// by the "tlmstatus" command.                                                                     *
+// Once a second the state of the decoder is added by decoder().  A second with an underrun of the *
+// ringbuffer or a decoder that does not advance while playing is a dropout.  The first second of  *
+// a dropout gives the cause:                                                                      *
+//  DROP_NETWORK - the ringbuffer ran empty and less data than needed came in.                     *
+//  DROP_BUFFER  - the ringbuffer ran empty although enough data came in.                          *
+//  DROP_CHIP    - the decoder did not advance for 2 seconds while the ringbuffer had data.        *
+//**************************************************************************************************
+#define TLMSIZ        300                               // Seconds kept in the ring (5 minutes)
+#define DECSTALL      2                                 // Seconds without progress for a stall
+
+enum dropcause_t { DROP_NONE, DROP_NETWORK,             // Causes of a dropout
+                   DROP_BUFFER, DROP_CHIP,
+                   DROP_NUMCAUSES } ;
+
+struct tlmrec_struct                                    // Statistics of one second
+{
+  uint32_t        in ;                                  // Bytes read from the input
+  uint32_t        queued ;                              // Bytes put in the ringbuffer
+  uint32_t        sent ;                                // Bytes sent to the VS1053
+  uint32_t        fillmin ;                             // Lowest fill of ringbuffer
+  uint32_t        fillavg ;                             // Average fill of ringbuffer
+  uint32_t        fillmax ;                             // Highest fill of ringbuffer
+  uint16_t        underruns ;                           // Underruns of playtask
+  uint16_t        loopms ;                              // Longest loop() in msec
+  uint8_t         decoded ;                             // Seconds decoded by the VS1053
+  uint8_t         drop ;                                // Cause of dropout that started here
+  uint8_t         playing ;                             // Playback established whole second
+} ;
+
+struct decinfo_struct                                   // Derived state of the decoder
+{
+  const char*     format ;                              // Format of the stream
+  uint16_t        samplerate ;                          // Sample rate in Hz
+  bool            stereo ;                              // Stereo or mono
+  uint16_t        kbps ;                                // Bitrate as measured by the decoder
+  uint16_t        decodetime ;                          // Seconds decoded of this stream
+  uint16_t        status ;                              // Copy of SCI_STATUS
+  uint32_t        stalls ;                              // Decoder stalls while playing
+  uint32_t        drops[DROP_NUMCAUSES] ;               // Number of dropouts per cause
+  dropcause_t     lastdrop ;                            // Cause of the last dropout
+} ;
+
+class Telemetry
+{
+  private:
+    tlmrec_struct*    recs      = NULL ;                // The ring
+    uint32_t          seconds   = 0 ;                   // Number of records written
+    // Counters, incount and sentcount are updated by one task only.  loopmax is raised by loop()
+    // and reset by tick(), so both use atomic operations on it.
+    volatile uint32_t incount   = 0 ;                   // Bytes read from input (mp3loop)
+    volatile uint32_t sentcount = 0 ;                   // Bytes sent to VS1053 (playtask)
+    volatile uint32_t loopmax   = 0 ;                   // Longest loop() in this second (loop)
+    // State of the current second (spftask)
+    uint32_t          lastin ;                          // Counters at start of this second
+    uint32_t          lastqueued ;
+    uint32_t          lastsent ;
+    uint32_t          lastunderruns ;
+    uint32_t          fmin ;                            // Fill statistics of this second
+    uint32_t          fmax ;
+    uint32_t          fsum ;
+    uint8_t           nsamples ;                        // Number of fill samples
+    bool              splaying ;                        // Playing at all samples of this second
+    // State of the decoder (spftask)
+    decinfo_struct    dec = { "none" } ;                // Derived state of the decoder
+    uint16_t          lastdecodetime = 0 ;              // Decode time of previous second
+    uint8_t           stallsec = 0 ;                    // Seconds without progress
+    bool              indrop = false ;                  // Dropout in progress
+
+  public:
+    bool              begin() ;                         // Allocate the ring
+    void              sample ( bool playing ) ;         // Sample the fill level (100 msec)
+    void              tick() ;                          // Add the record of the last second
+    const tlmrec_struct* getrec ( uint32_t n ) const ;  // Get record of second n after begin()
+    void              summary ( char* buf, size_t siz,  // Summary of all records
+                                uint32_t byterate ) const ;
+    bool              decoder ( const decstat_struct& ds, // Add state of the decoder to the last
+                                uint32_t byterate ) ;   // record, true if changed
+    void              decodertext ( char* buf,          // Short text with state of the decoder
+                                    size_t siz ) const ;
+    inline const decinfo_struct& getdecinfo() const     // Derived state of the decoder
+    {
+      return dec ;
+    }
+    inline void       countin ( uint32_t n )            // Count bytes read from input
+    {
+      incount += n ;
+    }
+    inline void       countsent ( uint32_t n )          // Count bytes sent to VS1053
+    {
+      sentcount += n ;
+    }
+    inline void       countloop ( uint32_t ms )         // Register duration of loop()
+    {
+      uint32_t cur = loopmax ;                          // Maximum so far
+
+      while ( ( ms > cur ) &&                           // New maximum, not reset meanwhile?
+              !__atomic_compare_exchange_n ( &loopmax, &cur, ms, false,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+      {
+        // Changed by tick() in the meantime, cur holds the new value, try again
+      }
+    }
+    inline uint16_t   getcount() const                  // Number of records available
+    {
+      return ( seconds < TLMSIZ ) ? seconds : TLMSIZ ;
+    }
+    inline uint32_t   getseconds() const                // Seconds since begin()
+    {
+      return seconds ;
+    }
+} ;
+
+extern Telemetry         tlm ;                          // Telemetry of the stream pipeline
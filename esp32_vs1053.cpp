@@ -7,10 +7,11 @@ VS1053::VS1053 ( int8_t _cs_pin, int8_t _dcs_pin, int8_t _dreq_pin,
 {
 }
 
-uint16_t VS1053::read_register ( uint8_t _reg ) const
+uint16_t VS1053::sci_read ( uint8_t _reg )
 {
   uint16_t result ;
 
+  sci_bus++ ;                                      // Count for statistics
   control_mode_on() ;
   SPI.write ( 3 ) ;                                // Read operation
   SPI.write ( _reg ) ;                             // Register to write (0..0xF)
@@ -19,17 +20,226 @@ uint16_t VS1053::read_register ( uint8_t _reg ) const
            ( SPI.transfer ( 0xFF ) ) ;
   await_data_request() ;                           // Wait for DREQ to be HIGH again
   control_mode_off() ;
+  if ( SCI_CACHED & ( 1 << _reg ) )                // Keep a copy?
+  {
+    set_shadow ( _reg, result ) ;                  // Yes, remember
+  }
   return result ;
 }
 
-void VS1053::write_register ( uint8_t _reg, uint16_t _value ) const
+uint16_t VS1053::read_register ( uint8_t _reg )
+{
+  if ( SCI_CACHED & shadowvalid & ( 1 << _reg ) )  // Value known?
+  {
+    sci_cached++ ;                                 // Yes, no need to use the bus
+    return shadow[_reg] ;
+  }
+  return sci_read ( _reg ) ;
+}
+
+void VS1053::write_register ( uint8_t _reg, uint16_t _value )
 {
+  sci_bus++ ;                                      // Count for statistics
   control_mode_on( );
   SPI.write ( 2 ) ;                                // Write operation
   SPI.write ( _reg ) ;                             // Register to write (0..0xF)
   SPI.write16 ( _value ) ;                         // Send 16 bits data
   await_data_request() ;
   control_mode_off() ;
+  if ( SCI_CACHED & ( 1 << _reg ) )                // Keep a copy?
+  {
+    set_shadow ( _reg, _value ) ;                  // Yes, remember value
+  }
+}
+
+void VS1053::update_register ( uint8_t _reg, uint16_t _value )
+{
+  if ( ( SCI_CACHED & shadowvalid & ( 1 << _reg ) ) &&
+       ( shadow[_reg] == _value ) )                // Value known and the same?
+  {
+    sci_cached++ ;                                 // Yes, no need to use the bus
+    return ;
+  }
+  write_register ( _reg, _value ) ;
+}
+
+void VS1053::sciBatch ( uint8_t reg, uint16_t value )
+{
+  if ( batchcount == SCIBATCHSIZ )                 // Room in batch?
+  {
+    sciCommit() ;                                  // No, send what we have
+  }
+  batch[batchcount].reg = reg ;
+  batch[batchcount].value = value ;
+  batchcount++ ;
+}
+
+void VS1053::sciWram ( uint16_t address, uint16_t data )
+{
+  // The WRAM address increments after every word, so the address is only needed if it is not the
+  // next one.
+  if ( ( batchcount == 0 ) ||                      // Address in WRAMADDR known?
+       ( batch[batchcount - 1].reg != SCI_WRAM ) ||
+       ( shadow[SCI_WRAMADDR] != address ) )
+  {
+    sciBatch ( SCI_WRAMADDR, address ) ;           // No, set address
+    shadow[SCI_WRAMADDR] = address ;
+  }
+  sciBatch ( SCI_WRAM, data ) ;
+  shadow[SCI_WRAMADDR]++ ;                         // Next address
+}
+
+void VS1053::sciCommit()
+{
+  uint8_t i ;                                      // Index in batch
+
+  if ( batchcount == 0 )                           // Anything to send?
+  {
+    return ;
+  }
+  SPI.beginTransaction ( VS1053_SPI ) ;            // One transaction for the whole batch
+  for ( i = 0 ; i < batchcount ; i++ )
+  {
+    if ( ( i == 0 ) ||                             // New register?
+         ( batch[i].reg != SCI_WRAM ) ||
+         ( batch[i - 1].reg != SCI_WRAM ) )
+    {
+      if ( i )
+      {
+        digitalWrite ( cs_pin, HIGH ) ;            // End previous operation
+      }
+      sci_bus++ ;                                  // Count for statistics
+      await_data_request() ;
+      digitalWrite ( cs_pin, LOW ) ;
+      SPI.write ( 2 ) ;                            // Write operation
+      SPI.write ( batch[i].reg ) ;                 // Register to write (0..0xF)
+    }
+    else
+    {
+      await_data_request() ;                       // Next word of a multiple write
+    }
+    SPI.write16 ( batch[i].value ) ;               // Send 16 bits data
+    if ( SCI_CACHED & ( 1 << batch[i].reg ) )      // Keep a copy?
+    {
+      set_shadow ( batch[i].reg, batch[i].value ) ;
+    }
+  }
+  await_data_request() ;
+  digitalWrite ( cs_pin, HIGH ) ;                  // End last operation
+  SPI.endTransaction() ;                           // Allow other SPI users
+  batchcount = 0 ;
+}
+
+void VS1053::sci_multi ( uint8_t _reg, const uint16_t* data, uint16_t n, bool repeat )
+{
+  // SCI multiple write: XCS stays low and every next word goes to the same register.  For
+  // SCI_WRAM the address increments after every word.  If repeat is set, data[0] is written n times.
+  uint16_t i ;                                     // Loop control
+
+  if ( n == 0 )                                    // Anything to write?
+  {
+    return ;
+  }
+  sci_bus++ ;                                      // Count for statistics
+  control_mode_on() ;
+  SPI.write ( 2 ) ;                                // Write operation
+  SPI.write ( _reg ) ;                             // Register to write (0..0xF)
+  for ( i = 0 ; i < n ; i++ )
+  {
+    SPI.write16 ( repeat ? data[0] : data[i] ) ;   // Send 16 bits data
+    await_data_request() ;                         // Wait until the chip has handled it
+  }
+  control_mode_off() ;
+  if ( SCI_CACHED & ( 1 << _reg ) )                // Keep a copy?
+  {
+    set_shadow ( _reg, repeat ? data[0] : data[n - 1] ) ;
+  }
+}
+
+void VS1053::sciWramRead ( uint16_t address, uint16_t* buf, uint16_t n )
+{
+  // The address is set once, it increments after every read of SCI_WRAM.  DREQ cannot be used to
+  // see if the chip is ready: during playing DREQ is low most of the time, because playtask keeps
+  // the FIFO full.  So there is a fixed delay of WRAMSETTLE after every WRAM access instead.
+  uint16_t i ;                                     // Index in buf
+
+  sci_bus += n + 1 ;                               // Count for statistics
+  SPI.beginTransaction ( VS1053_SPI ) ;            // One transaction for all reads
+  digitalWrite ( cs_pin, LOW ) ;
+  SPI.write ( 2 ) ;                                // Write operation
+  SPI.write ( SCI_WRAMADDR ) ;                     // Set address
+  SPI.write16 ( address ) ;
+  digitalWrite ( cs_pin, HIGH ) ;
+  for ( i = 0 ; i < n ; i++ )
+  {
+    delayMicroseconds ( WRAMSETTLE ) ;             // Wait until address is set or incremented
+    buf[i] = sci_read_cs ( SCI_WRAM ) ;
+  }
+  SPI.endTransaction() ;                           // Allow other SPI users
+}
+
+uint16_t VS1053::sci_read_cs ( uint8_t _reg )
+{
+  uint16_t result ;
+
+  digitalWrite ( cs_pin, LOW ) ;
+  SPI.write ( 3 ) ;                                // Read operation
+  SPI.write ( _reg ) ;
+  result = SPI.transfer ( 0xFF ) << 8 ;            // Read 16 bits data
+  result |= SPI.transfer ( 0xFF ) ;
+  digitalWrite ( cs_pin, HIGH ) ;
+  return result ;
+}
+
+void VS1053::readDecoder ( decstat_struct* ds )
+{
+  // The registers are changed by the chip, so they are always read from the chip and not from the
+  // shadow copy.  byteRate is the average rate of the stream as measured by the decoder, it is
+  // found in the parametric data at 0x1E05.  No waits for DREQ, but a fixed delay after setting
+  // the WRAM address, see sciWramRead().
+  sci_bus += 7 ;                                   // Count for statistics
+  SPI.beginTransaction ( VS1053_SPI ) ;            // One transaction for all reads
+  ds->status = sci_read_cs ( SCI_STATUS ) ;
+  ds->decodetime = sci_read_cs ( SCI_DECODE_TIME ) ;
+  ds->audata = sci_read_cs ( SCI_AUDATA ) ;
+  ds->hdat0 = sci_read_cs ( SCI_HDAT0 ) ;
+  ds->hdat1 = sci_read_cs ( SCI_HDAT1 ) ;
+  digitalWrite ( cs_pin, LOW ) ;
+  SPI.write ( 2 ) ;                                // Write operation
+  SPI.write ( SCI_WRAMADDR ) ;                     // Set address of byteRate
+  SPI.write16 ( 0x1E05 ) ;
+  digitalWrite ( cs_pin, HIGH ) ;
+  delayMicroseconds ( WRAMSETTLE ) ;               // Wait until address is set
+  ds->byterate = sci_read_cs ( SCI_WRAM ) ;
+  SPI.endTransaction() ;                           // Allow other SPI users
+}
+
+const char* VS1053::formatName ( uint16_t hdat1 )
+{
+  // See the description of SCI_HDAT1 in the datasheet.  For MP3 the sync word is followed by the
+  // ID and the layer bits.
+  switch ( hdat1 )
+  {
+    case 0x0000 : return "none" ;
+    case 0x7665 : return "WAV" ;
+    case 0x4154 : return "AAC" ;                   // ADTS
+    case 0x4144 : return "AAC" ;                   // ADIF
+    case 0x4D34 : return "AAC" ;                   // MP4
+    case 0x574D : return "WMA" ;
+    case 0x4F67 : return "Ogg" ;
+    case 0x664C : return "FLAC" ;
+    case 0x4D54 : return "MIDI" ;
+  }
+  if ( ( hdat1 & 0xFFE0 ) == 0xFFE0 )              // MPEG audio sync word?
+  {
+    switch ( ( hdat1 >> 1 ) & 3 )                  // Yes, check layer
+    {
+      case 1 : return "MP3" ;
+      case 2 : return "MP2" ;
+      case 3 : return "MP1" ;
+    }
+  }
+  return "unknown" ;
 }
 
 bool VS1053::sdi_send_buffer ( uint8_t* data, size_t len )
@@ -116,8 +326,8 @@ bool VS1053::testComm ( const char *header )
   for ( i = 0 ; ( i < 0xFFFF ) && ( cnt < 20 ) ; i += delta )
   {
     write_register ( SCI_VOL, i ) ;                     // Write data to SCI_VOL
-    r1 = read_register ( SCI_VOL ) ;                    // Read back for the first time
-    r2 = read_register ( SCI_VOL ) ;                    // Read back a second time
+    r1 = sci_read ( SCI_VOL ) ;                         // Read back for the first time
+    r2 = sci_read ( SCI_VOL ) ;                         // Read back a second time
     if  ( r1 != r2 || i != r1 || i != r2 )              // Check for 2 equal reads
     {
       dbgprint ( "VS1053 SPI error. SB:%04X R1:%04X R2:%04X", i, r1, r2 ) ;
@@ -173,8 +383,13 @@ void VS1053::begin()
     testComm ( "Fast SPI, Testing VS1053 read/write registers again..." ) ;
     delay ( 10 ) ;
     await_data_request() ;
+    running = true ;                                      // Clock and SPI speed are final
+    loadPlugins() ;                                       // Load patches and plugins (if any)
     endFillByte = wram_read ( 0x1E06 ) & 0xFF ;
     dbgprint ( "endFillByte is %X", endFillByte ) ;
+    curvol = 0 ;                                          // Start in silence, setVolume() will
+    tgtatt = VOLSILENT ;                                  // ramp up from here
+    writeatt ( VOLSILENT ) ;
     //printDetails ( "After last clocksetting" ) ;
     delay ( 100 ) ;
   }
@@ -185,15 +400,139 @@ void VS1053::setVolume ( uint8_t vol )
   // Set volume.  Both left and right.
   // Input value is 0..100.  100 is the loudest.
   // Clicking reduced by using 0xf8 to 0x00 as limits.
-  uint16_t value ;                                      // Value to send to SCI_VOL
-
   if ( vol != curvol )
   {
     curvol = vol ;                                      // Save for later use
-    value = map ( vol, 0, 100, 0xF8, 0x00 ) ;           // 0..100% to one channel
-    value = ( value << 8 ) | value ;
-    write_register ( SCI_VOL, value ) ;                 // Volume left and right
-    output_enable ( vol != 0 ) ;                        // Enable/disable amplifier through shutdown pin(s)
+    if ( muted )                                        // Muted by setMute()?
+    {
+      return ;                                          // Yes, set at unmute
+    }
+    if ( vol )                                          // Sound wanted?
+    {
+      output_enable ( true ) ;                          // Yes, enable amplifier before ramp up
+    }
+    settarget() ;                                       // Ramp to new volume
+  }
+}
+
+void VS1053::setMute ( bool on )
+{
+  // Mute the output without disabling the amplifier.  This avoids the plop of the shutdown pin
+  // and the startup time of the amplifier.  Muting is immediate, unmuting is ramped.
+  if ( on == muted )                                    // Any change?
+  {
+    return ;                                            // No, nothing to do
+  }
+  muted = on ;
+  if ( on )                                             // Mute?
+  {
+    tgtatt = VOLSILENT ;                                // Yes, total silence at once
+    writeatt ( VOLSILENT ) ;
+  }
+  else
+  {
+    settarget() ;                                       // Ramp to current volume
+  }
+}
+
+void VS1053::writeatt ( uint8_t att )
+{
+  curatt = att ;
+  update_register ( SCI_VOL, ( att << 8 ) | att ) ;     // Volume left and right
+}
+
+void VS1053::settarget()
+{
+  tgtatt = muted ? VOLSILENT : map ( curvol, 0, 100, 0xF8, 0x00 ) ;
+  ramplast = millis() ;                                 // Start of ramp
+  curramp = rampms ;                                    // Normal speed
+  if ( rampms == 0 )                                    // Ramping?
+  {
+    writeatt ( tgtatt ) ;                               // No, jump to target
+  }
+  if ( ( curatt == tgtatt ) && ( curvol == 0 ) && !muted )
+  {
+    output_enable ( false ) ;                           // Disable amplifier at volume 0
+  }
+}
+
+void VS1053::setRampTime ( uint16_t ms )
+{
+  rampms = ms ;
+  if ( ms == 0 )                                        // No more ramping?
+  {
+    settarget() ;                                       // Yes, finish ramp in progress
+  }
+}
+
+bool VS1053::rampStep()
+{
+  uint32_t now = millis() ;                             // Current time
+  uint32_t n ;                                          // Units to move
+
+  if ( curatt == tgtatt )                               // Ramp in progress?
+  {
+    return false ;                                      // No
+  }
+  n = ( now - ramplast ) * RAMPUNITS / curramp ;        // Units since last step
+  if ( n == 0 )                                         // Time for a step?
+  {
+    return true ;                                       // No, wait
+  }
+  if ( n > RAMPMAXSTEP )                                // Long time since last step?
+  {
+    n = RAMPMAXSTEP ;                                   // Yes, limit step, continue from now
+    ramplast = now ;
+  }
+  else
+  {
+    ramplast += n * curramp / RAMPUNITS ;               // Keep the rate exact
+  }
+  if ( curatt < tgtatt )                                // Softer?
+  {
+    writeatt ( ( ( tgtatt - curatt ) > n ) ? curatt + n : tgtatt ) ;
+  }
+  else
+  {
+    writeatt ( ( ( curatt - tgtatt ) > n ) ? curatt - n : tgtatt ) ;
+  }
+  rampsteps++ ;                                         // Count for statistics
+  if ( ( curatt == tgtatt ) && ( curvol == 0 ) && !muted )
+  {
+    output_enable ( false ) ;                           // Disable amplifier at volume 0
+  }
+  return true ;
+}
+
+void VS1053::fadeIn()
+{
+  writeatt ( VOLSILENT ) ;                              // Start in silence
+  muted = false ;
+  settarget() ;                                         // Ramp to current volume
+}
+
+void VS1053::fadeOut()
+{
+  // Ramp down while the decoder plays the rest of the FIFO.  The caller has to stop the data, so
+  // the duration is limited to FADEOUTMAX msec.
+  uint32_t units = VOLSILENT - curatt ;                 // Units to go
+
+  muted = true ;                                        // Silent until fadeIn()
+  tgtatt = VOLSILENT ;
+  ramplast = millis() ;                                 // Start of ramp
+  if ( ( rampms == 0 ) || ( units == 0 ) )              // Ramping?
+  {
+    writeatt ( VOLSILENT ) ;                            // No, silent at once
+    return ;
+  }
+  curramp = rampms ;
+  if ( units * rampms / RAMPUNITS > FADEOUTMAX )        // Too slow?
+  {
+    curramp = FADEOUTMAX * RAMPUNITS / units ;          // Yes, faster ramp
+    if ( curramp == 0 )
+    {
+      curramp = 1 ;
+    }
   }
 }
 
@@ -207,7 +546,7 @@ void VS1053::setTone ( uint8_t *rtone )                 // Set bass/treble (4 ni
   {
     value = ( value << 4 ) | rtone[i] ;                 // Shift next nibble in
   }
-  write_register ( SCI_BASS, value ) ;                  // Volume left and right
+  update_register ( SCI_BASS, value ) ;                 // Only if changed
 }
 
 void VS1053::startSong()
@@ -221,6 +560,15 @@ bool VS1053::playChunk ( uint8_t* data, size_t len )
   return okay && sdi_send_buffer ( data, len ) ;        // True if more data can be added to fifo
 }
 
+bool VS1053::burstChunk ( uint8_t* data, size_t len )
+{
+  if ( okay )                                           // Only if chip is working
+  {
+    SPI.writeBytes ( data, len ) ;                      // XDCS is already low
+  }
+  return data_request() ;                               // True if more data can be added to fifo
+}
+
 void VS1053::stopSong()
 {
   uint16_t modereg ;                                    // Read from mode register
@@ -233,7 +581,7 @@ void VS1053::stopSong()
   for ( i = 0 ; i < 200 ; i++ )
   {
     sdi_send_fillers ( 32 ) ;
-    modereg = read_register ( SCI_MODE ) ;  // Read status
+    modereg = sci_read ( SCI_MODE ) ;       // Read status, SM_CANCEL is cleared by the chip
     if ( ( modereg & _BV ( SM_CANCEL ) ) == 0 )
     {
       sdi_send_fillers ( 2052 ) ;
@@ -245,11 +593,124 @@ void VS1053::stopSong()
   printDetails ( "Song stopped incorrectly!" ) ;
 }
 
+bool VS1053::cancelSong()
+{
+  // Cancel decoding of the current stream as described in the datasheet: set SM_CANCEL and send
+  // fill bytes in blocks of 32 until the decoder clears SM_CANCEL (max. 2048 bytes).
+  // No long fill and no delays, so this is much faster than stopSong().
+  uint16_t modereg ;                                    // Read from mode register
+  int      i ;                                          // Loop control
+
+  write_register ( SCI_MODE, _BV ( SM_SDINEW ) | _BV ( SM_CANCEL ) ) ;
+  for ( i = 0 ; i < 64 ; i++ )
+  {
+    sdi_send_fillers ( 32 ) ;
+    modereg = sci_read ( SCI_MODE ) ;                   // Read status, not from the shadow copy
+    if ( ( modereg & _BV ( SM_CANCEL ) ) == 0 )
+    {
+      return true ;                                     // Decoder is ready for the next stream
+    }
+  }
+  printDetails ( "Song cancelled incorrectly!" ) ;
+  return false ;
+}
+
 void VS1053::softReset()
 {
+  SPISettings fastspi = VS1053_SPI ;                    // SPI settings before reset
+
   write_register ( SCI_MODE, _BV ( SM_SDINEW ) | _BV ( SM_RESET ) ) ;
   delay ( 10 ) ;
   await_data_request() ;
+  shadowvalid = 0 ;                                     // Registers are back to defaults
+  if ( running )                                        // Reset after begin()?
+  {
+    // Restore the settings of begin().  The chip runs on XTALI until CLOCKF is set, so that is
+    // done at a lower SPI speed.  The plugins are lost by the reset, so they are loaded again.
+    VS1053_SPI = SPISettings ( 1000000, MSBFIRST, SPI_MODE0 ) ;
+    write_register ( SCI_CLOCKF, 6 << 12 ) ;            // Normal clock settings
+    VS1053_SPI = fastspi ;
+    write_register ( SCI_AUDATA, 44100 + 1 ) ;          // 44.1kHz + stereo
+    write_register ( SCI_MODE, _BV ( SM_SDINEW ) | _BV ( SM_LINE1 ) ) ;
+    writeatt ( curatt ) ;                               // Volume is reset to maximum
+    loadPlugins() ;
+  }
+}
+
+bool VS1053::setPlugin ( uint8_t n, const char* name, const uint16_t* img, uint16_t size )
+{
+  if ( n >= PLGMAX )                                    // Legal plugin number?
+  {
+    return false ;
+  }
+  plugins[n].name = name ;
+  plugins[n].img = img ;
+  plugins[n].size = size ;
+  plugins[n].words = 0 ;
+  plugins[n].loadus = 0 ;
+  if ( running && img )                                 // Chip ready for it?
+  {
+    return loadPlugin ( n ) ;                           // Yes, load now
+  }
+  return true ;
+}
+
+bool VS1053::loadPlugin ( uint8_t n )
+{
+  plugin_struct*  p = plugins + n ;                     // The plugin to load
+  const uint16_t* img = p->img ;                        // The image
+  uint16_t        i = 0 ;                               // Index in image
+  uint16_t        reg ;                                 // SCI register of a record
+  uint16_t        count ;                               // Count of a record
+  bool            repeat ;                              // Record with one value
+  uint32_t        words = 0 ;                           // Words written
+  uint32_t        t0 = micros() ;                       // Start of load
+
+  if ( ( n >= PLGMAX ) || ( img == NULL ) || !okay )    // Plugin and chip available?
+  {
+    return false ;
+  }
+  while ( i < p->size )
+  {
+    if ( ( p->size - i ) < 2 )                          // Room for register and count?
+    {
+      break ;                                           // No, image is corrupt
+    }
+    reg = img[i++] ;
+    count = img[i++] ;
+    repeat = ( count & 0x8000 ) != 0 ;                  // One value repeated?
+    count &= 0x7FFF ;
+    if ( ( reg > SCI_num_registers ) ||                 // Check record against end of image
+         ( repeat ? ( i == p->size ) : ( count > ( p->size - i ) ) ) )
+    {
+      break ;                                           // Image is corrupt
+    }
+    sci_multi ( reg, img + i, count, repeat ) ;         // Send this record
+    i += repeat ? 1 : count ;                           // Skip the data
+    words += count ;
+  }
+  p->loadus = micros() - t0 ;
+  p->words = words ;
+  if ( i < p->size )                                    // Stopped before the end?
+  {
+    dbgprint ( "Plugin %s is corrupt at word %d", p->name, i ) ;
+    return false ;
+  }
+  dbgprint ( "Plugin %s loaded, %d words in %d usec", p->name, words, p->loadus ) ;
+  return true ;
+}
+
+void VS1053::loadPlugins()
+{
+  uint8_t n ;                                           // Loop control
+
+  for ( n = 0 ; n < PLGMAX ; n++ )
+  {
+    if ( plugins[n].img )                               // Plugin in use?
+    {
+      loadPlugin ( n ) ;                                // Yes, load it
+    }
+  }
 }
 
 void VS1053::printDetails ( const char *header )
@@ -262,7 +723,7 @@ void VS1053::printDetails ( const char *header )
   dbgprint ( "---   -----" ) ;
   for ( i = 0 ; i <= SCI_num_registers ; i++ )
   {
-    regbuf[i] = read_register ( i ) ;
+    regbuf[i] = sci_read ( i ) ;                        // From the chip, not the shadow
   }
   for ( i = 0 ; i <= SCI_num_registers ; i++ )
   {
@@ -286,12 +747,12 @@ void  VS1053::output_enable ( bool ena )               // Enable amplifier throu
 
 void VS1053::AdjustRate ( long ppm2 )                  // Fine tune the data rate 
 {
-  write_register ( SCI_WRAMADDR, 0x1e07 ) ;
-  write_register ( SCI_WRAM,     ppm2 ) ;
-  write_register ( SCI_WRAM,     ppm2 >> 16 ) ;
+  sciWram ( 0x1e07, ppm2 ) ;
+  sciWram ( 0x1e08, ppm2 >> 16 ) ;
   // oldClock4KHz = 0 forces  adjustment calculation when rate checked.
-  write_register ( SCI_WRAMADDR, 0x5b1c ) ;
-  write_register ( SCI_WRAM,     0 ) ;
-  // Write to AUDATA or CLOCKF checks rate and recalculates adjustment.
-  write_register ( SCI_AUDATA,   read_register ( SCI_AUDATA ) ) ;
+  sciWram ( 0x5b1c, 0 ) ;
+  // Write to AUDATA or CLOCKF checks rate and recalculates adjustment.  CLOCKF is not changed by
+  // the chip, so the value is known without a read.
+  sciBatch ( SCI_CLOCKF, read_register ( SCI_CLOCKF ) ) ;
+  sciCommit() ;
 }
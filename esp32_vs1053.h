@@ -5,6 +5,59 @@
 //**************************************************************************************************
 // VS1053 class definition.                                                                        *
 //**************************************************************************************************
+// A shadow copy of the SCI registers is kept.  Registers that are only written by this class      *
+// (see SCI_CACHED) are read from the shadow copy without touching the bus.  Registers that are    *
+// changed by the chip itself, like SCI_AUDATA, SCI_HDAT0 and SCI_AICTRLx, are always read from    *
+// the chip.  SCI_MODE is cached, but SM_CANCEL is cleared by the chip, so it is polled with       *
+// sci_read().                                                                                     *
+// A sequence of register and WRAM writes may be collected with sciBatch() and sciWram() and is    *
+// sent by sciCommit() within one SPI transaction.  Consecutive WRAM words are sent as one SCI     *
+// multiple write.                                                                                 *
+// Volume changes are ramped.  The attenuation in SCI_VOL (0.5 dB units) moves to the target at a  *
+// rate of RAMPUNITS per rampms msec, so the curve is linear in dB.  The steps are made by         *
+// rampStep(), which is called by playtask between the SDI bursts.  Every step is one SCI write.   *
+// fadeOut() only starts a faster ramp to silence that lasts FADEOUTMAX msec at most.  The caller  *
+// steps it with rampStep() until isRamping() is false.                                            *
+// Plugins and patches of VLSI are loaded from images in the compressed format of VLSI.  Such an   *
+// image is a list of records: register, count and data.  If bit 15 of the count is set, one value *
+// is written count times, else count values follow.  Every record is sent as one SCI multiple     *
+// write.  The plugins are loaded at the end of begin() and again after every softReset().         *
+// The state of the decoder is read by readDecoder() within one SPI transaction.                   *
+//**************************************************************************************************
+#define SCIBATCHSIZ   16                           // Max. number of writes in a batch
+#define RAMPUNITS     80                           // Ramp of 40 dB takes rampms msec
+#define RAMPMAXSTEP   4                            // Max. units in one ramp step
+#define FADEOUTMAX    60                           // Max. duration of a fade-out in msec
+#define VOLSILENT     0xFE                         // Attenuation for silence, analog parts on
+#define PLGMAX        4                            // Max. number of plugins
+#define WRAMSETTLE    12                           // Usec after a WRAM access, 100 CLKI cycles at
+                                                   // 12.288 MHz (before CLOCKF is set) plus margin
+
+struct sciop_struct                                // One write in a batch
+{
+  uint8_t       reg ;                              // SCI register
+  uint16_t      value ;                            // Value to write
+} ;
+
+struct decstat_struct                              // State of the decoder, see readDecoder()
+{
+  uint16_t        status ;                         // SCI_STATUS
+  uint16_t        decodetime ;                     // SCI_DECODE_TIME, seconds decoded
+  uint16_t        audata ;                         // SCI_AUDATA, sample rate and stereo bit
+  uint16_t        hdat0 ;                          // SCI_HDAT0, depends on format
+  uint16_t        hdat1 ;                          // SCI_HDAT1, format of the stream
+  uint16_t        byterate ;                       // byteRate in parametric data, bytes/sec
+} ;
+
+struct plugin_struct                               // A plugin image in compressed VLSI format
+{
+  const char*     name ;                           // Name for reports
+  const uint16_t* img ;                            // Image in flash or RAM, NULL if not used
+  uint16_t        size ;                           // Size of image in words
+  uint16_t        words ;                          // Words written by last load
+  uint32_t        loadus ;                         // Duration of last load in usec
+} ;
+
 class VS1053
 {
   private:
@@ -14,19 +67,33 @@ class VS1053
     int8_t        shutdown_pin ;                   // Pin where the shutdown line is connected
     int8_t        shutdownx_pin ;                  // Pin where the shutdown (inversed) line is connected
     uint8_t       curvol ;                         // Current volume setting 0..100%
+    bool          muted             = false ;     // Output muted by setMute()
+    uint8_t       curatt            = VOLSILENT ; // Attenuation in SCI_VOL now
+    uint8_t       tgtatt            = VOLSILENT ; // Attenuation at end of ramp
+    uint16_t      rampms            = 0 ;         // Time for a ramp of RAMPUNITS, 0 is no ramp
+    uint16_t      curramp           = 0 ;         // Time for RAMPUNITS of the ramp in progress
+    uint32_t      ramplast ;                      // millis() of last ramp step
+    uint32_t      rampsteps         = 0 ;         // Number of ramp steps (statistics)
     const uint8_t vs1053_chunk_size = 32 ;
     // SCI Register
     const uint8_t SCI_MODE          = 0x0 ;
+    const uint8_t SCI_STATUS        = 0x1 ;
     const uint8_t SCI_BASS          = 0x2 ;
     const uint8_t SCI_CLOCKF        = 0x3 ;
+    const uint8_t SCI_DECODE_TIME   = 0x4 ;
     const uint8_t SCI_AUDATA        = 0x5 ;
     const uint8_t SCI_WRAM          = 0x6 ;
     const uint8_t SCI_WRAMADDR      = 0x7 ;
+    const uint8_t SCI_HDAT0         = 0x8 ;
+    const uint8_t SCI_HDAT1         = 0x9 ;
     const uint8_t SCI_AIADDR        = 0xA ;
     const uint8_t SCI_VOL           = 0xB ;
     const uint8_t SCI_AICTRL0       = 0xC ;
     const uint8_t SCI_AICTRL1       = 0xD ;
     const uint8_t SCI_num_registers = 0xF ;
+    // Registers that can be read from the shadow copy: MODE, BASS, CLOCKF and VOL.  AIADDR and
+    // AICTRL0..3 are not cached, because plugins and the firmware write them as well.
+    const uint16_t SCI_CACHED       = 0x080D ;
     // SCI_MODE bits
     const uint8_t SM_SDINEW         = 11 ;        // Bitnumber in SCI_MODE always on
     const uint8_t SM_RESET          = 2 ;         // Bitnumber in SCI_MODE soft reset
@@ -36,6 +103,14 @@ class VS1053
     SPISettings   VS1053_SPI ;                    // SPI settings for this slave
     uint8_t       endFillByte ;                   // Byte to send when stopping song
     bool          okay              = true ;      // VS1053 is working
+    uint16_t      shadow[16] ;                    // Last value written to or read from SCI
+    uint16_t      shadowvalid       = 0 ;         // Bit n set if shadow[n] is valid
+    sciop_struct  batch[SCIBATCHSIZ] ;            // Writes collected by sciBatch()
+    uint8_t       batchcount        = 0 ;         // Number of writes in batch
+    uint32_t      sci_bus           = 0 ;         // SCI operations on the bus
+    uint32_t      sci_cached        = 0 ;         // SCI reads from the shadow copy
+    plugin_struct plugins[PLGMAX]   = {} ;        // Plugins to load after reset
+    bool          running           = false ;     // begin() has set the clock and fast SPI
   protected:
     inline void await_data_request() const
     {
@@ -71,13 +146,26 @@ class VS1053
       SPI.endTransaction() ;                      // Allow other SPI users
     }
 
-    uint16_t    read_register ( uint8_t _reg ) const ;
-    void        write_register ( uint8_t _reg, uint16_t _value ) const ;
+    uint16_t    sci_read ( uint8_t _reg ) ;              // Read register from chip
+    uint16_t    sci_read_cs ( uint8_t _reg ) ;           // Read register, caller did beginTransaction
+    uint16_t    read_register ( uint8_t _reg ) ;         // Read register, from shadow if possible
+    void        write_register ( uint8_t _reg, uint16_t _value ) ;
+    void        update_register ( uint8_t _reg,          // Write register if value differs
+                                  uint16_t _value ) ;
+    inline void set_shadow ( uint8_t _reg, uint16_t _value )
+    {
+      shadow[_reg] = _value ;
+      shadowvalid |= ( 1 << _reg ) ;
+    }
     inline bool sdi_send_buffer ( uint8_t* data, size_t len ) ;
     void        sdi_send_fillers ( size_t length ) ;
+    void        sci_multi ( uint8_t _reg,                // Write words to one register at once
+                            const uint16_t* data, uint16_t n, bool repeat ) ;
     void        wram_write ( uint16_t address, uint16_t data ) ;
     uint16_t    wram_read ( uint16_t address ) ;
     void        output_enable ( bool ena ) ;             // Enable amplifier through shutdown pin(s)
+    void        writeatt ( uint8_t att ) ;               // Set attenuation, both channels
+    void        settarget() ;                            // Start ramp to current volume
 
   public:
     // Constructor.  Only sets pin values.  Doesn't touch the chip.  Be sure to call begin()!
@@ -93,10 +181,28 @@ class VS1053
     // to fifo
     void     stopSong() ;                                // Finish playing a song. Call this after
     // the last playChunk call.
+    bool     cancelSong() ;                              // Fast alternative for stopSong().  Does
+    // not touch the amplifier.  False if cancel failed.
+    void     setMute ( bool on ) ;                       // Mute/unmute through SCI_VOL, amplifier
+    // stays enabled.  Volume changes are delayed until unmute.
     void     setVolume ( uint8_t vol ) ;                 // Set the player volume.Level from 0-100,
     // higher is louder.
     void     setTone ( uint8_t* rtone ) ;                // Set the player baas/treble, 4 nibbles for
     // treble gain/freq and bass gain/freq
+    void     setRampTime ( uint16_t ms ) ;               // Set time for a ramp of 40 dB, 0 = no ramp
+    bool     rampStep() ;                                // One step of the volume ramp, caller owns
+    // the bus.  False if no ramp in progress.
+    void     fadeIn() ;                                  // Ramp up from silence, ends mute
+    void     fadeOut() ;                                 // Start ramp down to silence, mute until
+    // fadeIn().  Ends when isRamping() is false.
+    inline bool isRamping() const                        // Volume ramp in progress?
+    {
+      return curatt != tgtatt ;
+    }
+    inline uint32_t getRampSteps() const                 // Number of ramp steps for statistics
+    {
+      return rampsteps ;
+    }
     inline uint8_t  getVolume() const                    // Get the current volume setting.
     { // higher is louder.
       return curvol ;
@@ -109,6 +215,43 @@ class VS1053
       return ( digitalRead ( dreq_pin ) == HIGH ) ;
     }
     void     AdjustRate ( long ppm2 ) ;                  // Fine tune the datarate
+    void     sciBatch ( uint8_t reg, uint16_t value ) ;  // Add a register write to the batch
+    void     sciWram ( uint16_t address,                 // Add a WRAM write to the batch
+                       uint16_t data ) ;
+    void     sciCommit() ;                               // Send the batch, caller owns the bus
+    void     sciWramRead ( uint16_t address,             // Read n words from WRAM in one
+                           uint16_t* buf, uint16_t n ) ; // transaction, caller owns the bus
+    void     readDecoder ( decstat_struct* ds ) ;        // Read state of the decoder in one
+    // transaction, caller owns the bus
+    static const char* formatName ( uint16_t hdat1 ) ;   // Name of stream format from SCI_HDAT1
+    inline uint32_t getSciBus() const                    // Number of SCI operations on the bus
+    {
+      return sci_bus ;
+    }
+    inline uint32_t getSciCached() const                 // Number of SCI reads from shadow copy
+    {
+      return sci_cached ;
+    }
+    bool     setPlugin ( uint8_t n, const char* name,    // Set plugin n, load it if running.
+                         const uint16_t* img,            // img == NULL removes the plugin.
+                         uint16_t size ) ;               // Caller owns the bus.
+    bool     loadPlugin ( uint8_t n ) ;                  // Load plugin n, caller owns the bus
+    void     loadPlugins() ;                             // Load all plugins, caller owns the bus
+    inline const plugin_struct* getPlugin ( uint8_t n ) const
+    {
+      return ( ( n < PLGMAX ) && plugins[n].img ) ? plugins + n : NULL ;
+    }
+    // Burst mode.  XDCS stays low between burstBegin() and burstEnd().  The caller must check
+    // data_request() before every call of burstChunk() and must own the SPI bus.
+    inline void burstBegin() const                       // Start a burst of SDI transfers
+    {
+      data_mode_on() ;
+    }
+    bool     burstChunk ( uint8_t* data, size_t len ) ;  // Send max. 32 bytes, true if more fits
+    inline void burstEnd() const                         // End a burst of SDI transfers
+    {
+      data_mode_off() ;
+    }
 
 } ;
 